@@ -0,0 +1,215 @@
+#include "BenchmarkReport.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+
+namespace gps {
+
+    void BenchmarkReport::setConfig(const std::string& key, const std::string& value) {
+        config.push_back(std::make_pair(key, value));
+    }
+
+    void BenchmarkReport::addFrame(const Frame& frame) {
+        frames.push_back(frame);
+    }
+
+    void BenchmarkReport::setMetric(const std::string& name, double value) {
+        for (size_t i = 0; i < metrics.size(); i++) {
+            if (metrics[i].first == name) {
+                metrics[i].second = value;
+                return;
+            }
+        }
+        metrics.push_back(std::make_pair(name, value));
+    }
+
+    //nearest rank on sorted samples
+    static double percentile(const std::vector<double>& sorted, double p) {
+        size_t rank = (size_t)std::ceil(p * sorted.size());
+        return sorted[rank > 0 ? rank - 1 : 0];
+    }
+
+    void BenchmarkReport::summarize() {
+        if (frames.empty())
+            return;
+
+        std::vector<double> frameMs, cpuMs;
+        double drawCalls = 0.0, triangles = 0.0;
+        for (size_t i = 0; i < frames.size(); i++) {
+            frameMs.push_back(frames[i].frameMs);
+            cpuMs.push_back(frames[i].cpuMs);
+            drawCalls += (double)frames[i].drawCalls;
+            triangles += (double)frames[i].triangles;
+        }
+
+        const char* names[] = { "frame_ms", "cpu_ms" };
+        std::vector<double>* samples[] = { &frameMs, &cpuMs };
+        for (int s = 0; s < 2; s++) {
+            std::vector<double>& sorted = *samples[s];
+            std::sort(sorted.begin(), sorted.end());
+            double total = 0.0;
+            for (size_t i = 0; i < sorted.size(); i++)
+                total += sorted[i];
+            std::string name = names[s];
+            setMetric(name + "_avg", total / sorted.size());
+            setMetric(name + "_p50", percentile(sorted, 0.50));
+            setMetric(name + "_p95", percentile(sorted, 0.95));
+            setMetric(name + "_p99", percentile(sorted, 0.99));
+            setMetric(name + "_max", sorted.back());
+        }
+        setMetric("draw_calls", drawCalls / frames.size());
+        setMetric("triangles", triangles / frames.size());
+    }
+
+    void BenchmarkReport::print(std::ostream& out) {
+        out << "Benchmark (" << frames.size() << " frames):" << std::endl;
+        for (size_t i = 0; i < metrics.size(); i++)
+            out << "  " << std::left << std::setw(28) << metrics[i].first << std::right << metrics[i].second << std::endl;
+    }
+
+    static void writeJsonString(std::ostream& out, const std::string& text) {
+        out << '"';
+        for (size_t i = 0; i < text.size(); i++) {
+            if (text[i] == '"' || text[i] == '\\')
+                out << '\\';
+            out << text[i];
+        }
+        out << '"';
+    }
+
+    bool BenchmarkReport::writeJson(const std::string& fileName) {
+        std::ofstream file(fileName.c_str());
+        if (!file)
+            return false;
+
+        file << "{" << std::endl << "  \"config\": {" << std::endl;
+        for (size_t i = 0; i < config.size(); i++) {
+            file << "    ";
+            writeJsonString(file, config[i].first);
+            file << ": ";
+            writeJsonString(file, config[i].second);
+            file << (i + 1 < config.size() ? "," : "") << std::endl;
+        }
+        file << "  }," << std::endl << "  \"frames\": " << frames.size() << "," << std::endl << "  \"metrics\": {" << std::endl;
+        file << std::setprecision(6);
+        for (size_t i = 0; i < metrics.size(); i++) {
+            file << "    ";
+            writeJsonString(file, metrics[i].first);
+            file << ": " << metrics[i].second << (i + 1 < metrics.size() ? "," : "") << std::endl;
+        }
+        file << "  }" << std::endl << "}" << std::endl;
+        return true;
+    }
+
+    //reads back what writeJson writes: flat "config" (strings) and "metrics" (numbers) objects
+    bool BenchmarkReport::readJson(const std::string& fileName, std::vector<std::pair<std::string, std::string>>& config,
+        std::vector<std::pair<std::string, double>>& metrics) {
+        std::ifstream file(fileName.c_str());
+        if (!file)
+            return false;
+        std::stringstream buffer;
+        buffer << file.rdbuf();
+        std::string text = buffer.str();
+
+        size_t position = 0;
+        //the next quoted string from position, unescaped; false at the end of the text
+        auto readString = [&text, &position](std::string& value) {
+            position = text.find('"', position);
+            if (position == std::string::npos)
+                return false;
+            value.clear();
+            for (position++; position < text.size() && text[position] != '"'; position++) {
+                if (text[position] == '\\' && position + 1 < text.size())
+                    position++;
+                value += text[position];
+            }
+            position++;
+            return true;
+        };
+
+        std::string section, key, value;
+        while (readString(key)) {
+            size_t colon = text.find(':', position);
+            if (colon == std::string::npos)
+                break;
+            size_t start = text.find_first_not_of(" \t\r\n", colon + 1);
+            if (start == std::string::npos)
+                break;
+            if (text[start] == '{') {
+                section = key;
+                position = start + 1;
+            }
+            else if (text[start] == '"') {
+                position = start;
+                readString(value);
+                if (section == "config")
+                    config.push_back(std::make_pair(key, value));
+            }
+            else {
+                char* end = NULL;
+                double number = std::strtod(text.c_str() + start, &end);
+                position = end - text.c_str();
+                if (section == "metrics")
+                    metrics.push_back(std::make_pair(key, number));
+            }
+            //leaving an object brings the next key back to the top level
+            size_t nextKey = text.find('"', position);
+            size_t close = text.find('}', position);
+            if (close != std::string::npos && close < nextKey)
+                section.clear();
+        }
+        return true;
+    }
+
+    int BenchmarkReport::compareWithBaseline(const std::string& fileName, double threshold, std::ostream& out) {
+        std::vector<std::pair<std::string, std::string>> baselineConfig;
+        std::vector<std::pair<std::string, double>> baselineMetrics;
+        if (!readJson(fileName, baselineConfig, baselineMetrics) || baselineMetrics.empty()) {
+            out << "Could not read benchmark baseline " << fileName << std::endl;
+            return -1;
+        }
+
+        for (size_t i = 0; i < config.size(); i++) {
+            for (size_t b = 0; b < baselineConfig.size(); b++) {
+                if (baselineConfig[b].first == config[i].first && baselineConfig[b].second != config[i].second) {
+                    out << "Warning: baseline " << config[i].first << " is " << baselineConfig[b].second
+                        << ", this run " << config[i].second << std::endl;
+                }
+            }
+        }
+
+        int regressions = 0;
+        //the fixed precision below is the caller's stream state too, put back after every line
+        std::ios_base::fmtflags flags = out.flags();
+        std::streamsize precision = out.precision();
+        out << "Against " << fileName << " (regression above +" << threshold * 100.0 << "%):" << std::endl;
+        for (size_t i = 0; i < metrics.size(); i++) {
+            out << "  " << std::left << std::setw(28) << metrics[i].first << std::right;
+            size_t b = 0;
+            while (b < baselineMetrics.size() && baselineMetrics[b].first != metrics[i].first)
+                b++;
+            if (b == baselineMetrics.size()) {
+                out << metrics[i].second << " (not in baseline)" << std::endl;
+                continue;
+            }
+
+            double baseline = baselineMetrics[b].second;
+            double change = baseline != 0.0 ? (metrics[i].second - baseline) / baseline : 0.0;
+            bool regressed = change > threshold;
+            regressions += regressed ? 1 : 0;
+            out << std::fixed << std::setprecision(3) << baseline << " -> " << metrics[i].second << " ("
+                << std::showpos << std::setprecision(1) << change * 100.0 << std::noshowpos << "%)"
+                << (regressed ? "  REGRESSION" : "") << std::endl;
+            out.flags(flags);
+            out.precision(precision);
+        }
+        out.flags(flags);
+        out.precision(precision);
+        out << regressions << " regression" << (regressions == 1 ? "" : "s") << std::endl;
+        return regressions;
+    }
+}
@@ -0,0 +1,48 @@
+#ifndef BenchmarkReport_hpp
+#define BenchmarkReport_hpp
+
+#include <iostream>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace gps {
+
+    //per-frame samples of a benchmark run, summarized into named metrics that are written as JSON
+    //and compared against an earlier run's file; every metric is a cost, so higher is worse
+    class BenchmarkReport {
+    public:
+        struct Frame {
+            //wall time of the whole frame, gpu included
+            double frameMs;
+            //cpu time until the frame was submitted
+            double cpuMs;
+            long long drawCalls;
+            long long triangles;
+        };
+
+        //run settings, written next to the metrics; a baseline with different ones is still compared, with a warning
+        void setConfig(const std::string& key, const std::string& value);
+        void addFrame(const Frame& frame);
+        //metrics measured elsewhere (e.g. per pass times); the frame ones are added by summarize()
+        void setMetric(const std::string& name, double value);
+        //avg/p50/p95/p99/max of the frame and cpu times, average draws and triangles
+        void summarize();
+
+        void print(std::ostream& out);
+        bool writeJson(const std::string& fileName);
+        //prints every metric next to its baseline value and returns how many grew by more than
+        //threshold (a fraction); -1 if the baseline can't be read
+        int compareWithBaseline(const std::string& fileName, double threshold, std::ostream& out);
+
+    private:
+        std::vector<std::pair<std::string, std::string>> config;
+        std::vector<std::pair<std::string, double>> metrics;
+        std::vector<Frame> frames;
+
+        static bool readJson(const std::string& fileName, std::vector<std::pair<std::string, std::string>>& config,
+            std::vector<std::pair<std::string, double>>& metrics);
+    };
+}
+
+#endif /* BenchmarkReport_hpp */
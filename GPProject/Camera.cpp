@@ -64,4 +64,21 @@ namespace gps {
         this->cameraTarget = this->cameraPosition + this->cameraFrontDirection;
 
     }
-}
\ No newline at end of file
+
+    //place the camera at position looking at target (used by scripted camera paths)
+    void Camera::setPose(glm::vec3 position, glm::vec3 target) {
+        this->cameraPosition = position;
+        this->cameraTarget = target;
+        this->cameraFrontDirection = glm::normalize(target - position);
+        this->cameraRightDirection = glm::normalize(glm::cross(this->cameraFrontDirection, this->worldUp));
+        this->cameraUpDirection = glm::normalize(glm::cross(this->cameraRightDirection, this->cameraFrontDirection));
+
+        //keep yaw and pitch in sync so mouse look continues from the new direction
+        this->pitch = glm::degrees(asin(this->cameraFrontDirection.y));
+        this->yaw = glm::degrees(atan2(this->cameraFrontDirection.z, this->cameraFrontDirection.x));
+    }
+
+    glm::vec3 Camera::getPosition() {
+        return cameraPosition;
+    }
+}
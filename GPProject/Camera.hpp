@@ -23,6 +23,9 @@ namespace gps {
         //yaw - camera rotation around the y axis
         //pitch - camera rotation around the x axis
         void rotate(float pitch, float yaw);
+        //place the camera at position looking at target (used by scripted camera paths)
+        void setPose(glm::vec3 position, glm::vec3 target);
+        glm::vec3 getPosition();
 
     private:
         glm::vec3 cameraPosition;
@@ -0,0 +1,37 @@
+#include "CameraPath.hpp"
+
+#include <cmath>
+
+namespace gps {
+
+    void CameraPath::addKey(glm::vec3 position, glm::vec3 target) {
+        positions.push_back(position);
+        targets.push_back(target);
+    }
+
+    int CameraPath::getKeyCount() {
+        return (int)positions.size();
+    }
+
+    //uniform Catmull-Rom between keys segment and segment + 1, wrapping round the ends
+    glm::vec3 CameraPath::interpolate(const std::vector<glm::vec3>& keys, int segment, float u) {
+        int count = (int)keys.size();
+        const glm::vec3& p0 = keys[(segment + count - 1) % count];
+        const glm::vec3& p1 = keys[segment];
+        const glm::vec3& p2 = keys[(segment + 1) % count];
+        const glm::vec3& p3 = keys[(segment + 2) % count];
+        float u2 = u * u;
+        float u3 = u2 * u;
+        return 0.5f * (2.0f * p1 + (p2 - p0) * u + (2.0f * p0 - 5.0f * p1 + 4.0f * p2 - p3) * u2 +
+            (3.0f * p1 - p0 - 3.0f * p2 + p3) * u3);
+    }
+
+    void CameraPath::sample(float t, glm::vec3& position, glm::vec3& target) {
+        int count = (int)positions.size();
+        float scaled = (t - std::floor(t)) * count;
+        int segment = (int)scaled % count;
+        float u = scaled - std::floor(scaled);
+        position = interpolate(positions, segment, u);
+        target = interpolate(targets, segment, u);
+    }
+}
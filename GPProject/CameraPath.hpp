@@ -0,0 +1,27 @@
+#ifndef CameraPath_hpp
+#define CameraPath_hpp
+
+#include <glm/glm.hpp>
+
+#include <vector>
+
+namespace gps {
+
+    //closed Catmull-Rom spline through camera keys, for scripted flights that replay identically
+    class CameraPath {
+    public:
+        void addKey(glm::vec3 position, glm::vec3 target);
+        int getKeyCount();
+
+        //t in [0, 1) covers the loop once, each segment getting an equal share; needs 2 keys or more
+        void sample(float t, glm::vec3& position, glm::vec3& target);
+
+    private:
+        std::vector<glm::vec3> positions;
+        std::vector<glm::vec3> targets;
+
+        static glm::vec3 interpolate(const std::vector<glm::vec3>& keys, int segment, float u);
+    };
+}
+
+#endif /* CameraPath_hpp */
@@ -0,0 +1,243 @@
+#include "ClusteredLighting.hpp"
+
+#include "CpuProfiler.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+
+namespace gps {
+
+    const int CLUSTER_COUNT = ClusteredLighting::GRID_X * ClusteredLighting::GRID_Y * ClusteredLighting::GRID_Z;
+
+    static void createTextureBuffer(GLuint& buffer, GLuint& texture, GLenum format) {
+        glGenBuffers(1, &buffer);
+        glBindBuffer(GL_TEXTURE_BUFFER, buffer);
+        glBufferData(GL_TEXTURE_BUFFER, 16, NULL, GL_STREAM_DRAW);
+        glGenTextures(1, &texture);
+        glBindTexture(GL_TEXTURE_BUFFER, texture);
+        glTexBuffer(GL_TEXTURE_BUFFER, format, buffer);
+        glBindTexture(GL_TEXTURE_BUFFER, 0);
+        glBindBuffer(GL_TEXTURE_BUFFER, 0);
+    }
+
+    //orphans the old store so the upload never waits on a draw still reading it
+    static void uploadTextureBuffer(GLuint buffer, const void* data, size_t size) {
+        glBindBuffer(GL_TEXTURE_BUFFER, buffer);
+        //an empty store cannot be created, keep a few bytes around instead
+        glBufferData(GL_TEXTURE_BUFFER, std::max(size, (size_t)16), NULL, GL_STREAM_DRAW);
+        if (size > 0)
+            glBufferSubData(GL_TEXTURE_BUFFER, 0, size, data);
+        glBindBuffer(GL_TEXTURE_BUFFER, 0);
+    }
+
+    static bool sphereIntersectsBox(glm::vec3 center, float radius, glm::vec3 boxMin, glm::vec3 boxMax) {
+        glm::vec3 closest = glm::clamp(center, boxMin, boxMax);
+        glm::vec3 offset = center - closest;
+        return glm::dot(offset, offset) <= radius * radius;
+    }
+
+    ClusteredLighting::~ClusteredLighting() {
+        glDeleteTextures(1, &lightTexture);
+        glDeleteTextures(1, &clusterTexture);
+        glDeleteTextures(1, &indexTexture);
+        glDeleteBuffers(1, &lightBuffer);
+        glDeleteBuffers(1, &clusterBuffer);
+        glDeleteBuffers(1, &indexBuffer);
+    }
+
+    void ClusteredLighting::init(int batchCount) {
+        //every batch needs at least one depth slice
+        batchCount = batchCount <= 0 ? GRID_Z : std::min(batchCount, (int)GRID_Z);
+
+        createTextureBuffer(lightBuffer, lightTexture, GL_RGBA32F);
+        createTextureBuffer(clusterBuffer, clusterTexture, GL_RG32UI);
+        createTextureBuffer(indexBuffer, indexTexture, GL_R32UI);
+
+        batches.resize(batchCount);
+        for (int i = 0; i < batchCount; i++) {
+            batches[i].firstSlice = GRID_Z * i / batchCount;
+            batches[i].lastSlice = GRID_Z * (i + 1) / batchCount - 1;
+        }
+        clusterRanges.resize(CLUSTER_COUNT * 2);
+    }
+
+    void ClusteredLighting::setJobSystem(JobSystem* jobs) {
+        this->jobs = jobs;
+    }
+
+    std::vector<PointLight>& ClusteredLighting::getLights() {
+        return lights;
+    }
+
+    //slices are spaced exponentially so clusters stay roughly cubic in view space
+    int ClusteredLighting::sliceOf(float depth) {
+        int slice = (int)std::floor(std::log(depth / zNear) / std::log(zFar / zNear) * GRID_Z);
+        return std::max(0, std::min(slice, GRID_Z - 1));
+    }
+
+    void ClusteredLighting::buildClusterBounds(const glm::mat4& projection) {
+        clusterBounds.resize(CLUSTER_COUNT);
+        float projectionX = projection[0][0];
+        float projectionY = projection[1][1];
+
+        for (int z = 0; z < GRID_Z; z++) {
+            float sliceNear = zNear * std::pow(zFar / zNear, (float)z / GRID_Z);
+            float sliceFar = zNear * std::pow(zFar / zNear, (float)(z + 1) / GRID_Z);
+            for (int y = 0; y < GRID_Y; y++) {
+                float ndcY0 = 2.0f * y / GRID_Y - 1.0f;
+                float ndcY1 = 2.0f * (y + 1) / GRID_Y - 1.0f;
+                for (int x = 0; x < GRID_X; x++) {
+                    float ndcX0 = 2.0f * x / GRID_X - 1.0f;
+                    float ndcX1 = 2.0f * (x + 1) / GRID_X - 1.0f;
+
+                    //the cluster is a frustum slab; bound it by its corners at both depths
+                    ClusterBounds& bounds = clusterBounds[x + GRID_X * (y + GRID_Y * z)];
+                    bounds.min = glm::vec3(
+                        std::min(ndcX0 * sliceNear, ndcX0 * sliceFar) / projectionX,
+                        std::min(ndcY0 * sliceNear, ndcY0 * sliceFar) / projectionY,
+                        -sliceFar);
+                    bounds.max = glm::vec3(
+                        std::max(ndcX1 * sliceNear, ndcX1 * sliceFar) / projectionX,
+                        std::max(ndcY1 * sliceNear, ndcY1 * sliceFar) / projectionY,
+                        -sliceNear);
+                }
+            }
+        }
+        boundsProjection = projection;
+    }
+
+    void ClusteredLighting::assignSlices(SliceBatch& batch, float projectionX, float projectionY) {
+        GPS_PROFILE_FUNCTION();
+        int firstCluster = GRID_X * GRID_Y * batch.firstSlice;
+        int clusterCount = GRID_X * GRID_Y * (batch.lastSlice - batch.firstSlice + 1);
+
+        //(cluster, light) pairs, bucketed by cluster afterwards
+        std::vector<std::pair<GLuint, GLuint>> pairs;
+        batch.counts.assign(clusterCount, 0);
+
+        for (size_t i = 0; i < viewLights.size(); i++) {
+            glm::vec3 center = glm::vec3(viewLights[i]);
+            float radius = viewLights[i].w;
+            float nearDepth = std::max(-center.z - radius, zNear);
+            float farDepth = std::min(-center.z + radius, zFar);
+            if (nearDepth > farDepth)
+                continue;
+
+            int firstSlice = std::max(sliceOf(nearDepth), batch.firstSlice);
+            int lastSlice = std::min(sliceOf(farDepth), batch.lastSlice);
+            if (firstSlice > lastSlice)
+                continue;
+
+            //screen extent of the light's bounding box; x/z is extreme at one of the two depths
+            float left = std::min((center.x - radius) / nearDepth, (center.x - radius) / farDepth) * projectionX;
+            float right = std::max((center.x + radius) / nearDepth, (center.x + radius) / farDepth) * projectionX;
+            float bottom = std::min((center.y - radius) / nearDepth, (center.y - radius) / farDepth) * projectionY;
+            float top = std::max((center.y + radius) / nearDepth, (center.y + radius) / farDepth) * projectionY;
+            if (left > 1.0f || right < -1.0f || bottom > 1.0f || top < -1.0f)
+                continue;
+
+            int firstX = std::max(0, (int)std::floor((left + 1.0f) * 0.5f * GRID_X));
+            int lastX = std::min(GRID_X - 1, (int)std::floor((right + 1.0f) * 0.5f * GRID_X));
+            int firstY = std::max(0, (int)std::floor((bottom + 1.0f) * 0.5f * GRID_Y));
+            int lastY = std::min(GRID_Y - 1, (int)std::floor((top + 1.0f) * 0.5f * GRID_Y));
+
+            for (int z = firstSlice; z <= lastSlice; z++) {
+                for (int y = firstY; y <= lastY; y++) {
+                    for (int x = firstX; x <= lastX; x++) {
+                        int cluster = x + GRID_X * (y + GRID_Y * z);
+                        const ClusterBounds& bounds = clusterBounds[cluster];
+                        GLuint& count = batch.counts[cluster - firstCluster];
+                        if (count < MAX_LIGHTS_PER_CLUSTER && sphereIntersectsBox(center, radius, bounds.min, bounds.max)) {
+                            count++;
+                            pairs.push_back(std::make_pair((GLuint)(cluster - firstCluster), (GLuint)i));
+                        }
+                    }
+                }
+            }
+        }
+
+        //counting sort keeps each cluster's lights contiguous
+        std::vector<GLuint> offsets(clusterCount + 1, 0);
+        for (int c = 0; c < clusterCount; c++)
+            offsets[c + 1] = offsets[c] + batch.counts[c];
+        batch.indices.resize(pairs.size());
+        for (size_t p = 0; p < pairs.size(); p++)
+            batch.indices[offsets[pairs[p].first]++] = pairs[p].second;
+    }
+
+    void ClusteredLighting::update(const glm::mat4& view, const glm::mat4& projection, float zNear, float zFar) {
+        GPS_PROFILE_FUNCTION();
+        auto start = std::chrono::high_resolution_clock::now();
+
+        if (clusterBounds.empty() || projection != boundsProjection || zNear != this->zNear || zFar != this->zFar) {
+            this->zNear = zNear;
+            this->zFar = zFar;
+            buildClusterBounds(projection);
+        }
+
+        //the shader works in eye space, so the lights are moved there once here
+        viewLights.resize(lights.size());
+        std::vector<glm::vec4> lightTexels(lights.size() * 2);
+        for (size_t i = 0; i < lights.size(); i++) {
+            viewLights[i] = glm::vec4(glm::vec3(view * glm::vec4(lights[i].position, 1.0f)), lights[i].radius);
+            lightTexels[i * 2] = viewLights[i];
+            lightTexels[i * 2 + 1] = glm::vec4(lights[i].color, 0.0f);
+        }
+
+        //each batch owns a contiguous block of depth slices, so no locking is needed
+        JobSystem::RangeJob assign = [this, &projection](size_t begin, size_t end) {
+            GPS_PROFILE_SCOPE("lightAssign");
+            for (size_t i = begin; i < end; i++)
+                assignSlices(batches[i], projection[0][0], projection[1][1]);
+        };
+        if (jobs != NULL)
+            jobs->parallelFor(batches.size(), assign);
+        else
+            assign(0, batches.size());
+
+        //batches cover the clusters in order, so concatenating them gives the global list
+        lightIndices.clear();
+        GLuint cluster = 0;
+        for (size_t b = 0; b < batches.size(); b++) {
+            GLuint offset = (GLuint)lightIndices.size();
+            for (size_t c = 0; c < batches[b].counts.size(); c++, cluster++) {
+                clusterRanges[cluster * 2] = offset;
+                clusterRanges[cluster * 2 + 1] = batches[b].counts[c];
+                offset += batches[b].counts[c];
+            }
+            lightIndices.insert(lightIndices.end(), batches[b].indices.begin(), batches[b].indices.end());
+        }
+
+        uploadTextureBuffer(lightBuffer, lightTexels.data(), lightTexels.size() * sizeof(glm::vec4));
+        uploadTextureBuffer(clusterBuffer, clusterRanges.data(), clusterRanges.size() * sizeof(GLuint));
+        uploadTextureBuffer(indexBuffer, lightIndices.data(), lightIndices.size() * sizeof(GLuint));
+
+        lastUpdateMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+    }
+
+    void ClusteredLighting::applyUniforms(gps::Shader& shader, GLuint firstUnit, int screenWidth, int screenHeight) {
+        glActiveTexture(GL_TEXTURE0 + firstUnit);
+        glBindTexture(GL_TEXTURE_BUFFER, lightTexture);
+        glActiveTexture(GL_TEXTURE0 + firstUnit + 1);
+        glBindTexture(GL_TEXTURE_BUFFER, clusterTexture);
+        glActiveTexture(GL_TEXTURE0 + firstUnit + 2);
+        glBindTexture(GL_TEXTURE_BUFFER, indexTexture);
+        glActiveTexture(GL_TEXTURE0);
+
+        glUniform1i(shader.getUniformLocation("pointLights"), firstUnit);
+        glUniform1i(shader.getUniformLocation("lightClusters"), firstUnit + 1);
+        glUniform1i(shader.getUniformLocation("lightIndices"), firstUnit + 2);
+        glUniform3ui(shader.getUniformLocation("clusterGrid"), GRID_X, GRID_Y, GRID_Z);
+        glUniform2f(shader.getUniformLocation("clusterScreenSize"), (float)screenWidth, (float)screenHeight);
+        glUniform2f(shader.getUniformLocation("clusterDepthRange"), zNear, zFar);
+    }
+
+    double ClusteredLighting::getLastUpdateMs() {
+        return lastUpdateMs;
+    }
+
+    size_t ClusteredLighting::getAssignedIndexCount() {
+        return lightIndices.size();
+    }
+}
@@ -0,0 +1,95 @@
+#ifndef ClusteredLighting_hpp
+#define ClusteredLighting_hpp
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+
+#include "JobSystem.hpp"
+#include "Shader.hpp"
+
+#include <vector>
+
+namespace gps {
+
+    struct PointLight {
+        //world space
+        glm::vec3 position;
+        //the light has no effect past this distance
+        float radius;
+        glm::vec3 color;
+    };
+
+    //clustered forward lighting: the view frustum is split into a 3D grid of clusters
+    //(screen tiles x exponential depth slices), point lights are binned into the clusters
+    //they touch on the job system's threads, and basic.frag only loops over its own cluster's lights
+    class ClusteredLighting {
+    public:
+        //must match the grid used by basic.frag through the clusterGrid uniform
+        static const int GRID_X = 16;
+        static const int GRID_Y = 9;
+        static const int GRID_Z = 24;
+        //lights beyond this count are dropped from a cluster
+        static const int MAX_LIGHTS_PER_CLUSTER = 256;
+
+        ~ClusteredLighting();
+
+        //the depth slices are binned in batchCount batches (at most GRID_Z), one job each; 0 gives every
+        //slice its own, so idle threads can take over slices from the busy near ones
+        void init(int batchCount = 0);
+        //NULL (the default) bins every batch on the calling thread
+        void setJobSystem(JobSystem* jobs);
+
+        //lights are edited in place; changes are picked up by the next update
+        std::vector<PointLight>& getLights();
+
+        //bins the lights for the given camera and uploads the cluster lists;
+        //projection must be a symmetric perspective with the given planes
+        void update(const glm::mat4& view, const glm::mat4& projection, float zNear, float zFar);
+
+        //binds the three light buffers to texture units firstUnit..firstUnit+2 and sets the grid uniforms
+        void applyUniforms(gps::Shader& shader, GLuint firstUnit, int screenWidth, int screenHeight);
+
+        //cpu time of the last update (binning and upload)
+        double getLastUpdateMs();
+        size_t getAssignedIndexCount();
+
+    private:
+        struct ClusterBounds {
+            glm::vec3 min;
+            glm::vec3 max;
+        };
+
+        //lights binned by one job for its range of depth slices
+        struct SliceBatch {
+            int firstSlice;
+            int lastSlice;
+            std::vector<GLuint> counts;
+            std::vector<GLuint> indices;
+        };
+
+        JobSystem* jobs = NULL;
+        std::vector<PointLight> lights;
+        std::vector<ClusterBounds> clusterBounds;
+        glm::mat4 boundsProjection;
+        float zNear = 0.0f;
+        float zFar = 0.0f;
+
+        //light position (view space) and radius
+        std::vector<glm::vec4> viewLights;
+        std::vector<SliceBatch> batches;
+        std::vector<GLuint> clusterRanges;
+        std::vector<GLuint> lightIndices;
+        double lastUpdateMs = 0.0;
+
+        //texture buffers: lights (RGBA32F, 2 texels each), cluster offset/count (RG32UI), light indices (R32UI)
+        GLuint lightBuffer = 0, lightTexture = 0;
+        GLuint clusterBuffer = 0, clusterTexture = 0;
+        GLuint indexBuffer = 0, indexTexture = 0;
+
+        int sliceOf(float depth);
+        void buildClusterBounds(const glm::mat4& projection);
+        void assignSlices(SliceBatch& batch, float projectionX, float projectionY);
+    };
+}
+
+#endif /* ClusteredLighting_hpp */
@@ -0,0 +1,158 @@
+#include "CpuProfiler.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <mutex>
+#include <vector>
+
+namespace gps {
+
+    struct ProfileEvent {
+        const char* name;
+        long long startNs;
+        long long endNs;
+    };
+
+    //one per thread that ever recorded; a finished thread's buffer is handed to the next new one
+    struct ThreadBuffer {
+        std::vector<ProfileEvent> events;
+        //total zones written, the ring position is written % RING_SIZE
+        std::atomic<unsigned long long> written;
+        const char* name;
+        int id;
+        bool inUse;
+    };
+
+    static std::atomic<bool> profilerEnabled(false);
+    static std::mutex registryMutex;
+    static std::vector<ThreadBuffer*> threadBuffers;
+    static const std::chrono::steady_clock::time_point profilerEpoch = std::chrono::steady_clock::now();
+
+    struct ThreadBufferHandle {
+        ThreadBuffer* buffer = NULL;
+        //kept here so naming a thread allocates nothing while the profiler is off
+        const char* name = "worker";
+
+        ~ThreadBufferHandle() {
+            if (buffer != NULL) {
+                std::lock_guard<std::mutex> lock(registryMutex);
+                buffer->inUse = false;
+            }
+        }
+    };
+
+    static thread_local ThreadBufferHandle threadBuffer;
+
+    static ThreadBuffer* getThreadBuffer() {
+        if (threadBuffer.buffer != NULL)
+            return threadBuffer.buffer;
+
+        std::lock_guard<std::mutex> lock(registryMutex);
+        for (size_t i = 0; i < threadBuffers.size(); i++) {
+            if (!threadBuffers[i]->inUse) {
+                threadBuffers[i]->inUse = true;
+                threadBuffers[i]->name = threadBuffer.name;
+                threadBuffer.buffer = threadBuffers[i];
+                return threadBuffer.buffer;
+            }
+        }
+        ThreadBuffer* buffer = new ThreadBuffer();
+        buffer->events.resize(CpuProfiler::RING_SIZE);
+        buffer->written = 0;
+        buffer->name = threadBuffer.name;
+        buffer->id = (int)threadBuffers.size() + 1;
+        buffer->inUse = true;
+        threadBuffers.push_back(buffer);
+        threadBuffer.buffer = buffer;
+        return buffer;
+    }
+
+    void CpuProfiler::setEnabled(bool enabled) {
+        profilerEnabled.store(enabled);
+    }
+
+    bool CpuProfiler::isEnabled() {
+        return profilerEnabled.load(std::memory_order_relaxed);
+    }
+
+    void CpuProfiler::setThreadName(const char* name) {
+        threadBuffer.name = name;
+        if (threadBuffer.buffer != NULL) {
+            std::lock_guard<std::mutex> lock(registryMutex);
+            threadBuffer.buffer->name = name;
+        }
+    }
+
+    long long CpuProfiler::now() {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - profilerEpoch).count();
+    }
+
+    void CpuProfiler::record(const char* name, long long startNs, long long endNs) {
+        ThreadBuffer* buffer = getThreadBuffer();
+        unsigned long long index = buffer->written.load(std::memory_order_relaxed);
+        ProfileEvent& event = buffer->events[index % RING_SIZE];
+        event.name = name;
+        event.startNs = startNs;
+        event.endNs = endNs;
+        //publishes the zone to the exporter
+        buffer->written.store(index + 1, std::memory_order_release);
+    }
+
+    static void writeJsonString(std::ofstream& file, const char* text) {
+        file << '"';
+        for (const char* c = text; *c != '\0'; c++) {
+            if (*c == '"' || *c == '\\')
+                file << '\\';
+            file << *c;
+        }
+        file << '"';
+    }
+
+    bool CpuProfiler::writeChromeTrace(const std::string& fileName) {
+        std::ofstream file(fileName.c_str());
+        if (!file)
+            return false;
+
+        std::lock_guard<std::mutex> lock(registryMutex);
+        file << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[" << std::endl;
+        bool first = true;
+        for (size_t t = 0; t < threadBuffers.size(); t++) {
+            ThreadBuffer* buffer = threadBuffers[t];
+            file << (first ? "" : ",\n") << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << buffer->id
+                << ",\"args\":{\"name\":";
+            writeJsonString(file, buffer->name);
+            file << "}}";
+            first = false;
+
+            unsigned long long written = buffer->written.load(std::memory_order_acquire);
+            unsigned long long oldest = written > (unsigned long long)RING_SIZE ? written - RING_SIZE : 0;
+            for (unsigned long long i = oldest; i < written; i++) {
+                const ProfileEvent& event = buffer->events[i % RING_SIZE];
+                //complete events, microseconds
+                file << ",\n{\"name\":";
+                writeJsonString(file, event.name);
+                file << ",\"ph\":\"X\",\"pid\":1,\"tid\":" << buffer->id << ",\"ts\":" << event.startNs / 1000.0
+                    << ",\"dur\":" << (event.endNs - event.startNs) / 1000.0 << "}";
+            }
+        }
+        file << "\n]}" << std::endl;
+        return true;
+    }
+
+    void CpuProfiler::clear() {
+        std::lock_guard<std::mutex> lock(registryMutex);
+        for (size_t t = 0; t < threadBuffers.size(); t++)
+            threadBuffers[t]->written.store(0);
+    }
+
+    ProfileScope::ProfileScope(const char* name) {
+        this->name = CpuProfiler::isEnabled() ? name : NULL;
+        start = this->name != NULL ? CpuProfiler::now() : 0;
+    }
+
+    ProfileScope::~ProfileScope() {
+        if (name != NULL)
+            CpuProfiler::record(name, start, CpuProfiler::now());
+    }
+}
@@ -0,0 +1,59 @@
+#ifndef CpuProfiler_hpp
+#define CpuProfiler_hpp
+
+#include <string>
+
+//zones are compiled in for debug builds, or for any build that defines GPS_ENABLE_PROFILER;
+//otherwise the macros below expand to nothing
+#if !defined(NDEBUG) || defined(GPS_ENABLE_PROFILER)
+#define GPS_PROFILER_COMPILED 1
+#define GPS_PROFILE_CONCAT_INNER(a, b) a##b
+#define GPS_PROFILE_CONCAT(a, b) GPS_PROFILE_CONCAT_INNER(a, b)
+//name must outlive the trace export (a literal, or a string owned by a long lived object)
+#define GPS_PROFILE_SCOPE(name) gps::ProfileScope GPS_PROFILE_CONCAT(profileScope, __LINE__)(name)
+#define GPS_PROFILE_FUNCTION() GPS_PROFILE_SCOPE(__FUNCTION__)
+#define GPS_PROFILE_THREAD(name) gps::CpuProfiler::setThreadName(name)
+#else
+#define GPS_PROFILER_COMPILED 0
+#define GPS_PROFILE_SCOPE(name) ((void)0)
+#define GPS_PROFILE_FUNCTION() ((void)0)
+#define GPS_PROFILE_THREAD(name) ((void)0)
+#endif
+
+namespace gps {
+
+    //cpu zone profiler: every thread records finished zones into its own fixed ring buffer, without
+    //locks, and the rings are exported as a Chrome trace (chrome://tracing, ui.perfetto.dev)
+    class CpuProfiler {
+    public:
+        //zones kept per thread; older ones are overwritten
+        static const int RING_SIZE = 1 << 16;
+
+        //while disabled a zone costs one relaxed atomic load
+        static void setEnabled(bool enabled);
+        static bool isEnabled();
+
+        //label of the calling thread in the trace
+        static void setThreadName(const char* name);
+
+        //nanoseconds since the profiler started
+        static long long now();
+        static void record(const char* name, long long startNs, long long endNs);
+
+        //best taken between frames: zones being written meanwhile may come out torn
+        static bool writeChromeTrace(const std::string& fileName);
+        static void clear();
+    };
+
+    class ProfileScope {
+    public:
+        explicit ProfileScope(const char* name);
+        ~ProfileScope();
+
+    private:
+        const char* name;
+        long long start;
+    };
+}
+
+#endif /* CpuProfiler_hpp */
@@ -0,0 +1,141 @@
+#include "DepthPrepass.hpp"
+
+namespace gps {
+
+    const float DepthPrepass::ENABLE_OVERDRAW = 1.5f;
+    const float DepthPrepass::DISABLE_OVERDRAW = 1.25f;
+
+    const char* getDepthPrepassModeName(DepthPrepassMode mode) {
+        switch (mode) {
+        case DEPTH_PREPASS_OFF:
+            return "off";
+        case DEPTH_PREPASS_ON:
+            return "on";
+        case DEPTH_PREPASS_AUTO:
+            return "auto";
+        default:
+            return "unknown";
+        }
+    }
+
+    DepthPrepass::~DepthPrepass() {
+        if (!created)
+            return;
+        for (int i = 0; i < FRAME_COUNT; i++) {
+            glDeleteQueries(1, &frames[i].depthQuery);
+            glDeleteQueries(1, &frames[i].litQuery);
+        }
+    }
+
+    void DepthPrepass::setMode(DepthPrepassMode mode) {
+        this->mode = mode;
+    }
+
+    DepthPrepassMode DepthPrepass::getMode() {
+        return mode;
+    }
+
+    void DepthPrepass::collect() {
+        for (int i = 0; i < FRAME_COUNT; i++) {
+            Frame& frame = frames[i];
+            if (!frame.pending)
+                continue;
+            //the lit query ends last, so once it is available the depth one is too
+            GLint available = 0;
+            glGetQueryObjectiv(frame.litQuery, GL_QUERY_RESULT_AVAILABLE, &available);
+            if (!available)
+                continue;
+
+            GLuint64 litSamples = 0;
+            glGetQueryObjectui64v(frame.litQuery, GL_QUERY_RESULT, &litSamples);
+            if (frame.prepass) {
+                glGetQueryObjectui64v(frame.depthQuery, GL_QUERY_RESULT, &shadedSamples);
+                visibleSamples = litSamples;
+            }
+            else {
+                shadedSamples = litSamples;
+            }
+            frame.pending = false;
+        }
+    }
+
+    bool DepthPrepass::beginFrame(bool available) {
+        if (!created) {
+            for (int i = 0; i < FRAME_COUNT; i++) {
+                glGenQueries(1, &frames[i].depthQuery);
+                glGenQueries(1, &frames[i].litQuery);
+                frames[i].pending = false;
+            }
+            created = true;
+        }
+
+        collect();
+
+        if (mode == DEPTH_PREPASS_AUTO) {
+            float overdraw = getOverdraw();
+            if (!active && overdraw > ENABLE_OVERDRAW)
+                active = true;
+            else if (active && overdraw < DISABLE_OVERDRAW)
+                active = false;
+        }
+        else {
+            active = mode == DEPTH_PREPASS_ON;
+        }
+
+        bool prepass = active;
+        //the visible count goes stale while the pre-pass is off, refresh it now and then
+        if (mode == DEPTH_PREPASS_AUTO && !active && ++framesSinceProbe >= PROBE_INTERVAL)
+            prepass = true;
+        prepass = prepass && available;
+        if (prepass)
+            framesSinceProbe = 0;
+
+        //every slot still in flight: draw, but do not measure this frame
+        if (frames[next].pending) {
+            current = -1;
+            return prepass;
+        }
+        current = next;
+        next = (next + 1) % FRAME_COUNT;
+        frames[current].prepass = prepass;
+        return prepass;
+    }
+
+    void DepthPrepass::beginDepthPass() {
+        if (current != -1)
+            glBeginQuery(GL_SAMPLES_PASSED, frames[current].depthQuery);
+    }
+
+    void DepthPrepass::endDepthPass() {
+        if (current != -1)
+            glEndQuery(GL_SAMPLES_PASSED);
+    }
+
+    void DepthPrepass::beginLitPass() {
+        if (current != -1)
+            glBeginQuery(GL_SAMPLES_PASSED, frames[current].litQuery);
+    }
+
+    void DepthPrepass::endLitPass() {
+        if (current == -1)
+            return;
+        glEndQuery(GL_SAMPLES_PASSED);
+        frames[current].pending = true;
+        current = -1;
+    }
+
+    float DepthPrepass::getOverdraw() {
+        if (visibleSamples == 0)
+            return 1.0f;
+        return (float)shadedSamples / visibleSamples;
+    }
+
+    bool DepthPrepass::isActive() {
+        return active;
+    }
+
+    void DepthPrepass::printStats(std::ostream& out) {
+        out << "Depth pre-pass: " << getDepthPrepassModeName(mode) << (active ? " (running)" : " (skipped)")
+            << ", overdraw " << getOverdraw() << " (" << shadedSamples << " shaded / " << visibleSamples << " visible samples)" << std::endl;
+    }
+}
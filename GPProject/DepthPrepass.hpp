@@ -0,0 +1,75 @@
+#ifndef DepthPrepass_hpp
+#define DepthPrepass_hpp
+
+#include <GL/glew.h>
+
+#include <iostream>
+
+namespace gps {
+
+    enum DepthPrepassMode {
+        DEPTH_PREPASS_OFF = 0,
+        DEPTH_PREPASS_ON = 1,
+        //on while the measured overdraw is high enough to pay for the extra geometry pass
+        DEPTH_PREPASS_AUTO = 2,
+        DEPTH_PREPASS_MODE_COUNT = 3
+    };
+
+    const char* getDepthPrepassModeName(DepthPrepassMode mode);
+
+    //decides per frame whether the opaque pass gets a depth-only pre-pass, from GL_SAMPLES_PASSED
+    //counts read back a few frames late: with the pre-pass on, its samples are what the lit pass
+    //would have shaded without it and the lit pass samples are the visible pixels
+    class DepthPrepass {
+    public:
+        ~DepthPrepass();
+
+        void setMode(DepthPrepassMode mode);
+        DepthPrepassMode getMode();
+
+        //true when this frame should draw the pre-pass; available is false while the
+        //pre-pass program cannot be used yet
+        bool beginFrame(bool available);
+        //bracket the depth-only draws and the lit draws of the frame
+        void beginDepthPass();
+        void endDepthPass();
+        void beginLitPass();
+        void endLitPass();
+
+        //shaded fragments per visible pixel without a pre-pass, 1 when nothing is known yet
+        float getOverdraw();
+        bool isActive();
+        void printStats(std::ostream& out);
+
+    private:
+        static const int FRAME_COUNT = 4;
+        //turn on above, off below; the gap keeps the mode from flipping every frame
+        static const float ENABLE_OVERDRAW;
+        static const float DISABLE_OVERDRAW;
+        //with the pre-pass off, one frame in this many still runs it to refresh the visible pixel count
+        static const int PROBE_INTERVAL = 30;
+
+        struct Frame {
+            GLuint depthQuery;
+            GLuint litQuery;
+            bool prepass;
+            bool pending;
+        };
+
+        Frame frames[FRAME_COUNT];
+        bool created = false;
+        //slot of the frame being recorded, -1 if all slots are still in flight
+        int current = -1;
+        int next = 0;
+
+        DepthPrepassMode mode = DEPTH_PREPASS_AUTO;
+        bool active = false;
+        int framesSinceProbe = 0;
+        GLuint64 shadedSamples = 0;
+        GLuint64 visibleSamples = 0;
+
+        void collect();
+    };
+}
+
+#endif /* DepthPrepass_hpp */
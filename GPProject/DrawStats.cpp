@@ -0,0 +1,21 @@
+#include "DrawStats.hpp"
+
+namespace gps {
+
+    //only the thread owning the GL context draws, so plain counters do
+    static DrawStats drawStats = { 0, 0 };
+
+    void countDraw(long long triangles) {
+        drawStats.drawCalls++;
+        drawStats.triangles += triangles;
+    }
+
+    DrawStats getDrawStats() {
+        return drawStats;
+    }
+
+    void resetDrawStats() {
+        drawStats.drawCalls = 0;
+        drawStats.triangles = 0;
+    }
+}
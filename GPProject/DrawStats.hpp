@@ -0,0 +1,19 @@
+#ifndef DrawStats_hpp
+#define DrawStats_hpp
+
+namespace gps {
+
+    //draws submitted since the last reset, counted where the glDraw* calls are made
+    struct DrawStats {
+        long long drawCalls;
+        //indirect draws count every command, including the ones the gpu culls to 0 instances
+        long long triangles;
+    };
+
+    //one multi draw indirect call counts once, whatever its command count
+    void countDraw(long long triangles);
+    DrawStats getDrawStats();
+    void resetDrawStats();
+}
+
+#endif /* DrawStats_hpp */
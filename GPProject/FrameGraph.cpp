@@ -0,0 +1,363 @@
+#include "FrameGraph.hpp"
+
+#include "CpuProfiler.hpp"
+
+#include <chrono>
+#include <iomanip>
+#include <set>
+#include <stdexcept>
+
+namespace gps {
+
+    static bool isDepthFormat(GLenum internalFormat) {
+        return internalFormat == GL_DEPTH_COMPONENT || internalFormat == GL_DEPTH_COMPONENT16 ||
+            internalFormat == GL_DEPTH_COMPONENT24 || internalFormat == GL_DEPTH_COMPONENT32F;
+    }
+
+    RenderTargetPool::~RenderTargetPool() {
+        for (size_t i = 0; i < targets.size(); i++) {
+            glDeleteFramebuffers(1, &targets[i].framebuffer);
+            glDeleteTextures(1, &targets[i].texture);
+        }
+    }
+
+    int RenderTargetPool::acquire(const RenderTargetDesc& desc) {
+        for (size_t i = 0; i < targets.size(); i++) {
+            const RenderTargetDesc& other = targets[i].desc;
+            if (!inUse[i] && other.width == desc.width && other.height == desc.height &&
+                other.internalFormat == desc.internalFormat) {
+                inUse[i] = true;
+                return (int)i;
+            }
+        }
+
+        targets.push_back(createTarget(desc));
+        inUse.push_back(true);
+        return (int)targets.size() - 1;
+    }
+
+    void RenderTargetPool::release(int index) {
+        inUse[index] = false;
+    }
+
+    const RenderTarget& RenderTargetPool::get(int index) const {
+        return targets[index];
+    }
+
+    size_t RenderTargetPool::size() const {
+        return targets.size();
+    }
+
+    RenderTarget RenderTargetPool::createTarget(const RenderTargetDesc& desc) {
+        RenderTarget target;
+        target.desc = desc;
+        bool depth = isDepthFormat(desc.internalFormat);
+
+        glGenTextures(1, &target.texture);
+        glBindTexture(GL_TEXTURE_2D, target.texture);
+        if (depth) {
+            glTexImage2D(GL_TEXTURE_2D, 0, desc.internalFormat, desc.width, desc.height, 0,
+                GL_DEPTH_COMPONENT, GL_FLOAT, NULL);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+            //everything outside the map is treated as lit
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_BORDER);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_BORDER);
+            GLfloat borderColor[] = { 1.0f, 1.0f, 1.0f, 1.0f };
+            glTexParameterfv(GL_TEXTURE_2D, GL_TEXTURE_BORDER_COLOR, borderColor);
+        }
+        else {
+            glTexImage2D(GL_TEXTURE_2D, 0, desc.internalFormat, desc.width, desc.height, 0,
+                GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        }
+        glBindTexture(GL_TEXTURE_2D, 0);
+
+        glGenFramebuffers(1, &target.framebuffer);
+        glBindFramebuffer(GL_FRAMEBUFFER, target.framebuffer);
+        if (depth) {
+            glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, target.texture, 0);
+            glDrawBuffer(GL_NONE);
+            glReadBuffer(GL_NONE);
+        }
+        else {
+            glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, target.texture, 0);
+        }
+        if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+            std::cout << "Render target " << desc.width << "x" << desc.height << " is incomplete" << std::endl;
+        }
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+        return target;
+    }
+
+    int FrameGraph::findResource(const std::string& name) const {
+        std::map<std::string, int>::const_iterator it = resourceIndices.find(name);
+        if (it == resourceIndices.end()) {
+            throw std::runtime_error("Frame graph resource not declared: " + name);
+        }
+        return it->second;
+    }
+
+    int FrameGraph::declareResource(const std::string& name) {
+        if (resourceIndices.count(name)) {
+            throw std::runtime_error("Frame graph resource declared twice: " + name);
+        }
+        Resource resource;
+        resource.name = name;
+        resource.transient = false;
+        resource.output = false;
+        resource.desc = RenderTargetDesc{ 0, 0, GL_NONE };
+        resource.framebuffer = 0;
+        resource.texture = 0;
+        resource.poolIndex = -1;
+        resources.push_back(resource);
+        resourceIndices[name] = (int)resources.size() - 1;
+        compiled = false;
+        return (int)resources.size() - 1;
+    }
+
+    void FrameGraph::createTransient(const std::string& name, RenderTargetDesc desc) {
+        Resource& resource = resources[declareResource(name)];
+        resource.transient = true;
+        resource.desc = desc;
+    }
+
+    void FrameGraph::importResource(const std::string& name, GLuint framebuffer, GLuint texture) {
+        Resource& resource = resources[declareResource(name)];
+        resource.framebuffer = framebuffer;
+        resource.texture = texture;
+    }
+
+    void FrameGraph::markOutput(const std::string& name) {
+        resources[findResource(name)].output = true;
+        compiled = false;
+    }
+
+    void FrameGraph::addPass(const std::string& name,
+        std::vector<std::string> reads,
+        std::vector<std::string> writes,
+        ExecuteFunction execute) {
+        Pass pass;
+        pass.name = name;
+        for (size_t i = 0; i < reads.size(); i++)
+            pass.reads.push_back(findResource(reads[i]));
+        for (size_t i = 0; i < writes.size(); i++)
+            pass.writes.push_back(findResource(writes[i]));
+        pass.execute = execute;
+        pass.culled = false;
+        pass.totalMs = 0.0;
+        pass.frames = 0;
+        passes.push_back(pass);
+        compiled = false;
+    }
+
+    void FrameGraph::compile() {
+        size_t passCount = passes.size();
+
+        //build the dependency edges: a read depends on the writers declared before the
+        //reader (or on any writer if the resource is only produced later), and writes
+        //to the same resource keep their declaration order
+        std::vector<std::set<int>> dependencies(passCount);
+        for (size_t p = 0; p < passCount; p++) {
+            for (size_t r = 0; r < passes[p].reads.size(); r++) {
+                int resource = passes[p].reads[r];
+                std::vector<int> earlier, later;
+                for (size_t w = 0; w < passCount; w++) {
+                    if (w == p)
+                        continue;
+                    for (size_t k = 0; k < passes[w].writes.size(); k++) {
+                        if (passes[w].writes[k] == resource) {
+                            (w < p ? earlier : later).push_back((int)w);
+                            break;
+                        }
+                    }
+                }
+                std::vector<int>& writers = earlier.empty() ? later : earlier;
+                dependencies[p].insert(writers.begin(), writers.end());
+            }
+            for (size_t k = 0; k < passes[p].writes.size(); k++) {
+                for (int w = (int)p - 1; w >= 0; w--) {
+                    bool writesSame = false;
+                    for (size_t j = 0; j < passes[w].writes.size(); j++)
+                        writesSame = writesSame || passes[w].writes[j] == passes[p].writes[k];
+                    if (writesSame) {
+                        dependencies[p].insert(w);
+                        break;
+                    }
+                }
+            }
+        }
+
+        //topological sort, ties broken by declaration order
+        std::vector<int> sorted;
+        std::vector<bool> done(passCount, false);
+        while (sorted.size() < passCount) {
+            int next = -1;
+            for (size_t p = 0; p < passCount && next == -1; p++) {
+                if (done[p])
+                    continue;
+                bool ready = true;
+                for (std::set<int>::iterator it = dependencies[p].begin(); it != dependencies[p].end(); ++it)
+                    ready = ready && done[*it];
+                if (ready)
+                    next = (int)p;
+            }
+            if (next == -1) {
+                throw std::runtime_error("Frame graph has a dependency cycle");
+            }
+            done[next] = true;
+            sorted.push_back(next);
+        }
+
+        //cull: walk backwards from the outputs, keeping only passes whose writes are consumed
+        std::vector<bool> needed(resources.size(), false);
+        for (size_t i = 0; i < resources.size(); i++)
+            needed[i] = resources[i].output;
+        for (int i = (int)sorted.size() - 1; i >= 0; i--) {
+            Pass& pass = passes[sorted[i]];
+            pass.culled = true;
+            for (size_t k = 0; k < pass.writes.size(); k++)
+                pass.culled = pass.culled && !needed[pass.writes[k]];
+            if (!pass.culled) {
+                for (size_t r = 0; r < pass.reads.size(); r++)
+                    needed[pass.reads[r]] = true;
+            }
+        }
+
+        order.clear();
+        for (size_t i = 0; i < sorted.size(); i++) {
+            if (!passes[sorted[i]].culled)
+                order.push_back(sorted[i]);
+        }
+
+        //assign pool targets; a transient is acquired at its first use and released
+        //after its last one, so a later transient with the same desc aliases it
+        for (size_t i = 0; i < resources.size(); i++) {
+            if (resources[i].poolIndex != -1) {
+                pool.release(resources[i].poolIndex);
+                resources[i].poolIndex = -1;
+            }
+        }
+        std::vector<int> firstUse(resources.size(), -1), lastUse(resources.size(), -1);
+        for (size_t i = 0; i < order.size(); i++) {
+            const Pass& pass = passes[order[i]];
+            std::vector<int> used(pass.reads);
+            used.insert(used.end(), pass.writes.begin(), pass.writes.end());
+            for (size_t k = 0; k < used.size(); k++) {
+                if (firstUse[used[k]] == -1)
+                    firstUse[used[k]] = (int)i;
+                lastUse[used[k]] = (int)i;
+            }
+        }
+        for (size_t i = 0; i < order.size(); i++) {
+            for (size_t r = 0; r < resources.size(); r++) {
+                if (resources[r].transient && firstUse[r] == (int)i)
+                    resources[r].poolIndex = pool.acquire(resources[r].desc);
+            }
+            for (size_t r = 0; r < resources.size(); r++) {
+                if (resources[r].transient && lastUse[r] == (int)i)
+                    pool.release(resources[r].poolIndex);
+            }
+        }
+
+        compiled = true;
+    }
+
+    void FrameGraph::execute() {
+        if (!compiled)
+            compile();
+
+        if (gpuProfiler != NULL)
+            gpuProfiler->beginFrame();
+        for (size_t i = 0; i < order.size(); i++) {
+            Pass& pass = passes[order[i]];
+            GPS_PROFILE_SCOPE(pass.name.c_str());
+            std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+            if (gpuProfiler != NULL)
+                gpuProfiler->beginZone(pass.name);
+            pass.execute();
+            if (gpuProfiler != NULL)
+                gpuProfiler->endZone();
+            std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+            pass.totalMs += elapsed.count();
+            pass.frames++;
+        }
+        if (gpuProfiler != NULL)
+            gpuProfiler->endFrame();
+    }
+
+    void FrameGraph::setGpuProfiler(gps::GpuProfiler* profiler) {
+        gpuProfiler = profiler;
+    }
+
+    GLuint FrameGraph::getFramebuffer(const std::string& name) const {
+        const Resource& resource = resources[findResource(name)];
+        if (resource.transient)
+            return resource.poolIndex == -1 ? 0 : pool.get(resource.poolIndex).framebuffer;
+        return resource.framebuffer;
+    }
+
+    GLuint FrameGraph::getTexture(const std::string& name) const {
+        const Resource& resource = resources[findResource(name)];
+        if (resource.transient)
+            return resource.poolIndex == -1 ? 0 : pool.get(resource.poolIndex).texture;
+        return resource.texture;
+    }
+
+    void FrameGraph::printGraph(std::ostream& out) const {
+        std::ios_base::fmtflags flags = out.flags();
+        out << "Frame graph: " << order.size() << " of " << passes.size() << " passes live, "
+            << pool.size() << " pooled render targets" << std::endl;
+        for (size_t i = 0; i < order.size(); i++) {
+            const Pass& pass = passes[order[i]];
+            out << "  [" << i << "] " << std::left << std::setw(12) << pass.name << " reads:";
+            for (size_t r = 0; r < pass.reads.size(); r++)
+                out << " " << resources[pass.reads[r]].name;
+            out << "  writes:";
+            for (size_t w = 0; w < pass.writes.size(); w++)
+                out << " " << resources[pass.writes[w]].name;
+            out << std::endl;
+        }
+        for (size_t i = 0; i < passes.size(); i++) {
+            if (passes[i].culled)
+                out << "  culled: " << passes[i].name << std::endl;
+        }
+        for (size_t i = 0; i < resources.size(); i++) {
+            const Resource& resource = resources[i];
+            if (!resource.transient)
+                continue;
+            out << "  " << resource.name << " " << resource.desc.width << "x" << resource.desc.height;
+            if (resource.poolIndex == -1)
+                out << " -> unused" << std::endl;
+            else
+                out << " -> pool target #" << resource.poolIndex << std::endl;
+        }
+        out.flags(flags);
+    }
+
+    std::vector<FrameGraph::PassTiming> FrameGraph::takeTimings() {
+        std::vector<PassTiming> timings;
+        for (size_t i = 0; i < order.size(); i++) {
+            Pass& pass = passes[order[i]];
+            timings.push_back({ pass.name, pass.frames > 0 ? pass.totalMs / pass.frames : 0.0, pass.frames });
+            pass.totalMs = 0.0;
+            pass.frames = 0;
+        }
+        return timings;
+    }
+
+    void FrameGraph::printTimings(std::ostream& out) {
+        std::vector<PassTiming> timings = takeTimings();
+        std::ios_base::fmtflags flags = out.flags();
+        out << "Frame graph cpu timings:" << std::endl;
+        for (size_t i = 0; i < timings.size(); i++) {
+            out << "  " << std::left << std::setw(12) << timings[i].name << std::fixed << std::setprecision(3)
+                << timings[i].averageMs << " ms (" << timings[i].frames << " frames)" << std::endl;
+        }
+        out.flags(flags);
+    }
+}
@@ -0,0 +1,123 @@
+#ifndef FrameGraph_hpp
+#define FrameGraph_hpp
+
+#include <GL/glew.h>
+
+#include "GpuProfiler.hpp"
+
+#include <functional>
+#include <iostream>
+#include <map>
+#include <string>
+#include <vector>
+
+namespace gps {
+
+    struct RenderTargetDesc {
+        GLsizei width;
+        GLsizei height;
+        //GL_DEPTH_COMPONENT* formats get a depth attachment, everything else a color attachment
+        GLenum internalFormat;
+    };
+
+    struct RenderTarget {
+        RenderTargetDesc desc;
+        GLuint texture;
+        GLuint framebuffer;
+    };
+
+    //hands out render targets and takes them back, so transient resources whose
+    //lifetimes do not overlap end up sharing the same GL texture
+    class RenderTargetPool {
+    public:
+        ~RenderTargetPool();
+
+        //returns the index of a free target matching desc, creating one if needed
+        int acquire(const RenderTargetDesc& desc);
+        void release(int index);
+
+        const RenderTarget& get(int index) const;
+        size_t size() const;
+
+    private:
+        std::vector<RenderTarget> targets;
+        std::vector<bool> inUse;
+
+        RenderTarget createTarget(const RenderTargetDesc& desc);
+    };
+
+    class FrameGraph {
+    public:
+        typedef std::function<void()> ExecuteFunction;
+
+        //declares a render target owned by the graph and backed by the pool
+        void createTransient(const std::string& name, RenderTargetDesc desc);
+        //declares a resource owned by someone else (e.g. the default framebuffer)
+        void importResource(const std::string& name, GLuint framebuffer, GLuint texture = 0);
+        //resources that must be produced every frame; passes not contributing to them are culled
+        void markOutput(const std::string& name);
+
+        void addPass(const std::string& name,
+            std::vector<std::string> reads,
+            std::vector<std::string> writes,
+            ExecuteFunction execute);
+
+        //orders the passes, culls the unused ones and assigns pool targets to transients
+        void compile();
+        //runs every live pass exactly once, in compiled order
+        void execute();
+
+        GLuint getFramebuffer(const std::string& name) const;
+        GLuint getTexture(const std::string& name) const;
+
+        void printGraph(std::ostream& out) const;
+        struct PassTiming {
+            std::string name;
+            double averageMs;
+            int frames;
+        };
+        //per-pass cpu averages accumulated since the last call (of this or printTimings), in execution order; resets them
+        std::vector<PassTiming> takeTimings();
+        //prints the per-pass averages accumulated since the last call and resets them
+        void printTimings(std::ostream& out);
+        //every execute() becomes a profiler frame with one gpu zone per pass; NULL detaches it
+        void setGpuProfiler(gps::GpuProfiler* profiler);
+
+    private:
+        struct Resource {
+            std::string name;
+            bool transient;
+            bool output;
+            RenderTargetDesc desc;
+            GLuint framebuffer;
+            GLuint texture;
+            //pool slot assigned by compile(), -1 for imported resources
+            int poolIndex;
+        };
+
+        struct Pass {
+            std::string name;
+            std::vector<int> reads;
+            std::vector<int> writes;
+            ExecuteFunction execute;
+            bool culled;
+            //accumulated cpu time since the last printTimings()
+            double totalMs;
+            int frames;
+        };
+
+        std::vector<Resource> resources;
+        std::map<std::string, int> resourceIndices;
+        std::vector<Pass> passes;
+        //indices into passes, in execution order, culled passes excluded
+        std::vector<int> order;
+        RenderTargetPool pool;
+        bool compiled = false;
+        gps::GpuProfiler* gpuProfiler = NULL;
+
+        int findResource(const std::string& name) const;
+        int declareResource(const std::string& name);
+    };
+}
+
+#endif /* FrameGraph_hpp */
@@ -0,0 +1,172 @@
+#include "FramePacer.hpp"
+
+#include <GLFW/glfw3.h>
+
+#include <algorithm>
+#include <cmath>
+#include <thread>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#include <mmsystem.h>
+#pragma comment(lib, "winmm.lib")
+#endif
+
+namespace gps {
+
+    const char* getVsyncModeName(VsyncMode mode) {
+        switch (mode) {
+        case VSYNC_OFF:
+            return "off";
+        case VSYNC_ON:
+            return "on";
+        case VSYNC_ADAPTIVE:
+            return "adaptive";
+        default:
+            return "unknown";
+        }
+    }
+
+    FramePacer::FramePacer() {
+        histogram.assign(HISTOGRAM_BUCKETS, 0);
+#ifdef _WIN32
+        //the default scheduler tick is ~15.6 ms, far too coarse to sleep part of a frame
+        timeBeginPeriod(1);
+#endif
+    }
+
+    FramePacer::~FramePacer() {
+#ifdef _WIN32
+        timeEndPeriod(1);
+#endif
+    }
+
+    void FramePacer::setVsyncMode(VsyncMode mode) {
+        vsyncMode = mode;
+        resetStats();
+        //headless (see gps::Window::CreateHeadless): no glfw context, nothing is presented
+        if (glfwGetCurrentContext() == NULL)
+            return;
+        int interval = mode == VSYNC_OFF ? 0 : 1;
+        if (mode == VSYNC_ADAPTIVE) {
+            if (glfwExtensionSupported("WGL_EXT_swap_control_tear") || glfwExtensionSupported("GLX_EXT_swap_control_tear"))
+                interval = -1;
+            else
+                std::cout << "Adaptive vsync is not supported here, using vsync on" << std::endl;
+        }
+        glfwSwapInterval(interval);
+    }
+
+    VsyncMode FramePacer::getVsyncMode() {
+        return vsyncMode;
+    }
+
+    void FramePacer::setFrameCap(float fps) {
+        frameCap = std::max(fps, 0.0f);
+        resetStats();
+    }
+
+    float FramePacer::getFrameCap() {
+        return frameCap;
+    }
+
+    void FramePacer::setIdleFrameCap(float fps) {
+        idleFrameCap = std::max(fps, 0.0f);
+    }
+
+    //sleeps in 1 ms steps while the estimate says a step surely ends before the target, then spins
+    void FramePacer::waitUntil(Clock::time_point target) {
+        while (true) {
+            double remainingMs = std::chrono::duration<double, std::milli>(target - Clock::now()).count();
+            double estimateMs = sleepMeanMs + std::sqrt(sleepM2 / sleepSamples);
+            if (remainingMs <= estimateMs)
+                break;
+
+            Clock::time_point start = Clock::now();
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            double sleptMs = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+
+            sleepSamples++;
+            double delta = sleptMs - sleepMeanMs;
+            sleepMeanMs += delta / sleepSamples;
+            sleepM2 += delta * (sleptMs - sleepMeanMs);
+        }
+        while (Clock::now() < target)
+            std::this_thread::yield();
+    }
+
+    void FramePacer::beginFrame(bool idle) {
+        float cap = idle && idleFrameCap > 0.0f && (frameCap == 0.0f || idleFrameCap < frameCap) ? idleFrameCap : frameCap;
+        Clock::time_point now = Clock::now();
+
+        if (started && cap > 0.0f) {
+            Clock::duration period = std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(1.0 / cap));
+            deadline += period;
+            //a frame that overran restarts the schedule rather than rushing the next ones to catch up
+            if (deadline < now)
+                deadline = now;
+            else
+                waitUntil(deadline);
+            now = Clock::now();
+        }
+        else {
+            deadline = now;
+        }
+
+        if (started)
+            recordFrame(std::chrono::duration<double, std::milli>(now - lastFrame).count());
+        lastFrame = now;
+        started = true;
+    }
+
+    void FramePacer::recordFrame(double ms) {
+        int bucket = std::min((int)ms, HISTOGRAM_BUCKETS - 1);
+        histogram[bucket]++;
+        totalMs += ms;
+        totalSquaredMs += ms * ms;
+        if (frames > 0)
+            totalDeltaMs += std::abs(ms - previousMs);
+        previousMs = ms;
+        maxMs = std::max(maxMs, ms);
+        frames++;
+    }
+
+    void FramePacer::resetStats() {
+        histogram.assign(HISTOGRAM_BUCKETS, 0);
+        totalMs = 0.0;
+        totalSquaredMs = 0.0;
+        totalDeltaMs = 0.0;
+        previousMs = 0.0;
+        maxMs = 0.0;
+        frames = 0;
+    }
+
+    void FramePacer::printStats(std::ostream& out) {
+        out << "Frame pacing: vsync " << getVsyncModeName(vsyncMode) << ", cap ";
+        if (frameCap > 0.0f)
+            out << frameCap << " fps";
+        else
+            out << "off";
+        if (idleFrameCap > 0.0f)
+            out << " (" << idleFrameCap << " fps idle)";
+        out << std::endl;
+        if (frames == 0)
+            return;
+
+        double avgMs = totalMs / frames;
+        double stdDevMs = std::sqrt(std::max(totalSquaredMs / frames - avgMs * avgMs, 0.0));
+        double jitterMs = frames > 1 ? totalDeltaMs / (frames - 1) : 0.0;
+        out << "  " << frames << " frames, avg " << avgMs << " ms (" << 1000.0 / avgMs << " fps), max " << maxMs
+            << " ms, std dev " << stdDevMs << " ms, frame to frame jitter " << jitterMs << " ms" << std::endl;
+
+        int peak = *std::max_element(histogram.begin(), histogram.end());
+        for (int i = 0; i < HISTOGRAM_BUCKETS; i++) {
+            if (histogram[i] == 0)
+                continue;
+            out << "  " << (i < 10 ? " " : "") << i << (i == HISTOGRAM_BUCKETS - 1 ? "+ ms " : "  ms ")
+                << std::string(std::max(1, 40 * histogram[i] / peak), '#') << " " << histogram[i] << std::endl;
+        }
+    }
+}
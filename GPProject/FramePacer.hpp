@@ -0,0 +1,76 @@
+#ifndef FramePacer_hpp
+#define FramePacer_hpp
+
+#include <chrono>
+#include <iostream>
+#include <vector>
+
+namespace gps {
+
+    enum VsyncMode {
+        VSYNC_OFF,
+        VSYNC_ON,
+        //swaps late frames straight away instead of waiting a whole refresh; plain vsync where unsupported
+        VSYNC_ADAPTIVE,
+        VSYNC_MODE_COUNT
+    };
+
+    const char* getVsyncModeName(VsyncMode mode);
+
+    //paces the main loop: picks the swap interval, optionally caps the frame rate (lower still while
+    //idle) and keeps a histogram of the frame times it measured
+    class FramePacer {
+    public:
+        //histogram buckets, one millisecond wide; the last one also holds everything slower
+        static const int HISTOGRAM_BUCKETS = 50;
+
+        FramePacer();
+        ~FramePacer();
+
+        //applies to the current glfw context; adaptive falls back to on without the swap_control_tear extension
+        void setVsyncMode(VsyncMode mode);
+        VsyncMode getVsyncMode();
+        //frames per second, 0 for uncapped
+        void setFrameCap(float fps);
+        float getFrameCap();
+        //cap used instead while the loop reports nothing is changing (10 fps by default), 0 to never throttle
+        void setIdleFrameCap(float fps);
+
+        //call once per frame before doing any work: waits out the rest of the previous frame's
+        //slot, then records how long that frame took
+        void beginFrame(bool idle);
+
+        void resetStats();
+        void printStats(std::ostream& out);
+
+    private:
+        typedef std::chrono::steady_clock Clock;
+
+        VsyncMode vsyncMode = VSYNC_ON;
+        float frameCap = 0.0f;
+        float idleFrameCap = 10.0f;
+        bool started = false;
+        Clock::time_point deadline;
+        Clock::time_point lastFrame;
+
+        //running estimate of how long a 1 ms sleep really takes (Welford mean and variance);
+        //the last stretch before a deadline is spun instead of slept
+        double sleepMeanMs = 1.0;
+        double sleepM2 = 0.0;
+        long long sleepSamples = 1;
+
+        std::vector<int> histogram;
+        double totalMs = 0.0;
+        double totalSquaredMs = 0.0;
+        //sum of |frame - previous frame|, how uneven consecutive frames are
+        double totalDeltaMs = 0.0;
+        double previousMs = 0.0;
+        double maxMs = 0.0;
+        int frames = 0;
+
+        void waitUntil(Clock::time_point target);
+        void recordFrame(double ms);
+    };
+}
+
+#endif /* FramePacer_hpp */
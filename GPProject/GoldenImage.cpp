@@ -0,0 +1,142 @@
+#include "GoldenImage.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+
+namespace gps {
+
+    bool readTga(const std::string& fileName, Image& image) {
+        std::ifstream file(fileName.c_str(), std::ios::binary);
+        unsigned char header[18];
+        if (!file.read((char*)header, sizeof(header)))
+            return false;
+
+        int imageType = header[2];
+        int width = header[12] | (header[13] << 8);
+        int height = header[14] | (header[15] << 8);
+        int bitsPerPixel = header[16];
+        bool topToBottom = (header[17] & 0x20) != 0;
+        if (imageType != 2 || (bitsPerPixel != 24 && bitsPerPixel != 32) || width == 0 || height == 0)
+            return false;
+        file.seekg(header[0], std::ios::cur);
+
+        int bytesPerPixel = bitsPerPixel / 8;
+        std::vector<unsigned char> data((size_t)width * height * bytesPerPixel);
+        if (!file.read((char*)data.data(), data.size()))
+            return false;
+
+        image.width = width;
+        image.height = height;
+        image.pixels.resize((size_t)width * height * 4);
+        for (int y = 0; y < height; y++) {
+            int row = topToBottom ? height - 1 - y : y;
+            for (int x = 0; x < width; x++) {
+                const unsigned char* source = &data[((size_t)row * width + x) * bytesPerPixel];
+                unsigned char* target = &image.pixels[((size_t)y * width + x) * 4];
+                //stored BGR(A)
+                target[0] = source[2];
+                target[1] = source[1];
+                target[2] = source[0];
+                target[3] = bytesPerPixel == 4 ? source[3] : 255;
+            }
+        }
+        return true;
+    }
+
+    bool writeTga(const std::string& fileName, const Image& image) {
+        std::ofstream file(fileName.c_str(), std::ios::binary);
+        if (!file)
+            return false;
+
+        unsigned char header[18] = {};
+        header[2] = 2;
+        header[12] = image.width & 0xff;
+        header[13] = (image.width >> 8) & 0xff;
+        header[14] = image.height & 0xff;
+        header[15] = (image.height >> 8) & 0xff;
+        header[16] = 32;
+        //8 alpha bits, rows bottom to top
+        header[17] = 8;
+        file.write((const char*)header, sizeof(header));
+
+        std::vector<unsigned char> data(image.pixels.size());
+        for (size_t i = 0; i < image.pixels.size(); i += 4) {
+            data[i] = image.pixels[i + 2];
+            data[i + 1] = image.pixels[i + 1];
+            data[i + 2] = image.pixels[i];
+            data[i + 3] = image.pixels[i + 3];
+        }
+        file.write((const char*)data.data(), data.size());
+        return (bool)file;
+    }
+
+    //sRGB byte to CIELAB, D65 white
+    static void toLab(const unsigned char* rgb, double lab[3]) {
+        double linear[3];
+        for (int c = 0; c < 3; c++) {
+            double value = rgb[c] / 255.0;
+            linear[c] = value <= 0.04045 ? value / 12.92 : std::pow((value + 0.055) / 1.055, 2.4);
+        }
+        double xyz[3] = {
+            (0.4124 * linear[0] + 0.3576 * linear[1] + 0.1805 * linear[2]) / 0.95047,
+            0.2126 * linear[0] + 0.7152 * linear[1] + 0.0722 * linear[2],
+            (0.0193 * linear[0] + 0.1192 * linear[1] + 0.9505 * linear[2]) / 1.08883
+        };
+        for (int c = 0; c < 3; c++)
+            xyz[c] = xyz[c] > 0.008856 ? std::cbrt(xyz[c]) : 7.787 * xyz[c] + 16.0 / 116.0;
+        lab[0] = 116.0 * xyz[1] - 16.0;
+        lab[1] = 500.0 * (xyz[0] - xyz[1]);
+        lab[2] = 200.0 * (xyz[1] - xyz[2]);
+    }
+
+    ImageDifference compareImages(const Image& golden, const Image& actual, double tolerance) {
+        ImageDifference result = { 0, 0.0, 0.0, 0.0, Image() };
+        int pixelCount = golden.width * golden.height;
+        //a size change fails every pixel
+        if (golden.width != actual.width || golden.height != actual.height) {
+            result.differingPixels = std::max(pixelCount, actual.width * actual.height);
+            result.differingFraction = 1.0;
+            result.meanDeltaE = result.maxDeltaE = 100.0;
+            result.diff = actual;
+            return result;
+        }
+
+        result.diff.width = golden.width;
+        result.diff.height = golden.height;
+        result.diff.pixels.resize(golden.pixels.size());
+        double total = 0.0;
+        for (int i = 0; i < pixelCount; i++) {
+            const unsigned char* expected = &golden.pixels[(size_t)i * 4];
+            const unsigned char* got = &actual.pixels[(size_t)i * 4];
+            double deltaE = 0.0;
+            if (expected[0] != got[0] || expected[1] != got[1] || expected[2] != got[2]) {
+                double labExpected[3], labGot[3];
+                toLab(expected, labExpected);
+                toLab(got, labGot);
+                deltaE = std::sqrt((labExpected[0] - labGot[0]) * (labExpected[0] - labGot[0]) +
+                    (labExpected[1] - labGot[1]) * (labExpected[1] - labGot[1]) +
+                    (labExpected[2] - labGot[2]) * (labExpected[2] - labGot[2]));
+            }
+            total += deltaE;
+            result.maxDeltaE = std::max(result.maxDeltaE, deltaE);
+
+            unsigned char* diff = &result.diff.pixels[(size_t)i * 4];
+            if (deltaE > tolerance) {
+                result.differingPixels++;
+                diff[0] = (unsigned char)std::min(255.0, 128.0 + deltaE * 4.0);
+                diff[1] = 0;
+                diff[2] = 0;
+            }
+            else {
+                //dimmed, so the red stands out
+                unsigned char gray = (unsigned char)((expected[0] * 77 + expected[1] * 150 + expected[2] * 29) >> 9);
+                diff[0] = diff[1] = diff[2] = gray;
+            }
+            diff[3] = 255;
+        }
+        result.meanDeltaE = pixelCount > 0 ? total / pixelCount : 0.0;
+        result.differingFraction = pixelCount > 0 ? (double)result.differingPixels / pixelCount : 0.0;
+        return result;
+    }
+}
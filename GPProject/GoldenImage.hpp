@@ -0,0 +1,35 @@
+#ifndef GoldenImage_hpp
+#define GoldenImage_hpp
+
+#include <string>
+#include <vector>
+
+namespace gps {
+
+    //8 bit RGBA, rows bottom to top as glReadPixels returns them
+    struct Image {
+        int width = 0;
+        int height = 0;
+        std::vector<unsigned char> pixels;
+    };
+
+    struct ImageDifference {
+        //pixels whose color difference is above the tolerance
+        int differingPixels;
+        double differingFraction;
+        double meanDeltaE;
+        double maxDeltaE;
+        //the golden in gray, differing pixels in red, brighter the larger the difference
+        Image diff;
+    };
+
+    //uncompressed 24 or 32 bit TGA, the only kind writeTga produces
+    bool readTga(const std::string& fileName, Image& image);
+    bool writeTga(const std::string& fileName, const Image& image);
+
+    //per pixel CIE76 delta E (Lab, from sRGB), so the tolerance follows what is visible rather than
+    //raw channel values: about 2.3 is a just noticeable difference; alpha is ignored
+    ImageDifference compareImages(const Image& golden, const Image& actual, double tolerance);
+}
+
+#endif /* GoldenImage_hpp */
@@ -0,0 +1,228 @@
+#include "GpuDrivenRenderer.hpp"
+
+#include "CpuProfiler.hpp"
+#include "DrawStats.hpp"
+#include "ShaderPermutations.hpp"
+
+#include <glm/gtc/type_ptr.hpp>
+
+#include <map>
+#include <utility>
+
+namespace gps {
+
+    //layout glMultiDrawElementsIndirect reads, mirrored by Command in cullDraws.comp
+    struct DrawElementsIndirectCommand {
+        GLuint count;
+        GLuint instanceCount;
+        GLuint firstIndex;
+        GLint baseVertex;
+        GLuint baseInstance;
+    };
+
+    //must match local_size_x in cullDraws.comp
+    const GLuint CULL_GROUP_SIZE = 64;
+
+    GpuDrivenRenderer::~GpuDrivenRenderer() {
+        if (!initialized)
+            return;
+        glDeleteVertexArrays(1, &vao);
+        glDeleteBuffers(1, &vertexBuffer);
+        glDeleteBuffers(1, &indexBuffer);
+        glDeleteBuffers(1, &transformBuffer);
+        glDeleteBuffers(1, &boundsBuffer);
+        glDeleteBuffers(1, &recordBuffer);
+        glDeleteBuffers(1, &commandBuffer);
+    }
+
+    bool GpuDrivenRenderer::isSupported() {
+        return GLEW_VERSION_4_3 == GL_TRUE;
+    }
+
+    void GpuDrivenRenderer::addObject(gps::Model3D* object, const glm::mat4* modelMatrix, unsigned features) {
+        objects.push_back({ object, modelMatrix, features | SHADER_FEATURE_INSTANCED });
+    }
+
+    bool GpuDrivenRenderer::isInitialized() {
+        return initialized;
+    }
+
+    void GpuDrivenRenderer::init(const std::string& cullShaderFileName) {
+        //meshes grouped by material; a mesh shared by several objects is packed once
+        typedef std::pair<unsigned, std::vector<GLuint>> MaterialKey;
+        std::map<MaterialKey, size_t> groupIndices;
+        std::vector<std::vector<std::pair<GLuint, const gps::Mesh*>>> groupDraws;
+        std::map<const gps::Mesh*, std::pair<GLuint, GLint>> packedMeshes;
+        std::vector<gps::Vertex> vertices;
+        std::vector<GLuint> indices;
+
+        for (size_t i = 0; i < objects.size(); i++) {
+            const std::vector<gps::Mesh>& meshes = objects[i].model->getMeshes();
+            for (size_t m = 0; m < meshes.size(); m++) {
+                const gps::Mesh& mesh = meshes[m];
+                if (packedMeshes.find(&mesh) == packedMeshes.end()) {
+                    packedMeshes[&mesh] = std::make_pair((GLuint)indices.size(), (GLint)vertices.size());
+                    vertices.insert(vertices.end(), mesh.vertices.begin(), mesh.vertices.end());
+                    indices.insert(indices.end(), mesh.indices.begin(), mesh.indices.end());
+                }
+
+                MaterialKey key(objects[i].features, std::vector<GLuint>());
+                for (size_t t = 0; t < mesh.textures.size(); t++)
+                    key.second.push_back(mesh.textures[t].id);
+                if (groupIndices.find(key) == groupIndices.end()) {
+                    groupIndices[key] = groups.size();
+                    groups.push_back({ objects[i].features, mesh.textures, 0, 0 });
+                    groupDraws.push_back(std::vector<std::pair<GLuint, const gps::Mesh*>>());
+                }
+                groupDraws[groupIndices[key]].push_back(std::make_pair((GLuint)i, &mesh));
+            }
+        }
+
+        for (size_t g = 0; g < groups.size(); g++) {
+            groups[g].firstCommand = (GLuint)records.size();
+            groups[g].commandCount = (GLsizei)groupDraws[g].size();
+            for (size_t d = 0; d < groupDraws[g].size(); d++) {
+                const gps::Mesh* mesh = groupDraws[g][d].second;
+                std::pair<GLuint, GLint> offsets = packedMeshes[mesh];
+                records.push_back({ (GLuint)mesh->indices.size(), offsets.first, offsets.second, groupDraws[g][d].first });
+            }
+        }
+
+        std::vector<glm::vec4> bounds(objects.size());
+        for (size_t i = 0; i < objects.size(); i++) {
+            gps::BoundingSphere sphere = objects[i].model->getBoundingSphere();
+            bounds[i] = glm::vec4(sphere.center, sphere.radius);
+        }
+        transforms.resize(objects.size());
+
+        glGenBuffers(1, &vertexBuffer);
+        glGenBuffers(1, &indexBuffer);
+        glGenBuffers(1, &transformBuffer);
+        glGenBuffers(1, &boundsBuffer);
+        glGenBuffers(1, &recordBuffer);
+        glGenBuffers(1, &commandBuffer);
+
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, boundsBuffer);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, bounds.size() * sizeof(glm::vec4), bounds.data(), GL_STATIC_DRAW);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, recordBuffer);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, records.size() * sizeof(DrawRecord), records.data(), GL_STATIC_DRAW);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, commandBuffer);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, records.size() * sizeof(DrawElementsIndirectCommand), NULL, GL_DYNAMIC_COPY);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+        //same vertex layout as gps::Mesh, plus the instance transform basic.vert reads under INSTANCED
+        glGenVertexArrays(1, &vao);
+        glBindVertexArray(vao);
+        glBindBuffer(GL_ARRAY_BUFFER, vertexBuffer);
+        glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(gps::Vertex), vertices.data(), GL_STATIC_DRAW);
+        glEnableVertexAttribArray(0);
+        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(gps::Vertex), (GLvoid*)0);
+        glEnableVertexAttribArray(1);
+        glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(gps::Vertex), (GLvoid*)offsetof(gps::Vertex, Normal));
+        glEnableVertexAttribArray(2);
+        glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(gps::Vertex), (GLvoid*)offsetof(gps::Vertex, TexCoords));
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexBuffer);
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(GLuint), indices.data(), GL_STATIC_DRAW);
+
+        //each command's baseInstance is its object, so instance 0 fetches that object's matrix
+        glBindBuffer(GL_ARRAY_BUFFER, transformBuffer);
+        glBufferData(GL_ARRAY_BUFFER, transforms.size() * sizeof(glm::mat4), NULL, GL_DYNAMIC_DRAW);
+        for (GLuint column = 0; column < 4; column++) {
+            glEnableVertexAttribArray(3 + column);
+            glVertexAttribPointer(3 + column, 4, GL_FLOAT, GL_FALSE, sizeof(glm::mat4), (GLvoid*)(sizeof(glm::vec4) * column));
+            glVertexAttribDivisor(3 + column, 1);
+        }
+        glBindVertexArray(0);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+        cullShader.loadComputeShader(cullShaderFileName);
+        initialized = true;
+
+        std::cout << "GPU-driven renderer: " << records.size() << " draws in " << groups.size() << " materials, "
+            << vertices.size() << " vertices" << std::endl;
+    }
+
+    void GpuDrivenRenderer::cull(const glm::mat4& view, const glm::mat4& projection) {
+        GPS_PROFILE_FUNCTION();
+        for (size_t i = 0; i < objects.size(); i++)
+            transforms[i] = *objects[i].modelMatrix;
+        glBindBuffer(GL_ARRAY_BUFFER, transformBuffer);
+        glBufferSubData(GL_ARRAY_BUFFER, 0, transforms.size() * sizeof(glm::mat4), transforms.data());
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+        //world space frustum planes, rows of the view projection matrix added and subtracted
+        glm::mat4 viewProjection = projection * view;
+        glm::vec4 rows[4];
+        for (int r = 0; r < 4; r++)
+            rows[r] = glm::vec4(viewProjection[0][r], viewProjection[1][r], viewProjection[2][r], viewProjection[3][r]);
+        glm::vec4 planes[6] = {
+            rows[3] + rows[0], rows[3] - rows[0],
+            rows[3] + rows[1], rows[3] - rows[1],
+            rows[3] + rows[2], rows[3] - rows[2]
+        };
+        for (int p = 0; p < 6; p++)
+            planes[p] /= glm::length(glm::vec3(planes[p]));
+
+        cullShader.useShaderProgram();
+        glUniform4fv(cullShader.getUniformLocation("frustumPlanes"), 6, glm::value_ptr(planes[0]));
+        glUniform1ui(cullShader.getUniformLocation("drawCount"), (GLuint)records.size());
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, transformBuffer);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, boundsBuffer);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, recordBuffer);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, commandBuffer);
+        glDispatchCompute(((GLuint)records.size() + CULL_GROUP_SIZE - 1) / CULL_GROUP_SIZE, 1, 1);
+        //the draws read the commands as indirect arguments
+        glMemoryBarrier(GL_COMMAND_BARRIER_BIT);
+    }
+
+    void GpuDrivenRenderer::drawDepth() {
+        GPS_PROFILE_FUNCTION();
+        glBindVertexArray(vao);
+        glBindBuffer(GL_DRAW_INDIRECT_BUFFER, commandBuffer);
+        glMultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT, 0, (GLsizei)records.size(), 0);
+        countDraw(countTriangles(0, (GLsizei)records.size()));
+        glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+        glBindVertexArray(0);
+    }
+
+    void GpuDrivenRenderer::drawLit(const std::function<gps::Shader&(unsigned features)>& useShader) {
+        GPS_PROFILE_FUNCTION();
+        glBindVertexArray(vao);
+        glBindBuffer(GL_DRAW_INDIRECT_BUFFER, commandBuffer);
+        for (size_t g = 0; g < groups.size(); g++) {
+            const MaterialGroup& group = groups[g];
+            gps::Shader& shader = useShader(group.features);
+
+            //same bindings gps::Mesh::Draw makes
+            for (GLuint t = 0; t < group.textures.size(); t++) {
+                glActiveTexture(GL_TEXTURE0 + t);
+                glUniform1i(shader.getUniformLocation(group.textures[t].type), t);
+                glBindTexture(GL_TEXTURE_2D, group.textures[t].id);
+            }
+
+            glMultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT,
+                (GLvoid*)(group.firstCommand * sizeof(DrawElementsIndirectCommand)), group.commandCount, 0);
+            countDraw(countTriangles(group.firstCommand, group.commandCount));
+
+            for (GLuint t = 0; t < group.textures.size(); t++) {
+                glActiveTexture(GL_TEXTURE0 + t);
+                glBindTexture(GL_TEXTURE_2D, 0);
+            }
+        }
+        glActiveTexture(GL_TEXTURE0);
+        glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+        glBindVertexArray(0);
+    }
+
+    long long GpuDrivenRenderer::countTriangles(GLuint firstRecord, GLsizei recordCount) {
+        long long triangles = 0;
+        for (GLsizei r = 0; r < recordCount; r++)
+            triangles += records[firstRecord + r].count / 3;
+        return triangles;
+    }
+
+    void GpuDrivenRenderer::printStats(std::ostream& out) {
+        out << "GPU-driven: " << objects.size() << " objects, " << records.size() << " draw records, "
+            << groups.size() << " indirect calls in the lit pass, 1 in the depth pass" << std::endl;
+    }
+}
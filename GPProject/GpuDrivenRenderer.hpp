@@ -0,0 +1,88 @@
+#ifndef GpuDrivenRenderer_hpp
+#define GpuDrivenRenderer_hpp
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+
+#include "Shader.hpp"
+#include "Model3D.hpp"
+
+#include <functional>
+#include <iostream>
+#include <string>
+#include <vector>
+
+namespace gps {
+
+    //gpu-driven submission for GL 4.3 contexts: every mesh lives in one vertex and index buffer,
+    //the object transforms and bounds in storage buffers, and a compute pass frustum culls one draw
+    //record per (object, mesh) into glMultiDrawElementsIndirect commands; the depth-only pass is a
+    //single call and the lit pass one call per material (permutation and texture set)
+    class GpuDrivenRenderer {
+    public:
+        ~GpuDrivenRenderer();
+
+        //compute shaders, storage buffers and multi draw indirect
+        static bool isSupported();
+
+        //features select the permutation of the object's material; SHADER_FEATURE_INSTANCED is added
+        void addObject(gps::Model3D* object, const glm::mat4* modelMatrix, unsigned features);
+        //packs the meshes and builds the draw records, once the models are loaded
+        void init(const std::string& cullShaderFileName);
+        bool isInitialized();
+
+        //uploads the transforms and writes this frame's commands; projection and view of the camera
+        void cull(const glm::mat4& view, const glm::mat4& projection);
+        //every object in one call; the program in use reads the model matrix from location 3
+        void drawDepth();
+        //one call per material; useShader binds and returns the program for a feature set
+        void drawLit(const std::function<gps::Shader&(unsigned features)>& useShader);
+
+        void printStats(std::ostream& out);
+
+    private:
+        struct Object {
+            gps::Model3D* model;
+            const glm::mat4* modelMatrix;
+            unsigned features;
+        };
+
+        //mirrors DrawRecord in cullDraws.comp (std430)
+        struct DrawRecord {
+            GLuint count;
+            GLuint firstIndex;
+            GLint baseVertex;
+            GLuint object;
+        };
+
+        //draws sharing a program and textures, their commands are contiguous
+        struct MaterialGroup {
+            unsigned features;
+            std::vector<gps::Texture> textures;
+            GLuint firstCommand;
+            GLsizei commandCount;
+        };
+
+        std::vector<Object> objects;
+        std::vector<DrawRecord> records;
+        std::vector<MaterialGroup> groups;
+        std::vector<glm::mat4> transforms;
+        bool initialized = false;
+
+        GLuint vao = 0;
+        GLuint vertexBuffer = 0;
+        GLuint indexBuffer = 0;
+        //one mat4 per object: storage buffer for the culling, per instance attribute for the draws
+        GLuint transformBuffer = 0;
+        //object space bounding sphere per object
+        GLuint boundsBuffer = 0;
+        GLuint recordBuffer = 0;
+        GLuint commandBuffer = 0;
+        gps::Shader cullShader;
+
+        //triangles of a range of records, as if none were culled
+        long long countTriangles(GLuint firstRecord, GLsizei recordCount);
+    };
+}
+
+#endif /* GpuDrivenRenderer_hpp */
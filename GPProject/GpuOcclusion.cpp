@@ -0,0 +1,169 @@
+#include "GpuOcclusion.hpp"
+
+#include "CpuProfiler.hpp"
+#include "DrawStats.hpp"
+
+#include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtc/type_ptr.hpp>
+
+#include <cmath>
+
+namespace gps {
+
+    //unit cube, counter clockwise seen from outside so back face culling keeps the front faces
+    static const GLfloat proxyVertices[] = {
+        -1.0f, -1.0f, -1.0f,   1.0f, -1.0f, -1.0f,   1.0f, 1.0f, -1.0f,   -1.0f, 1.0f, -1.0f,
+        -1.0f, -1.0f, 1.0f,    1.0f, -1.0f, 1.0f,    1.0f, 1.0f, 1.0f,    -1.0f, 1.0f, 1.0f
+    };
+    static const GLuint proxyIndices[] = {
+        4, 5, 6, 4, 6, 7,
+        1, 0, 3, 1, 3, 2,
+        0, 4, 7, 0, 7, 3,
+        5, 1, 2, 5, 2, 6,
+        7, 6, 2, 7, 2, 3,
+        0, 1, 5, 0, 5, 4
+    };
+
+    GpuOcclusion::~GpuOcclusion() {
+        if (!created)
+            return;
+        for (size_t i = 0; i < objects.size(); i++)
+            glDeleteQueries(1, &objects[i].query);
+        glDeleteBuffers(1, &proxyVBO);
+        glDeleteBuffers(1, &proxyEBO);
+        glDeleteVertexArrays(1, &proxyVAO);
+    }
+
+    void GpuOcclusion::addObject(gps::Model3D* object, const glm::mat4* modelMatrix) {
+        GLuint query = 0;
+        if (created)
+            glGenQueries(1, &query);
+        objects.push_back({ object, modelMatrix, query, false, true, glm::vec3(0.0f), false });
+    }
+
+    void GpuOcclusion::create() {
+        for (size_t i = 0; i < objects.size(); i++)
+            glGenQueries(1, &objects[i].query);
+
+        glGenVertexArrays(1, &proxyVAO);
+        glGenBuffers(1, &proxyVBO);
+        glGenBuffers(1, &proxyEBO);
+        glBindVertexArray(proxyVAO);
+        glBindBuffer(GL_ARRAY_BUFFER, proxyVBO);
+        glBufferData(GL_ARRAY_BUFFER, sizeof(proxyVertices), proxyVertices, GL_STATIC_DRAW);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, proxyEBO);
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(proxyIndices), proxyIndices, GL_STATIC_DRAW);
+        glEnableVertexAttribArray(0);
+        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(GLfloat), (GLvoid*)0);
+        glBindVertexArray(0);
+        created = true;
+    }
+
+    void GpuOcclusion::beginFrame() {
+        GPS_PROFILE_FUNCTION();
+        frame++;
+        hiddenObjects = 0;
+        conditionalDraws = 0;
+        for (size_t i = 0; i < objects.size(); i++) {
+            Object& object = objects[i];
+            if (object.pending) {
+                GLuint available = 0;
+                glGetQueryObjectuiv(object.query, GL_QUERY_RESULT_AVAILABLE, &available);
+                if (available) {
+                    GLuint samples = 0;
+                    glGetQueryObjectuiv(object.query, GL_QUERY_RESULT, &samples);
+                    object.visible = samples != 0;
+                    object.pending = false;
+                }
+            }
+            hiddenObjects += object.visible ? 0 : 1;
+        }
+    }
+
+    bool GpuOcclusion::beginDraw(size_t object) {
+        if (object >= objects.size() || objects[object].visible)
+            return true;
+        if (!objects[object].pending)
+            return false;
+        //the query was issued a frame ago and is done on the gpu by now, so waiting for it
+        //there costs nothing; it also keeps the pre-pass and lit draws of the object in agreement
+        glBeginConditionalRender(objects[object].query, GL_QUERY_WAIT);
+        conditional = true;
+        conditionalDraws++;
+        return true;
+    }
+
+    void GpuOcclusion::endDraw() {
+        if (conditional) {
+            glEndConditionalRender();
+            conditional = false;
+        }
+    }
+
+    void GpuOcclusion::issueQueries(gps::Shader& shader, const glm::mat4& view, const glm::mat4& projection, float zNear) {
+        GPS_PROFILE_FUNCTION();
+        if (!created)
+            create();
+
+        shader.useShaderProgram();
+        glUniformMatrix4fv(shader.getUniformLocation("view"), 1, GL_FALSE, glm::value_ptr(view));
+        glUniformMatrix4fv(shader.getUniformLocation("projection"), 1, GL_FALSE, glm::value_ptr(projection));
+        GLint modelLoc = shader.getUniformLocation("model");
+        glm::vec3 cameraPosition = glm::vec3(glm::inverse(view)[3]);
+
+        //test only, the proxies must not leave anything behind
+        glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+        glDepthMask(GL_FALSE);
+        glBindVertexArray(proxyVAO);
+
+        issuedQueries = 0;
+        for (size_t i = 0; i < objects.size(); i++) {
+            Object& object = objects[i];
+            BoundingSphere sphere = object.model->getBoundingSphere(*object.modelMatrix);
+            //the result is used next frame, grow the box by how far the object moved in this one
+            float motion = object.tracked ? glm::length(sphere.center - object.lastCenter) : 0.0f;
+            object.lastCenter = sphere.center;
+            object.tracked = true;
+
+            if (object.pending)
+                continue;
+            //objects that stay visible reuse their result for a few frames, staggered so the queries spread out
+            if (object.visible && (frame + (int)i) % VISIBLE_QUERY_INTERVAL != 0)
+                continue;
+
+            //a box clipped by the near plane would pass no samples even though the camera is inside it
+            float extent = sphere.radius + motion;
+            glm::vec3 offset = glm::abs(cameraPosition - sphere.center);
+            if (offset.x < extent + 2.0f * zNear && offset.y < extent + 2.0f * zNear && offset.z < extent + 2.0f * zNear) {
+                object.visible = true;
+                continue;
+            }
+
+            glm::mat4 proxyModel = glm::scale(glm::translate(glm::mat4(1.0f), sphere.center), glm::vec3(extent));
+            glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(proxyModel));
+            glBeginQuery(GL_ANY_SAMPLES_PASSED, object.query);
+            glDrawElements(GL_TRIANGLES, 36, GL_UNSIGNED_INT, 0);
+            countDraw(12);
+            glEndQuery(GL_ANY_SAMPLES_PASSED);
+            object.pending = true;
+            issuedQueries++;
+        }
+
+        glBindVertexArray(0);
+        glDepthMask(GL_TRUE);
+        glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+    }
+
+    void GpuOcclusion::reset() {
+        for (size_t i = 0; i < objects.size(); i++) {
+            objects[i].pending = false;
+            objects[i].visible = true;
+            objects[i].tracked = false;
+        }
+    }
+
+    void GpuOcclusion::printStats(std::ostream& out) {
+        out << "Occlusion queries: " << hiddenObjects << " of " << objects.size() << " objects hidden, "
+            << conditionalDraws << " conditional draws, " << issuedQueries << " queries issued last frame" << std::endl;
+    }
+}
@@ -0,0 +1,71 @@
+#ifndef GpuOcclusion_hpp
+#define GpuOcclusion_hpp
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+
+#include "Shader.hpp"
+#include "Model3D.hpp"
+
+#include <iostream>
+#include <vector>
+
+namespace gps {
+
+    //gpu occlusion culling: after the opaque pass the bounding box of each object is drawn, without
+    //color or depth writes, inside a GL_ANY_SAMPLES_PASSED query; the next frame skips the objects
+    //whose result came back hidden and wraps the draws whose result is still in flight in a
+    //conditional render, so the cpu never waits for a query
+    class GpuOcclusion {
+    public:
+        ~GpuOcclusion();
+
+        void addObject(gps::Model3D* object, const glm::mat4* modelMatrix);
+
+        //picks up the results that are available, without waiting for the others
+        void beginFrame();
+        //object is the index in addObject order, bodies sharing a model each have their own;
+        //false when the object is known to be hidden, otherwise draw it and call endDraw
+        bool beginDraw(size_t object);
+        void endDraw();
+        //draws the proxies against the depth buffer of the finished opaque pass;
+        //shader must take model, view and projection uniforms and a position at location 0
+        void issueQueries(gps::Shader& shader, const glm::mat4& view, const glm::mat4& projection, float zNear);
+
+        //forgets every result, for when the queries were not issued for a while
+        void reset();
+        void printStats(std::ostream& out);
+
+    private:
+        //an object that stays visible is only queried again every this many frames
+        static const int VISIBLE_QUERY_INTERVAL = 4;
+
+        struct Object {
+            gps::Model3D* model;
+            const glm::mat4* modelMatrix;
+            GLuint query;
+            //issued, result not read back yet
+            bool pending;
+            bool visible;
+            //world space center when the last proxy was drawn, for the motion margin
+            glm::vec3 lastCenter;
+            bool tracked;
+        };
+
+        std::vector<Object> objects;
+        bool created = false;
+        GLuint proxyVAO = 0;
+        GLuint proxyVBO = 0;
+        GLuint proxyEBO = 0;
+        bool conditional = false;
+        int frame = 0;
+
+        int issuedQueries = 0;
+        int hiddenObjects = 0;
+        int conditionalDraws = 0;
+
+        void create();
+    };
+}
+
+#endif /* GpuOcclusion_hpp */
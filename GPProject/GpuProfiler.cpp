@@ -0,0 +1,183 @@
+#include "GpuProfiler.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+
+namespace gps {
+
+    GpuProfiler::~GpuProfiler() {
+        for (int i = 0; i < FRAME_COUNT; i++) {
+            if (!frames[i].queries.empty())
+                glDeleteQueries((GLsizei)frames[i].queries.size(), frames[i].queries.data());
+        }
+    }
+
+    void GpuProfiler::setEnabled(bool enabled) {
+        this->enabled = enabled;
+    }
+
+    bool GpuProfiler::isEnabled() {
+        return enabled;
+    }
+
+    void GpuProfiler::setDrawZonesEnabled(bool enabled) {
+        drawZonesEnabled = enabled;
+    }
+
+    bool GpuProfiler::areDrawZonesEnabled() {
+        return enabled && drawZonesEnabled;
+    }
+
+    GLuint GpuProfiler::nextQuery(Frame& frame) {
+        if (frame.usedQueries == frame.queries.size()) {
+            GLuint query;
+            glGenQueries(1, &query);
+            frame.queries.push_back(query);
+        }
+        return frame.queries[frame.usedQueries++];
+    }
+
+    //timestamps complete in submission order, so the last query issued being available means they all
+    //are; that is the last one handed out, not the last record's end, which nested zones close earlier
+    void GpuProfiler::collect(Frame& frame) {
+        if (!frame.pending)
+            return;
+        frame.pending = false;
+        if (frame.records.empty())
+            return;
+
+        GLint available = 0;
+        glGetQueryObjectiv(frame.queries[frame.usedQueries - 1], GL_QUERY_RESULT_AVAILABLE, &available);
+        if (!available) {
+            droppedFrames++;
+            return;
+        }
+
+        //a zone opened several times in a frame counts as one sample, the sum of its parts
+        std::map<int, double> frameMs;
+        for (size_t i = 0; i < frame.records.size(); i++) {
+            GLuint64 begin = 0, end = 0;
+            glGetQueryObjectui64v(frame.records[i].beginQuery, GL_QUERY_RESULT, &begin);
+            glGetQueryObjectui64v(frame.records[i].endQuery, GL_QUERY_RESULT, &end);
+            frameMs[frame.records[i].zone] += (end - begin) / 1000000.0;
+        }
+        for (std::map<int, double>::iterator it = frameMs.begin(); it != frameMs.end(); it++) {
+            Zone& zone = zones[it->first];
+            if (zone.window.size() < WINDOW_SIZE)
+                zone.window.push_back(it->second);
+            else
+                zone.window[zone.next] = it->second;
+            zone.next = (zone.next + 1) % WINDOW_SIZE;
+        }
+    }
+
+    void GpuProfiler::beginFrame() {
+        if (!enabled)
+            return;
+        current = next;
+        next = (next + 1) % FRAME_COUNT;
+
+        Frame& frame = frames[current];
+        collect(frame);
+        frame.usedQueries = 0;
+        frame.records.clear();
+        openRecords.clear();
+    }
+
+    void GpuProfiler::endFrame() {
+        if (current == -1)
+            return;
+        //zones left open are closed here so the frame stays readable
+        while (!openRecords.empty())
+            endZone();
+        frames[current].pending = true;
+        current = -1;
+    }
+
+    void GpuProfiler::beginZone(const std::string& name) {
+        if (current == -1)
+            return;
+        Frame& frame = frames[current];
+
+        std::string fullName = openRecords.empty() ? name : zones[frame.records[openRecords.back()].zone].name + "/" + name;
+        std::map<std::string, int>::iterator found = zoneIndices.find(fullName);
+        int zone;
+        if (found == zoneIndices.end()) {
+            zone = (int)zones.size();
+            zoneIndices[fullName] = zone;
+            zones.push_back({ fullName, std::vector<double>(), 0 });
+        }
+        else {
+            zone = found->second;
+        }
+
+        Record record;
+        record.zone = zone;
+        record.beginQuery = nextQuery(frame);
+        record.endQuery = 0;
+        glQueryCounter(record.beginQuery, GL_TIMESTAMP);
+        openRecords.push_back((int)frame.records.size());
+        frame.records.push_back(record);
+    }
+
+    void GpuProfiler::endZone() {
+        if (current == -1 || openRecords.empty())
+            return;
+        Frame& frame = frames[current];
+        Record& record = frame.records[openRecords.back()];
+        openRecords.pop_back();
+        record.endQuery = nextQuery(frame);
+        glQueryCounter(record.endQuery, GL_TIMESTAMP);
+    }
+
+    std::vector<GpuProfiler::ZoneStats> GpuProfiler::getStats() {
+        std::vector<ZoneStats> stats;
+        for (size_t i = 0; i < zones.size(); i++) {
+            std::vector<double> sorted = zones[i].window;
+            if (sorted.empty())
+                continue;
+            std::sort(sorted.begin(), sorted.end());
+            double total = 0.0;
+            for (size_t s = 0; s < sorted.size(); s++)
+                total += sorted[s];
+            size_t p99 = (size_t)std::ceil(0.99 * sorted.size()) - 1;
+            stats.push_back({ zones[i].name, (int)sorted.size(), sorted.front(), total / sorted.size(), sorted[p99], sorted.back() });
+        }
+        return stats;
+    }
+
+    void GpuProfiler::printStats(std::ostream& out) {
+        std::vector<ZoneStats> stats = getStats();
+        out << "GPU zones (last " << WINDOW_SIZE << " frames, " << droppedFrames << " frames dropped): min / avg / p99 ms" << std::endl;
+        for (size_t i = 0; i < stats.size(); i++) {
+            out << "  " << stats[i].name << ": " << stats[i].minMs << " / " << stats[i].avgMs << " / " << stats[i].p99Ms
+                << " (" << stats[i].samples << " frames)" << std::endl;
+        }
+    }
+
+    bool GpuProfiler::writeCsv(const std::string& fileName) {
+        std::ofstream file(fileName.c_str());
+        if (!file)
+            return false;
+        std::vector<ZoneStats> stats = getStats();
+        file << "zone,samples,min_ms,avg_ms,p99_ms,max_ms" << std::endl;
+        for (size_t i = 0; i < stats.size(); i++) {
+            file << stats[i].name << "," << stats[i].samples << "," << stats[i].minMs << "," << stats[i].avgMs << ","
+                << stats[i].p99Ms << "," << stats[i].maxMs << std::endl;
+        }
+        return true;
+    }
+
+    int GpuProfiler::getDroppedFrames() {
+        return droppedFrames;
+    }
+
+    void GpuProfiler::resetStats() {
+        for (size_t i = 0; i < zones.size(); i++) {
+            zones[i].window.clear();
+            zones[i].next = 0;
+        }
+        droppedFrames = 0;
+    }
+}
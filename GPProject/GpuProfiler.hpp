@@ -0,0 +1,94 @@
+#ifndef GpuProfiler_hpp
+#define GpuProfiler_hpp
+
+#include <GL/glew.h>
+
+#include <iostream>
+#include <map>
+#include <string>
+#include <vector>
+
+namespace gps {
+
+    //nestable gpu zones timed with GL_TIMESTAMP pairs; each frame records into its own slot of a
+    //ring and is read back when the slot comes round again, FRAME_COUNT frames later, so the cpu
+    //never waits on a query; per zone it keeps a rolling window of per-frame times
+    class GpuProfiler {
+    public:
+        static const int FRAME_COUNT = 5;
+        //frames each zone's min/avg/p99 are computed over
+        static const int WINDOW_SIZE = 600;
+
+        struct ZoneStats {
+            //nested zones are named parent/child
+            std::string name;
+            int samples;
+            double minMs;
+            double avgMs;
+            double p99Ms;
+            double maxMs;
+        };
+
+        ~GpuProfiler();
+
+        //disabled, every call below returns straight away
+        void setEnabled(bool enabled);
+        bool isEnabled();
+        //finer zones (e.g. one per draw) that callers only open when this is set
+        void setDrawZonesEnabled(bool enabled);
+        bool areDrawZonesEnabled();
+
+        void beginFrame();
+        void endFrame();
+        void beginZone(const std::string& name);
+        void endZone();
+
+        //zones in the order they were first seen
+        std::vector<ZoneStats> getStats();
+        void printStats(std::ostream& out);
+        bool writeCsv(const std::string& fileName);
+        //frames whose queries were still in flight when their slot was needed again
+        int getDroppedFrames();
+        //forgets the samples so far (e.g. warmup frames); frames already in flight still land
+        void resetStats();
+
+    private:
+        struct Zone {
+            std::string name;
+            std::vector<double> window;
+            size_t next;
+        };
+
+        struct Record {
+            int zone;
+            GLuint beginQuery;
+            GLuint endQuery;
+        };
+
+        struct Frame {
+            //grows to the most queries a frame has needed, reused afterwards
+            std::vector<GLuint> queries;
+            size_t usedQueries = 0;
+            std::vector<Record> records;
+            bool pending = false;
+        };
+
+        bool enabled = false;
+        bool drawZonesEnabled = false;
+        Frame frames[FRAME_COUNT];
+        //slot being recorded, -1 outside beginFrame/endFrame
+        int current = -1;
+        int next = 0;
+        int droppedFrames = 0;
+
+        std::vector<Zone> zones;
+        std::map<std::string, int> zoneIndices;
+        //open zones of the current frame, innermost last
+        std::vector<int> openRecords;
+
+        GLuint nextQuery(Frame& frame);
+        void collect(Frame& frame);
+    };
+}
+
+#endif /* GpuProfiler_hpp */
@@ -0,0 +1,66 @@
+#include "GpuTimer.hpp"
+
+namespace gps {
+
+    GpuTimer::~GpuTimer() {
+        if (created)
+            glDeleteQueries(QUERY_COUNT, queries);
+    }
+
+    void GpuTimer::collect() {
+        for (int i = 0; i < QUERY_COUNT; i++) {
+            if (!pending[i])
+                continue;
+            GLint available = 0;
+            glGetQueryObjectiv(queries[i], GL_QUERY_RESULT_AVAILABLE, &available);
+            if (available) {
+                GLuint64 elapsed = 0;
+                glGetQueryObjectui64v(queries[i], GL_QUERY_RESULT, &elapsed);
+                totalMs += elapsed / 1000000.0;
+                samples++;
+                pending[i] = false;
+            }
+        }
+    }
+
+    void GpuTimer::begin() {
+        if (!created) {
+            glGenQueries(QUERY_COUNT, queries);
+            for (int i = 0; i < QUERY_COUNT; i++)
+                pending[i] = false;
+            created = true;
+        }
+
+        collect();
+
+        //all the queries are still in flight, skip this frame rather than stall
+        if (pending[next]) {
+            active = -1;
+            return;
+        }
+        active = next;
+        next = (next + 1) % QUERY_COUNT;
+        glBeginQuery(GL_TIME_ELAPSED, queries[active]);
+    }
+
+    void GpuTimer::end() {
+        if (active == -1)
+            return;
+        glEndQuery(GL_TIME_ELAPSED);
+        pending[active] = true;
+        active = -1;
+    }
+
+    double GpuTimer::getAverageMs() {
+        return samples > 0 ? totalMs / samples : 0.0;
+    }
+
+    int GpuTimer::getSampleCount() {
+        return samples;
+    }
+
+    void GpuTimer::reset() {
+        totalMs = 0.0;
+        samples = 0;
+    }
+}
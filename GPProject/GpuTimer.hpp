@@ -0,0 +1,37 @@
+#ifndef GpuTimer_hpp
+#define GpuTimer_hpp
+
+#include <GL/glew.h>
+
+namespace gps {
+
+    //measures the gpu time of the commands issued between begin() and end(),
+    //reading results back a few frames later so the cpu never waits on the gpu
+    class GpuTimer {
+    public:
+        ~GpuTimer();
+
+        void begin();
+        void end();
+
+        //average of the results collected since the last reset
+        double getAverageMs();
+        int getSampleCount();
+        void reset();
+
+    private:
+        static const int QUERY_COUNT = 4;
+        GLuint queries[QUERY_COUNT];
+        bool pending[QUERY_COUNT];
+        bool created = false;
+        //slot used by the running measurement, -1 if begin() skipped this frame
+        int active = -1;
+        int next = 0;
+        double totalMs = 0.0;
+        int samples = 0;
+
+        void collect();
+    };
+}
+
+#endif /* GpuTimer_hpp */
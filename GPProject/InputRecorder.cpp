@@ -0,0 +1,157 @@
+#include "InputRecorder.hpp"
+
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+
+namespace gps {
+
+    //file layout, little endian: "GPSI", uint32 version, then one record per frame or event:
+    //  frame:  uint8 1, float32 delta
+    //  key:    uint8 2, float32 time, int16 key, int16 scancode, uint8 action, uint8 mods
+    //  cursor: uint8 3, float32 time, float64 x, float64 y
+    static const char FILE_MAGIC[4] = { 'G', 'P', 'S', 'I' };
+    static const uint32_t FILE_VERSION = 1;
+
+    InputRecorder::~InputRecorder() {
+        stop();
+    }
+
+    template <typename T> void InputRecorder::write(const T& value) {
+        output.write((const char*)&value, sizeof(T));
+    }
+
+    template <typename T> static bool read(std::ifstream& input, T& value) {
+        return (bool)input.read((char*)&value, sizeof(T));
+    }
+
+    bool InputRecorder::startRecording(const std::string& fileName) {
+        stop();
+        output.open(fileName.c_str(), std::ios::binary);
+        if (!output)
+            return false;
+        output.write(FILE_MAGIC, sizeof(FILE_MAGIC));
+        write(FILE_VERSION);
+        recording = true;
+        recordingStart = std::chrono::steady_clock::now();
+        frames = 0;
+        return true;
+    }
+
+    bool InputRecorder::startReplay(const std::string& fileName) {
+        stop();
+        std::ifstream input(fileName.c_str(), std::ios::binary);
+        char magic[4];
+        uint32_t version = 0;
+        if (!input.read(magic, sizeof(magic)) || std::memcmp(magic, FILE_MAGIC, sizeof(magic)) != 0 ||
+            !read(input, version) || version != FILE_VERSION) {
+            std::cout << fileName << " is not an input recording" << std::endl;
+            return false;
+        }
+
+        //the whole file is read up front so the replayed frames do no file io
+        events.clear();
+        frames = 0;
+        uint8_t type;
+        while (read(input, type)) {
+            Event event = {};
+            event.type = type;
+            bool complete = false;
+            if (type == EVENT_FRAME) {
+                complete = read(input, event.deltaTime);
+                frames += complete ? 1 : 0;
+            }
+            else if (type == EVENT_KEY) {
+                int16_t key, scancode;
+                uint8_t action, mods;
+                complete = read(input, event.time) && read(input, key) && read(input, scancode) &&
+                    read(input, action) && read(input, mods);
+                event.key = key;
+                event.scancode = scancode;
+                event.action = action;
+                event.mods = mods;
+            }
+            else if (type == EVENT_CURSOR) {
+                complete = read(input, event.time) && read(input, event.x) && read(input, event.y);
+            }
+            //a recording cut short (the app crashed) replays up to its last whole record
+            if (!complete)
+                break;
+            events.push_back(event);
+        }
+
+        replaying = true;
+        cursor = 0;
+        return true;
+    }
+
+    void InputRecorder::stop() {
+        if (recording)
+            output.close();
+        recording = false;
+        replaying = false;
+    }
+
+    bool InputRecorder::isRecording() {
+        return recording;
+    }
+
+    bool InputRecorder::isReplaying() {
+        return replaying;
+    }
+
+    void InputRecorder::recordFrame(float deltaTime) {
+        if (!recording)
+            return;
+        write((uint8_t)EVENT_FRAME);
+        write(deltaTime);
+        frames++;
+    }
+
+    void InputRecorder::recordKey(int key, int scancode, int action, int mods) {
+        if (!recording)
+            return;
+        write((uint8_t)EVENT_KEY);
+        write(std::chrono::duration<float>(std::chrono::steady_clock::now() - recordingStart).count());
+        write((int16_t)key);
+        write((int16_t)scancode);
+        write((uint8_t)action);
+        write((uint8_t)mods);
+    }
+
+    void InputRecorder::recordCursor(double x, double y) {
+        if (!recording)
+            return;
+        write((uint8_t)EVENT_CURSOR);
+        write(std::chrono::duration<float>(std::chrono::steady_clock::now() - recordingStart).count());
+        write(x);
+        write(y);
+    }
+
+    bool InputRecorder::nextFrame(float& deltaTime) {
+        if (!replaying)
+            return false;
+        //events left over from a frame that was not dispatched are dropped with it
+        while (cursor < events.size() && events[cursor].type != EVENT_FRAME)
+            cursor++;
+        if (cursor == events.size())
+            return false;
+        deltaTime = events[cursor].deltaTime;
+        cursor++;
+        return true;
+    }
+
+    void InputRecorder::dispatchEvents(const KeyHandler& onKey, const CursorHandler& onCursor) {
+        for (; replaying && cursor < events.size() && events[cursor].type != EVENT_FRAME; cursor++) {
+            const Event& event = events[cursor];
+            if (event.type == EVENT_KEY)
+                onKey(event.key, event.scancode, event.action, event.mods);
+            else
+                onCursor(event.x, event.y);
+        }
+    }
+
+    int InputRecorder::getFrameCount() {
+        return frames;
+    }
+}
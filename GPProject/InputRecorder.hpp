@@ -0,0 +1,75 @@
+#ifndef InputRecorder_hpp
+#define InputRecorder_hpp
+
+#include <chrono>
+#include <fstream>
+#include <functional>
+#include <string>
+#include <vector>
+
+namespace gps {
+
+    //logs every frame's delta time and the key and cursor events that arrived during it to a small
+    //binary file, and plays such a file back frame by frame: the same deltas and the same events on
+    //the same frames, so a session re-runs identically, with or without a window
+    class InputRecorder {
+    public:
+        typedef std::function<void(int key, int scancode, int action, int mods)> KeyHandler;
+        typedef std::function<void(double x, double y)> CursorHandler;
+
+        ~InputRecorder();
+
+        bool startRecording(const std::string& fileName);
+        bool startReplay(const std::string& fileName);
+        //finishes the file being recorded
+        void stop();
+        bool isRecording();
+        bool isReplaying();
+
+        //recording: call once per frame, before the frame's events
+        void recordFrame(float deltaTime);
+        void recordKey(int key, int scancode, int action, int mods);
+        void recordCursor(double x, double y);
+
+        //replay: moves to the next recorded frame and gives its delta; false once the recording is over
+        bool nextFrame(float& deltaTime);
+        //replay: hands the events of the current frame to the handlers, in recorded order
+        void dispatchEvents(const KeyHandler& onKey, const CursorHandler& onCursor);
+
+        int getFrameCount();
+
+    private:
+        enum EventType {
+            EVENT_FRAME = 1,
+            EVENT_KEY = 2,
+            EVENT_CURSOR = 3
+        };
+
+        struct Event {
+            unsigned char type;
+            //seconds since the recording started
+            float time;
+            float deltaTime;
+            int key;
+            int scancode;
+            int action;
+            int mods;
+            double x;
+            double y;
+        };
+
+        std::ofstream output;
+        bool recording = false;
+        bool replaying = false;
+        std::chrono::steady_clock::time_point recordingStart;
+        int frames = 0;
+
+        std::vector<Event> events;
+        //first event of the current replayed frame, after its frame record
+        size_t cursor = 0;
+
+        template <typename T> void write(const T& value);
+    };
+}
+
+#endif /* InputRecorder_hpp */
@@ -0,0 +1,207 @@
+#include "JobSystem.hpp"
+
+#include "CpuProfiler.hpp"
+
+#include <algorithm>
+
+namespace gps {
+
+    //set on the workers, which belong to one system for good; the thread that called init is
+    //recognised by its id instead, since it may drive several systems one after another
+    static thread_local const JobSystem* currentSystem = NULL;
+    static thread_local int currentQueue = -1;
+
+    bool JobSystem::Counter::isDone() const {
+        return pending.load(std::memory_order_acquire) <= 0;
+    }
+
+    bool JobSystem::WorkQueue::push(Task* task) {
+        long long b = bottom.load(std::memory_order_relaxed);
+        long long t = top.load(std::memory_order_acquire);
+        if (b - t >= CAPACITY)
+            return false;
+        tasks[b & (CAPACITY - 1)].store(task, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        bottom.store(b + 1, std::memory_order_relaxed);
+        return true;
+    }
+
+    JobSystem::Task* JobSystem::WorkQueue::pop() {
+        long long b = bottom.load(std::memory_order_relaxed) - 1;
+        bottom.store(b, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        long long t = top.load(std::memory_order_relaxed);
+        if (t > b) {
+            bottom.store(b + 1, std::memory_order_relaxed);
+            return NULL;
+        }
+        Task* task = tasks[b & (CAPACITY - 1)].load(std::memory_order_relaxed);
+        if (t == b) {
+            //the last one, the thieves may be after it too
+            if (!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+                task = NULL;
+            bottom.store(b + 1, std::memory_order_relaxed);
+        }
+        return task;
+    }
+
+    JobSystem::Task* JobSystem::WorkQueue::steal() {
+        long long t = top.load(std::memory_order_acquire);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        long long b = bottom.load(std::memory_order_acquire);
+        if (t >= b)
+            return NULL;
+        Task* task = tasks[t & (CAPACITY - 1)].load(std::memory_order_relaxed);
+        //lost to the owner or another thief, the caller looks elsewhere
+        if (!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+            return NULL;
+        return task;
+    }
+
+    JobSystem::~JobSystem() {
+        shutdown();
+    }
+
+    void JobSystem::init(int workerCount) {
+        shutdown();
+        if (workerCount < 0)
+            workerCount = std::max(0, (int)std::thread::hardware_concurrency() - 1);
+        ownerThread = std::this_thread::get_id();
+        queueCount = workerCount + 1;
+        queues.reset(new WorkQueue[queueCount]);
+        stopping = false;
+        for (int i = 0; i < workerCount; i++)
+            workers.push_back(std::thread(&JobSystem::workerLoop, this, i + 1));
+    }
+
+    //lets the workers drain what is queued, then joins them
+    void JobSystem::shutdown() {
+        if (workers.empty())
+            return;
+        {
+            std::lock_guard<std::mutex> lock(sleepMutex);
+            stopping = true;
+        }
+        wake.notify_all();
+        for (size_t i = 0; i < workers.size(); i++)
+            workers[i].join();
+        workers.clear();
+        queues.reset();
+        queueCount = 0;
+    }
+
+    int JobSystem::getWorkerCount() {
+        return (int)workers.size();
+    }
+
+    int JobSystem::getThreadCount() {
+        return (int)workers.size() + 1;
+    }
+
+    int JobSystem::getQueueIndex() {
+        if (currentSystem == this)
+            return currentQueue;
+        return std::this_thread::get_id() == ownerThread ? 0 : -1;
+    }
+
+    void JobSystem::run(const Job& job, Counter* counter) {
+        if (counter != NULL)
+            counter->pending.fetch_add(1, std::memory_order_relaxed);
+        if (workers.empty()) {
+            Task task = { job, counter };
+            execute(&task);
+            return;
+        }
+
+        Task* task = new Task{ job, counter };
+        int queue = getQueueIndex();
+        if (queue < 0 || !queues[queue].push(task)) {
+            std::lock_guard<std::mutex> lock(sharedMutex);
+            sharedTasks.push_back(task);
+            sharedCount.fetch_add(1);
+        }
+        //a worker going to sleep counts itself before it looks at queuedTasks, so one of the two sees
+        //the other, and taking the mutex waits until it actually sleeps
+        queuedTasks.fetch_add(1);
+        if (sleepingWorkers.load() > 0) {
+            { std::lock_guard<std::mutex> lock(sleepMutex); }
+            wake.notify_one();
+        }
+    }
+
+    //own deque first, then the shared list, then the others' deques starting after our own
+    JobSystem::Task* JobSystem::findTask(int queue) {
+        Task* task = queue >= 0 ? queues[queue].pop() : NULL;
+        if (task == NULL && sharedCount.load(std::memory_order_relaxed) > 0) {
+            std::lock_guard<std::mutex> lock(sharedMutex);
+            if (!sharedTasks.empty()) {
+                task = sharedTasks.front();
+                sharedTasks.pop_front();
+                sharedCount.fetch_sub(1);
+            }
+        }
+        for (int i = 1; task == NULL && i <= queueCount; i++) {
+            int victim = (std::max(queue, 0) + i) % queueCount;
+            if (victim != queue)
+                task = queues[victim].steal();
+        }
+        if (task != NULL)
+            queuedTasks.fetch_sub(1);
+        return task;
+    }
+
+    void JobSystem::execute(Task* task) {
+        task->job();
+        if (task->counter != NULL)
+            task->counter->pending.fetch_sub(1, std::memory_order_release);
+    }
+
+    void JobSystem::workerLoop(int queue) {
+        currentSystem = this;
+        currentQueue = queue;
+        GPS_PROFILE_THREAD("job worker");
+        while (true) {
+            Task* task = findTask(queue);
+            if (task != NULL) {
+                execute(task);
+                delete task;
+                continue;
+            }
+            std::unique_lock<std::mutex> lock(sleepMutex);
+            sleepingWorkers.fetch_add(1);
+            wake.wait(lock, [this]() { return stopping || queuedTasks.load() > 0; });
+            sleepingWorkers.fetch_sub(1);
+            if (stopping && queuedTasks.load() <= 0)
+                return;
+        }
+    }
+
+    void JobSystem::wait(Counter& counter, bool help) {
+        int queue = getQueueIndex();
+        while (!counter.isDone()) {
+            Task* task = help && !workers.empty() ? findTask(queue) : NULL;
+            if (task != NULL) {
+                execute(task);
+                delete task;
+            }
+            else
+                std::this_thread::yield();
+        }
+    }
+
+    void JobSystem::parallelFor(size_t count, const RangeJob& body, size_t minChunk) {
+        size_t chunks = std::min(count / std::max(minChunk, (size_t)1), (size_t)getThreadCount() * 4);
+        if (chunks <= 1 || workers.empty()) {
+            if (count > 0)
+                body(0, count);
+            return;
+        }
+
+        Counter counter;
+        //pushed last to first, so the caller pops its neighbours back in order while thieves take the far end
+        for (size_t c = chunks; c-- > 1;)
+            run([&body, c, chunks, count]() { body(count * c / chunks, count * (c + 1) / chunks); }, &counter);
+        body(0, count / chunks);
+        wait(counter);
+    }
+}
@@ -0,0 +1,102 @@
+#ifndef JobSystem_hpp
+#define JobSystem_hpp
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace gps {
+
+    //fixed pool of worker threads, each owning a work-stealing deque: a thread pushes and pops its own
+    //jobs at the bottom, newest first while their data is still in cache, and idle threads steal the
+    //oldest ones from the top of the others'. The thread that calls init takes part as well, it owns a
+    //deque of its own and runs jobs while it waits; other threads queue through a shared list
+    class JobSystem {
+    public:
+        typedef std::function<void()> Job;
+        typedef std::function<void(size_t begin, size_t end)> RangeJob;
+
+        //jobs still to finish: run counts it up, and it counts down once the job has run
+        class Counter {
+        public:
+            bool isDone() const;
+
+        private:
+            friend class JobSystem;
+            std::atomic<int> pending{ 0 };
+        };
+
+        ~JobSystem();
+
+        //workerCount < 0 starts one worker per hardware thread besides the calling one; with none,
+        //jobs run right away on the thread that queues them
+        void init(int workerCount = -1);
+        void shutdown();
+        int getWorkerCount();
+        //the workers and the thread that called init
+        int getThreadCount();
+
+        //counter, if any, is counted up now and down once job has run
+        void run(const Job& job, Counter* counter = NULL);
+        //returns once every job counted by counter has run; with help, the waiting thread runs queued
+        //jobs meanwhile, so jobs may wait on jobs of their own
+        void wait(Counter& counter, bool help = true);
+        //body over [0, count) in chunks of at least minChunk, about four per thread so uneven chunks
+        //even out; the calling thread takes the first chunk and helps with the rest
+        void parallelFor(size_t count, const RangeJob& body, size_t minChunk = 1);
+
+    private:
+        struct Task {
+            Job job;
+            Counter* counter;
+        };
+
+        //Chase-Lev deque on a fixed ring: only the owner pushes and pops, at the bottom, thieves
+        //compete for the top with a compare exchange
+        class WorkQueue {
+        public:
+            static const long long CAPACITY = 4096;
+
+            //false when full
+            bool push(Task* task);
+            Task* pop();
+            Task* steal();
+
+        private:
+            std::atomic<long long> top{ 0 };
+            std::atomic<long long> bottom{ 0 };
+            std::atomic<Task*> tasks[CAPACITY];
+        };
+
+        std::vector<std::thread> workers;
+        //0 belongs to the thread that called init, i + 1 to worker i
+        std::unique_ptr<WorkQueue[]> queues;
+        int queueCount = 0;
+        std::thread::id ownerThread;
+
+        //jobs queued by threads without a deque, or when one was full
+        std::mutex sharedMutex;
+        std::deque<Task*> sharedTasks;
+        std::atomic<int> sharedCount{ 0 };
+
+        //workers sleep while nothing is queued
+        std::mutex sleepMutex;
+        std::condition_variable wake;
+        std::atomic<int> queuedTasks{ 0 };
+        std::atomic<int> sleepingWorkers{ 0 };
+        bool stopping = false;
+
+        void workerLoop(int queue);
+        //the calling thread's deque, -1 if it has none
+        int getQueueIndex();
+        Task* findTask(int queue);
+        void execute(Task* task);
+    };
+}
+
+#endif /* JobSystem_hpp */
@@ -1,4 +1,7 @@
 #include "Mesh.hpp"
+
+#include "DrawStats.hpp"
+
 namespace gps {
 
 	/* Mesh Constructor */
@@ -16,7 +19,7 @@ namespace gps {
 	}
 
 	/* Mesh drawing function - also applies associated textures */
-	void Mesh::Draw(gps::Shader shader)
+	void Mesh::Draw(gps::Shader& shader)
 	{
 		shader.useShaderProgram();
 
@@ -24,12 +27,13 @@ namespace gps {
 		for (GLuint i = 0; i < textures.size(); i++)
 		{
 			glActiveTexture(GL_TEXTURE0 + i);
-			glUniform1i(glGetUniformLocation(shader.shaderProgram, this->textures[i].type.c_str()), i);
+			glUniform1i(shader.getUniformLocation(this->textures[i].type), i);
 			glBindTexture(GL_TEXTURE_2D, this->textures[i].id);
 		}
 
 		glBindVertexArray(this->buffers.VAO);
 		glDrawElements(GL_TRIANGLES, this->indices.size(), GL_UNSIGNED_INT, 0);
+		countDraw(this->indices.size() / 3);
 		glBindVertexArray(0);
 
         for(GLuint i = 0; i < this->textures.size(); i++)
@@ -51,7 +51,7 @@ public:
 
 	Buffers getBuffers();
 
-	void Draw(gps::Shader shader);
+	void Draw(gps::Shader& shader);
 
 private:
     /*  Render data  */
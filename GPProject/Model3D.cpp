@@ -1,29 +1,93 @@
 #include "Model3D.hpp"
 
+#include "CpuProfiler.hpp"
+
+#include <sstream>
+#include <utility>
+
 namespace gps {
 
 	void Model3D::LoadModel(std::string fileName)
 	{
         std::string basePath = fileName.substr(0, fileName.find_last_of('/')) + "/";
-		ReadOBJ(fileName, basePath);
+		LoadModel(fileName, basePath);
 	}
 
     void Model3D::LoadModel(std::string fileName, std::string basePath)
+	{
+		ParseModel(fileName, basePath);
+		UploadModel();
+	}
+
+	void Model3D::ParseModel(std::string fileName, std::string basePath)
 	{
 		ReadOBJ(fileName, basePath);
 	}
 
+	// Textures first, the meshes refer to them
+	void Model3D::UploadModel()
+	{
+		GPS_PROFILE_FUNCTION();
+		for (size_t i = 0; i < pendingTextures.size(); i++) {
+			gps::Texture texture;
+			texture.id = UploadTexture(pendingTextures[i]);
+			texture.type = pendingTextures[i].type;
+			texture.path = pendingTextures[i].path;
+			loadedTextures.push_back(texture);
+			stbi_image_free(pendingTextures[i].pixels);
+		}
+
+		size_t firstTexture = loadedTextures.size() - pendingTextures.size();
+		for (size_t m = 0; m < pendingMeshes.size(); m++) {
+			std::vector<gps::Texture> textures;
+			for (size_t t = 0; t < pendingMeshes[m].textures.size(); t++)
+				textures.push_back(loadedTextures[firstTexture + pendingMeshes[m].textures[t]]);
+			meshes.push_back(gps::Mesh(std::move(pendingMeshes[m].vertices), std::move(pendingMeshes[m].indices), textures));
+		}
+
+		pendingMeshes.clear();
+		pendingTextures.clear();
+	}
+
 	// Draw each mesh from the model
-	void Model3D::Draw(gps::Shader shaderProgram)
+	void Model3D::Draw(gps::Shader& shaderProgram)
 	{
 		for (int i = 0; i < meshes.size(); i++)
 			meshes[i].Draw(shaderProgram);
 	}
 
-	// Does the parsing of the .obj file and fills in the data structure
+	bool Model3D::hasTexture(const std::string& type) {
+		for (size_t i = 0; i < loadedTextures.size(); i++)
+			if (loadedTextures[i].type == type)
+				return true;
+		return false;
+	}
+
+	const std::vector<gps::Mesh>& Model3D::getMeshes() {
+		return meshes;
+	}
+
+	BoundingSphere Model3D::getBoundingSphere() {
+		return bounds;
+	}
+
+	BoundingSphere Model3D::getBoundingSphere(const glm::mat4& modelMatrix) {
+		BoundingSphere world;
+		world.center = glm::vec3(modelMatrix * glm::vec4(bounds.center, 1.0f));
+		float scaleX = glm::length(glm::vec3(modelMatrix[0]));
+		float scaleY = glm::length(glm::vec3(modelMatrix[1]));
+		float scaleZ = glm::length(glm::vec3(modelMatrix[2]));
+		world.radius = bounds.radius * glm::max(scaleX, glm::max(scaleY, scaleZ));
+		return world;
+	}
+
+	// Does the parsing of the .obj file and fills in the pending meshes
 	void Model3D::ReadOBJ(std::string fileName, std::string basePath){
+		GPS_PROFILE_FUNCTION();
 
-        std::cout << "Loading : " << fileName << std::endl;
+		// One write per model, models may load side by side
+		std::ostringstream log;
+		log << "Loading : " << fileName << std::endl;
 		tinyobj::attrib_t attrib;
 		std::vector<tinyobj::shape_t> shapes;
 		std::vector<tinyobj::material_t> materials;
@@ -33,21 +97,38 @@ namespace gps {
 		bool ret = tinyobj::LoadObj(&attrib, &shapes, &materials, &err, fileName.c_str(), basePath.c_str(), GL_TRUE);
 
 		if (!err.empty()) { // `err` may contain warning message.
-			std::cerr << err << std::endl;
+			log << err << std::endl;
 		}
 
 		if (!ret) {
+			std::cerr << log.str();
 			exit(1);
 		}
 
-		std::cout << "# of shapes    : " << shapes.size() << std::endl;
-		std::cout << "# of materials : " << materials.size() << std::endl;
+		log << "# of shapes    : " << shapes.size() << std::endl;
+		log << "# of materials : " << materials.size() << std::endl;
+		std::cout << log.str();
+
+		// bounding sphere around the center of the position AABB
+		glm::vec3 minPosition(0.0f), maxPosition(0.0f);
+		for (size_t v = 0; v + 2 < attrib.vertices.size(); v += 3) {
+			glm::vec3 position(attrib.vertices[v], attrib.vertices[v + 1], attrib.vertices[v + 2]);
+			minPosition = v == 0 ? position : glm::min(minPosition, position);
+			maxPosition = v == 0 ? position : glm::max(maxPosition, position);
+		}
+		bounds.center = (minPosition + maxPosition) * 0.5f;
+		bounds.radius = 0.0f;
+		for (size_t v = 0; v + 2 < attrib.vertices.size(); v += 3) {
+			glm::vec3 position(attrib.vertices[v], attrib.vertices[v + 1], attrib.vertices[v + 2]);
+			bounds.radius = glm::max(bounds.radius, glm::length(position - bounds.center));
+		}
 
 		// Loop over shapes
 		for (size_t s = 0; s < shapes.size(); s++) {
-			std::vector<gps::Vertex> vertices;
-			std::vector<GLuint> indices;
-			std::vector<gps::Texture> textures;
+			PendingMesh mesh;
+			std::vector<gps::Vertex>& vertices = mesh.vertices;
+			std::vector<GLuint>& indices = mesh.indices;
+			std::vector<size_t>& textures = mesh.textures;
 
 			// Loop over faces(polygon)
 			size_t index_offset = 0;
@@ -107,64 +188,63 @@ namespace gps {
 					std::string ambientTexturePath = materials[materialId].ambient_texname;
 					if (!ambientTexturePath.empty())
 					{
-						gps::Texture currentTexture;
-						currentTexture = LoadTexture(basePath + ambientTexturePath, "ambientTexture");
-						textures.push_back(currentTexture);
+						textures.push_back(LoadTexture(basePath + ambientTexturePath, "ambientTexture"));
 					}
 
 					//diffuse texture
 					std::string diffuseTexturePath = materials[materialId].diffuse_texname;
 					if (!diffuseTexturePath.empty())
 					{
-						gps::Texture currentTexture;
-						currentTexture = LoadTexture(basePath + diffuseTexturePath, "diffuseTexture");
-						textures.push_back(currentTexture);
+						textures.push_back(LoadTexture(basePath + diffuseTexturePath, "diffuseTexture"));
 					}
 
 					//specular texture
 					std::string specularTexturePath = materials[materialId].specular_texname;
 					if (!specularTexturePath.empty())
 					{
-						gps::Texture currentTexture;
-						currentTexture = LoadTexture(basePath + specularTexturePath, "specularTexture");
-						textures.push_back(currentTexture);
+						textures.push_back(LoadTexture(basePath + specularTexturePath, "specularTexture"));
 					}
 				}
 			}
 
-			meshes.push_back(gps::Mesh(vertices, indices, textures));
+			pendingMeshes.push_back(std::move(mesh));
 		}
 	}
 
 	// Retrieves a texture associated with the object - by its name and type
-	gps::Texture Model3D::LoadTexture(std::string path, std::string type) {
+	size_t Model3D::LoadTexture(std::string path, std::string type) {
 
-			for (int i = 0; i < loadedTextures.size(); i++) {
-				if (loadedTextures[i].path == path)
+			for (size_t i = 0; i < pendingTextures.size(); i++) {
+				if (pendingTextures[i].path == path)
 				{
 					//already loaded texture
-					return loadedTextures[i];
+					return i;
 				}
 			}
 
-			gps::Texture currentTexture;
-			currentTexture.id = ReadTextureFromFile(path.c_str());
+			PendingTexture currentTexture;
 			currentTexture.type = std::string(type);
 			currentTexture.path = path;
+			ReadTextureFromFile(currentTexture);
 
-			loadedTextures.push_back(currentTexture);
+			pendingTextures.push_back(currentTexture);
 
-			return currentTexture;
+			return pendingTextures.size() - 1;
 		}
 
-	// Reads the pixel data from an image file and loads it into the video memory
-	GLuint Model3D::ReadTextureFromFile(const char* file_name) {
+	// Reads the pixel data from an image file, flipped to OpenGL's row order
+	void Model3D::ReadTextureFromFile(PendingTexture& texture) {
+		GPS_PROFILE_FUNCTION();
+		const char* file_name = texture.path.c_str();
 		int x, y, n;
 		int force_channels = 4;
 		unsigned char* image_data = stbi_load(file_name, &x, &y, &n, force_channels);
+		texture.width = x;
+		texture.height = y;
+		texture.pixels = image_data;
 		if (!image_data) {
 			fprintf(stderr, "ERROR: could not load %s\n", file_name);
-			return false;
+			return;
 		}
 		// NPOT check
 		if ((x & (x - 1)) != 0 || (y & (y - 1)) != 0) {
@@ -190,6 +270,12 @@ namespace gps {
 				bottom++;
 			}
 		}
+	}
+
+	// Loads decoded pixels into the video memory
+	GLuint Model3D::UploadTexture(const PendingTexture& texture) {
+		if (!texture.pixels)
+			return 0;
 
 		GLuint textureID;
 		glGenTextures(1, &textureID);
@@ -198,12 +284,12 @@ namespace gps {
 			GL_TEXTURE_2D,
 			0,
 			GL_SRGB, //GL_SRGB,//GL_RGBA,
-			x,
-			y,
+			texture.width,
+			texture.height,
 			0,
 			GL_RGBA,
 			GL_UNSIGNED_BYTE,
-			image_data
+			texture.pixels
 		);
 		glGenerateMipmap(GL_TEXTURE_2D);
 
@@ -217,6 +303,10 @@ namespace gps {
 	}
 
 	Model3D::~Model3D() {
+        for (size_t i = 0; i < pendingTextures.size(); i++) {
+            stbi_image_free(pendingTextures[i].pixels);
+        }
+
         for (size_t i = 0; i < loadedTextures.size(); i++) {
             glDeleteTextures(1, &loadedTextures.at(i).id);
         }
@@ -12,6 +12,11 @@
 
 namespace gps {
 
+    struct BoundingSphere {
+        glm::vec3 center;
+        float radius;
+    };
+
     class Model3D
     {
 
@@ -22,22 +27,63 @@ namespace gps {
 
 		void LoadModel(std::string fileName, std::string basePath);
 
-		void Draw(gps::Shader shaderProgram);
+		// The two halves of LoadModel: ParseModel reads the .obj and decodes its textures without
+		// touching OpenGL, so it may run on any thread, UploadModel then creates the buffers and
+		// textures on the thread that owns the context
+		void ParseModel(std::string fileName, std::string basePath);
+		void UploadModel();
+
+		void Draw(gps::Shader& shaderProgram);
+
+		// True when any mesh carries a texture of this type (e.g. "specularTexture")
+		bool hasTexture(const std::string& type);
+
+		// Object space bounds of all the meshes, computed at load time
+		BoundingSphere getBoundingSphere();
+
+		// Bounds transformed by a model matrix (radius scaled by the largest axis scale)
+		BoundingSphere getBoundingSphere(const glm::mat4& modelMatrix);
+
+		// Component meshes, for renderers that pack the geometry into their own buffers
+		const std::vector<gps::Mesh>& getMeshes();
 
     private:
 		// Component meshes - group of objects
         std::vector<gps::Mesh> meshes;
 		// Associated textures
         std::vector<gps::Texture> loadedTextures;
+		// Object space bounds
+		BoundingSphere bounds;
 
-		// Does the parsing of the .obj file and fills in the data structure
+		// Parsed, not in the video memory yet
+		struct PendingMesh {
+			std::vector<gps::Vertex> vertices;
+			std::vector<GLuint> indices;
+			// Into pendingTextures
+			std::vector<size_t> textures;
+		};
+		struct PendingTexture {
+			std::string type;
+			std::string path;
+			int width;
+			int height;
+			// NULL if the file could not be read
+			unsigned char* pixels;
+		};
+		std::vector<PendingMesh> pendingMeshes;
+		std::vector<PendingTexture> pendingTextures;
+
+		// Does the parsing of the .obj file and fills in the pending meshes
 		void ReadOBJ(std::string fileName, std::string basePath);
 
 		// Retrieves a texture associated with the object - by its name and type
-		gps::Texture LoadTexture(std::string path, std::string type);
+		size_t LoadTexture(std::string path, std::string type);
+
+		// Reads the pixel data from an image file, flipped to OpenGL's row order
+		void ReadTextureFromFile(PendingTexture& texture);
 
-		// Reads the pixel data from an image file and loads it into the video memory
-		GLuint ReadTextureFromFile(const char* file_name);
+		// Loads decoded pixels into the video memory
+		GLuint UploadTexture(const PendingTexture& texture);
     };
 }
 
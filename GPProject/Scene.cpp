@@ -0,0 +1,232 @@
+#include "Scene.hpp"
+
+#include "CpuProfiler.hpp"
+
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <tuple>
+
+namespace gps {
+
+    bool Scene::load(const std::string& fileName) {
+        std::ifstream file(fileName.c_str());
+        if (!file) {
+            std::cout << "Could not open scene " << fileName << std::endl;
+            return false;
+        }
+        return load(file, fileName);
+    }
+
+    //one "key values..." per line, "body <name>" starts the next body, '#' comments
+    bool Scene::load(std::istream& input, const std::string& fileName) {
+        GPS_PROFILE_FUNCTION();
+        infos.clear();
+        std::vector<BodyMotion> motions;
+        std::map<std::string, int> bodyIndices;
+
+        std::string text, key;
+        //one stream for every line, constructing one per line is most of the parse time
+        std::istringstream line;
+        int lineNumber = 0;
+        while (std::getline(input, text)) {
+            lineNumber++;
+            size_t comment = text.find('#');
+            if (comment != std::string::npos)
+                text.erase(comment);
+            line.clear();
+            line.str(text);
+            if (!(line >> key))
+                continue;
+
+            auto fail = [&](const std::string& message) {
+                std::cout << fileName << ":" << lineNumber << ": " << message << std::endl;
+                return false;
+            };
+
+            if (key == "body") {
+                BodyInfo info = { "", "", "", 0u, 0.0f };
+                if (!(line >> info.name))
+                    return fail("body needs a name");
+                if (!bodyIndices.insert(std::make_pair(info.name, (int)infos.size())).second)
+                    return fail("body " + info.name + " is defined twice");
+                BodyMotion motion = { -1, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 1.0f, glm::vec3(0.0f), glm::vec3(0.0f) };
+                motions.push_back(motion);
+                infos.push_back(info);
+                continue;
+            }
+            if (infos.empty())
+                return fail(key + " before the first body");
+
+            BodyMotion& motion = motions.back();
+            BodyInfo& info = infos.back();
+            bool read = true;
+            if (key == "mesh")
+                read = (bool)(line >> info.mesh);
+            else if (key == "textures")
+                read = (bool)(line >> info.textures);
+            else if (key == "parent") {
+                std::string parent;
+                read = (bool)(line >> parent);
+                std::map<std::string, int>::const_iterator it = bodyIndices.find(parent);
+                //children after their parents keeps update a single pass
+                if (read && (it == bodyIndices.end() || it->second == (int)infos.size() - 1))
+                    return fail("parent " + parent + " has to be defined before " + info.name);
+                if (read)
+                    motion.parent = it->second;
+            }
+            else if (key == "orbit")
+                read = (bool)(line >> motion.orbitRadius >> motion.orbitSpeed);
+            else if (key == "phase")
+                read = (bool)(line >> motion.orbitPhase);
+            else if (key == "spin")
+                read = (bool)(line >> motion.spinSpeed);
+            else if (key == "heading")
+                read = (bool)(line >> motion.heading);
+            else if (key == "scale")
+                read = (bool)(line >> motion.scale);
+            else if (key == "position")
+                read = (bool)(line >> motion.position.x >> motion.position.y >> motion.position.z);
+            else if (key == "velocity")
+                read = (bool)(line >> motion.velocity.x >> motion.velocity.y >> motion.velocity.z);
+            else if (key == "headlight")
+                read = (bool)(line >> info.headlight);
+            else if (key == "emissive")
+                info.flags |= BODY_EMISSIVE;
+            else if (key == "sphere")
+                info.flags |= BODY_SPHERE;
+            else
+                return fail("unknown key " + key);
+            if (!read)
+                return fail("bad value for " + key);
+        }
+
+        for (size_t i = 0; i < infos.size(); i++) {
+            if (infos[i].mesh.empty()) {
+                std::cout << fileName << ": body " << infos[i].name << " has no mesh" << std::endl;
+                return false;
+            }
+            if (infos[i].textures.empty())
+                infos[i].textures = infos[i].mesh.substr(0, infos[i].mesh.find_last_of('/')) + "/";
+        }
+
+        //depth first, siblings in file order, so every subtree is one range of the table
+        std::vector<std::vector<int>> children(infos.size());
+        std::vector<int> pending;
+        for (size_t i = infos.size(); i-- > 0;)
+            (motions[i].parent >= 0 ? children[motions[i].parent] : pending).push_back((int)i);
+        std::vector<int> newIndices(infos.size());
+        std::vector<BodyInfo> sorted;
+        sorted.reserve(infos.size());
+        transforms.clear();
+        while (!pending.empty()) {
+            int body = pending.back();
+            pending.pop_back();
+            newIndices[body] = (int)sorted.size();
+            sorted.push_back(infos[body]);
+            BodyMotion motion = motions[body];
+            if (motion.parent >= 0)
+                motion.parent = newIndices[motion.parent];
+            transforms.addBody(motion);
+            pending.insert(pending.end(), children[body].begin(), children[body].end());
+        }
+        infos.swap(sorted);
+        bodyModels.assign(infos.size(), NULL);
+        transforms.update(0.0f);
+        drawnMatrices.resize(infos.size());
+        for (size_t i = 0; i < infos.size(); i++)
+            drawnMatrices[i] = *transforms.getModelMatrix(i);
+        return true;
+    }
+
+    void Scene::loadModels() {
+        parseModels();
+        uploadModels();
+    }
+
+    void Scene::parseModels() {
+        GPS_PROFILE_FUNCTION();
+        std::vector<size_t> firstUsers;
+        for (size_t i = 0; i < infos.size(); i++) {
+            std::string key = infos[i].mesh + "|" + infos[i].textures;
+            std::map<std::string, Model3D>::iterator it = models.find(key);
+            if (it == models.end()) {
+                it = models.emplace(std::piecewise_construct, std::forward_as_tuple(key), std::forward_as_tuple()).first;
+                firstUsers.push_back(i);
+                pendingModels.push_back(&it->second);
+            }
+            bodyModels[i] = &it->second;
+        }
+
+        //one model per job, the files differ a lot in size
+        JobSystem::RangeJob parse = [this, &firstUsers](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; i++) {
+                const BodyInfo& info = infos[firstUsers[i]];
+                bodyModels[firstUsers[i]]->ParseModel(info.mesh, info.textures);
+            }
+        };
+        if (jobs != NULL)
+            jobs->parallelFor(firstUsers.size(), parse);
+        else
+            parse(0, firstUsers.size());
+    }
+
+    void Scene::uploadModels() {
+        GPS_PROFILE_FUNCTION();
+        for (size_t i = 0; i < pendingModels.size(); i++)
+            pendingModels[i]->UploadModel();
+        pendingModels.clear();
+    }
+
+    void Scene::setJobSystem(JobSystem* jobs) {
+        this->jobs = jobs;
+        transforms.setJobSystem(jobs);
+    }
+
+    void Scene::update(float deltaTime) {
+        transforms.update(deltaTime);
+        for (size_t i = 0; i < drawnMatrices.size(); i++)
+            drawnMatrices[i] = *transforms.getModelMatrix(i);
+    }
+
+    void Scene::reset() {
+        transforms.reset();
+    }
+
+    size_t Scene::getBodyCount() {
+        return infos.size();
+    }
+
+    const std::string& Scene::getName(size_t body) {
+        return infos[body].name;
+    }
+
+    unsigned Scene::getFlags(size_t body) {
+        return infos[body].flags;
+    }
+
+    Model3D* Scene::getModel(size_t body) {
+        return bodyModels[body];
+    }
+
+    const glm::mat4* Scene::getModelMatrix(size_t body) {
+        return &drawnMatrices[body];
+    }
+
+    bool Scene::getHeadlight(size_t body, glm::vec3& position) {
+        glm::vec3 velocity = transforms.getVelocity(body);
+        float speed = glm::length(velocity);
+        if (infos[body].headlight <= 0.0f || speed == 0.0f)
+            return false;
+        position = glm::vec3(drawnMatrices[body][3]) + velocity * (infos[body].headlight / speed);
+        return true;
+    }
+
+    TransformSystem& Scene::getTransforms() {
+        return transforms;
+    }
+
+    std::vector<glm::mat4>& Scene::getDrawnMatrices() {
+        return drawnMatrices;
+    }
+}
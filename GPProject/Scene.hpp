@@ -0,0 +1,83 @@
+#ifndef Scene_hpp
+#define Scene_hpp
+
+#include "JobSystem.hpp"
+#include "Model3D.hpp"
+#include "TransformSystem.hpp"
+
+#include <glm/glm.hpp>
+
+#include <istream>
+#include <map>
+#include <string>
+#include <vector>
+
+namespace gps {
+
+    enum BodyFlags {
+        //unlit, glowing with its own texture; it holds the light, so it casts no shadow
+        BODY_EMISSIVE = 1 << 0,
+        //a closed sphere: occludes in the software rasterizer and its shadow tile only follows its bounds
+        BODY_SPHERE = 1 << 1
+    };
+
+    //the bodies of a .scene file in one table, depth first like the TransformSystem that moves them:
+    //the order of the file, except that every body's descendants follow it
+    class Scene {
+    public:
+        //parses the file into the body table; the meshes are loaded by loadModels. false, with the
+        //offending line printed, on errors
+        bool load(const std::string& fileName);
+        bool load(std::istream& input, const std::string& fileName);
+        //loads every distinct mesh once, bodies sharing a mesh share the model: parseModels, then uploadModels
+        void loadModels();
+        //reads the meshes and decodes their textures, side by side with a job system; needs no GL context
+        void parseModels();
+        //the buffers and textures of what parseModels read, on the thread that owns the context
+        void uploadModels();
+        //for loading and for the transform update, NULL (the default) keeps both on the calling thread
+        void setJobSystem(JobSystem* jobs);
+
+        //steps the transforms and copies their matrices to the drawn ones
+        void update(float deltaTime);
+        //back to the angles and positions of the file
+        void reset();
+
+        size_t getBodyCount();
+        const std::string& getName(size_t body);
+        unsigned getFlags(size_t body);
+        Model3D* getModel(size_t body);
+        //the drawn matrix, stable once loaded, other systems keep the pointer
+        const glm::mat4* getModelMatrix(size_t body);
+        //the headlight position, ahead of the body along its velocity; false if it has none
+        bool getHeadlight(size_t body, glm::vec3& position);
+        TransformSystem& getTransforms();
+        //what getModelMatrix points into: update fills it, or a SimulationThread while it owns the transforms
+        std::vector<glm::mat4>& getDrawnMatrices();
+
+    private:
+        //what the renderer needs of a body, read at load and draw time only
+        struct BodyInfo {
+            std::string name;
+            std::string mesh;
+            //directory the materials and textures are looked up in, the mesh's own by default
+            std::string textures;
+            unsigned flags;
+            //distance ahead of the body, 0 for none
+            float headlight;
+        };
+
+        std::vector<BodyInfo> infos;
+        TransformSystem transforms;
+        //apart from the transforms' own, so the renderer never reads what a simulation thread writes
+        std::vector<glm::mat4> drawnMatrices;
+        JobSystem* jobs = NULL;
+        std::vector<Model3D*> bodyModels;
+        //by mesh and texture directory
+        std::map<std::string, Model3D> models;
+        //parsed, not uploaded yet
+        std::vector<Model3D*> pendingModels;
+    };
+}
+
+#endif /* Scene_hpp */
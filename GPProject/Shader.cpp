@@ -1,5 +1,15 @@
 #include "Shader.hpp"
 
+#include <chrono>
+#include <cstring>
+#include <vector>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#ifdef _WIN32
+#include <direct.h>
+#endif
+
 namespace gps {
     std::string Shader::readShaderFile(std::string fileName)
     {
@@ -22,64 +32,429 @@ namespace gps {
         return shaderString;
     }
 
-    void Shader::shaderCompileLog(GLuint shaderId)
+    std::string Shader::injectDefines(std::string source, std::string defines)
+    {
+        if (defines.empty())
+            return source;
+
+        //#version has to stay the first statement
+        size_t lineEnd = source.find('\n');
+        if (source.compare(0, 8, "#version") != 0 || lineEnd == std::string::npos)
+            return defines + source;
+        return source.substr(0, lineEnd + 1) + defines + source.substr(lineEnd + 1);
+    }
+
+    //nanoseconds where the platform keeps them; the CRT only has whole seconds, the size covers the rest.
+    //Zero time for a file that cannot be read
+    static bool statSourceFile(const std::string& fileName, long long& time, long long& size)
+    {
+        time = 0;
+        size = 0;
+#ifdef _WIN32
+        struct _stat64 info;
+        if (_stat64(fileName.c_str(), &info) != 0)
+            return false;
+        time = (long long)info.st_mtime * 1000000000LL;
+#else
+        struct stat info;
+        if (stat(fileName.c_str(), &info) != 0)
+            return false;
+#ifdef __APPLE__
+        time = (long long)info.st_mtimespec.tv_sec * 1000000000LL + info.st_mtimespec.tv_nsec;
+#else
+        time = (long long)info.st_mtim.tv_sec * 1000000000LL + info.st_mtim.tv_nsec;
+#endif
+#endif
+        size = (long long)info.st_size;
+        return true;
+    }
+
+    //the whole info log, however long it is
+    static std::string shaderInfoLog(GLuint shaderId)
+    {
+        GLint length = 0;
+        glGetShaderiv(shaderId, GL_INFO_LOG_LENGTH, &length);
+        if (length <= 0)
+            return "";
+        std::vector<GLchar> infoLog(length);
+        glGetShaderInfoLog(shaderId, length, NULL, infoLog.data());
+        return std::string(infoLog.data());
+    }
+
+    static std::string programInfoLog(GLuint programId)
+    {
+        GLint length = 0;
+        glGetProgramiv(programId, GL_INFO_LOG_LENGTH, &length);
+        if (length <= 0)
+            return "";
+        std::vector<GLchar> infoLog(length);
+        glGetProgramInfoLog(programId, length, NULL, infoLog.data());
+        return std::string(infoLog.data());
+    }
+
+    bool Shader::shaderCompileLog(GLuint shaderId, const std::string& fileName)
     {
         GLint success;
-        GLchar infoLog[512];
 
         //check compilation info
         glGetShaderiv(shaderId, GL_COMPILE_STATUS, &success);
         if(!success)
         {
-            glGetShaderInfoLog(shaderId, 512, NULL, infoLog);
-            std::cout << "Shader compilation error\n" << infoLog << std::endl;
+            std::cout << "Shader compilation error in " << fileName << "\n" << shaderInfoLog(shaderId) << std::endl;
         }
+        return success == GL_TRUE;
     }
 
-    void Shader::shaderLinkLog(GLuint shaderProgramId)
+    bool Shader::shaderLinkLog(GLuint shaderProgramId)
     {
         GLint success;
-        GLchar infoLog[512];
 
         //check linking info
         glGetProgramiv(shaderProgramId, GL_LINK_STATUS, &success);
         if(!success) {
-            glGetProgramInfoLog(shaderProgram, 512, NULL, infoLog);
-            std::cout << "Shader linking error\n" << infoLog << std::endl;
+            std::cout << "Shader linking error (" << vertexShaderFileName << ", " << fragmentShaderFileName << ")\n"
+                << programInfoLog(shaderProgramId) << std::endl;
         }
+        return success == GL_TRUE;
     }
 
-    void Shader::loadShader(std::string vertexShaderFileName, std::string fragmentShaderFileName)
-    {
-        //read, parse and compile the vertex shader
-        std::string v = readShaderFile(vertexShaderFileName);
-        const GLchar* vertexShaderString = v.c_str();
-        GLuint vertexShader;
-        vertexShader = glCreateShader(GL_VERTEX_SHADER);
-        glShaderSource(vertexShader, 1, &vertexShaderString, NULL);
-        glCompileShader(vertexShader);
-        //check compilation status
-        shaderCompileLog(vertexShader);
-
-        //read, parse and compile the vertex shader
-        std::string f = readShaderFile(fragmentShaderFileName);
-        const GLchar* fragmentShaderString = f.c_str();
-        GLuint fragmentShader;
-        fragmentShader = glCreateShader(GL_FRAGMENT_SHADER);
-        glShaderSource(fragmentShader, 1, &fragmentShaderString, NULL);
-        glCompileShader(fragmentShader);
-        //check compilation status
-        shaderCompileLog(fragmentShader);
+    void Shader::loadShader(std::string vertexShaderFileName, std::string fragmentShaderFileName, std::string defines)
+    {
+        submitShader(vertexShaderFileName, fragmentShaderFileName, defines);
+        finish();
+    }
+
+    void Shader::loadComputeShader(std::string computeShaderFileName, std::string defines)
+    {
+        deleteProgram();
+
+        std::string computeSource = injectDefines(readShaderFile(computeShaderFileName), defines);
+        const GLchar* computeShaderString = computeSource.c_str();
+        GLuint computeShader = glCreateShader(GL_COMPUTE_SHADER);
+        glShaderSource(computeShader, 1, &computeShaderString, NULL);
+        glCompileShader(computeShader);
+
+        GLuint program = glCreateProgram();
+        glAttachShader(program, computeShader);
+        glLinkProgram(program);
+
+        GLint linked = GL_FALSE;
+        glGetProgramiv(program, GL_LINK_STATUS, &linked);
+        if (shaderCompileLog(computeShader, computeShaderFileName) && !linked)
+            std::cout << "Shader linking error (" << computeShaderFileName << ")\n" << programInfoLog(program) << std::endl;
+        glDeleteShader(computeShader);
+
+        this->shaderProgram = program;
+        uniformLocations.clear();
+    }
+
+    void Shader::submitShader(std::string vertexShaderFileName, std::string fragmentShaderFileName, std::string defines)
+    {
+        //a newer build replaces one still in flight
+        discardPending();
+
+        this->vertexShaderFileName = vertexShaderFileName;
+        this->fragmentShaderFileName = fragmentShaderFileName;
+        this->defines = defines;
+        statSourceFile(vertexShaderFileName, sourceStamps[0].time, sourceStamps[0].size);
+        statSourceFile(fragmentShaderFileName, sourceStamps[1].time, sourceStamps[1].size);
+
+        pendingVertexSource = injectDefines(readShaderFile(vertexShaderFileName), defines);
+        pendingFragmentSource = injectDefines(readShaderFile(fragmentShaderFileName), defines);
+        submitTime = std::chrono::high_resolution_clock::now();
+
+        pendingKey = programCacheKey(pendingVertexSource, pendingFragmentSource);
+        if (!pendingKey.empty() && submitProgramBinary(pendingKey))
+            return;
+        submitCompile();
+    }
+
+    bool Shader::isReady()
+    {
+        if (state != STATE_READY) {
+            bool complete = true;
+            if (GLEW_KHR_parallel_shader_compile || GLEW_ARB_parallel_shader_compile) {
+                //GL_COMPLETION_STATUS_ARB has the same value
+                GLint status = GL_FALSE;
+                glGetProgramiv(pendingProgram, GL_COMPLETION_STATUS_KHR, &status);
+                complete = status == GL_TRUE;
+            }
+            if (complete)
+                finishPending();
+        }
+        //a reload in flight leaves the previous program usable
+        return this->shaderProgram != 0;
+    }
+
+    void Shader::finish()
+    {
+        //a rejected binary takes a second round through the compiler
+        while (state != STATE_READY)
+            finishPending();
+    }
+
+    bool Shader::reloadIfChanged()
+    {
+        if (vertexShaderFileName.empty())
+            return false;
+        SourceStamp current[2];
+        //a file that is missing for a moment (editors that save by rename) is not a change
+        if (!statSourceFile(vertexShaderFileName, current[0].time, current[0].size)
+            || !statSourceFile(fragmentShaderFileName, current[1].time, current[1].size))
+            return false;
+        bool changed = false;
+        for (int i = 0; i < 2; i++)
+            changed = changed || current[i].time != sourceStamps[i].time || current[i].size != sourceStamps[i].size;
+        if (!changed)
+            return false;
+
+        std::cout << "Reloading " << vertexShaderFileName << ", " << fragmentShaderFileName << std::endl;
+        submitShader(vertexShaderFileName, fragmentShaderFileName, defines);
+        return true;
+    }
+
+    void Shader::setUniformBlockBinding(const std::string& blockName, GLuint binding)
+    {
+        uniformBlockBindings[blockName] = binding;
+        if (this->shaderProgram == 0)
+            return;
+        GLuint index = glGetUniformBlockIndex(this->shaderProgram, blockName.c_str());
+        if (index != GL_INVALID_INDEX)
+            glUniformBlockBinding(this->shaderProgram, index, binding);
+    }
+
+    void Shader::deleteProgram()
+    {
+        discardPending();
+        glDeleteProgram(this->shaderProgram);
+        this->shaderProgram = 0;
+    }
+
+    void Shader::discardPending()
+    {
+        if (state == STATE_READY)
+            return;
+        glDeleteShader(pendingVertexShader);
+        glDeleteShader(pendingFragmentShader);
+        glDeleteProgram(pendingProgram);
+        pendingVertexShader = 0;
+        pendingFragmentShader = 0;
+        pendingProgram = 0;
+        state = STATE_READY;
+    }
+
+    //swaps the finished build in; locations and block indices may differ in the new program
+    void Shader::adoptPending()
+    {
+        glDeleteProgram(this->shaderProgram);
+        this->shaderProgram = pendingProgram;
+        pendingProgram = 0;
+        uniformLocations.clear();
+        for (std::unordered_map<std::string, GLuint>::iterator it = uniformBlockBindings.begin(); it != uniformBlockBindings.end(); it++)
+            setUniformBlockBinding(it->first, it->second);
+    }
+
+    //compiles and links without asking for any status, so nothing here waits on the driver
+    void Shader::submitCompile()
+    {
+        //parse and compile the vertex shader
+        const GLchar* vertexShaderString = pendingVertexSource.c_str();
+        pendingVertexShader = glCreateShader(GL_VERTEX_SHADER);
+        glShaderSource(pendingVertexShader, 1, &vertexShaderString, NULL);
+        glCompileShader(pendingVertexShader);
+
+        //parse and compile the fragment shader
+        const GLchar* fragmentShaderString = pendingFragmentSource.c_str();
+        pendingFragmentShader = glCreateShader(GL_FRAGMENT_SHADER);
+        glShaderSource(pendingFragmentShader, 1, &fragmentShaderString, NULL);
+        glCompileShader(pendingFragmentShader);
 
         //attach and link the shader programs
-        this->shaderProgram = glCreateProgram();
-        glAttachShader(this->shaderProgram, vertexShader);
-        glAttachShader(this->shaderProgram, fragmentShader);
-        glLinkProgram(this->shaderProgram);
-        glDeleteShader(vertexShader);
-        glDeleteShader(fragmentShader);
-        //check linking info
-        shaderLinkLog(this->shaderProgram);
+        pendingProgram = glCreateProgram();
+        glAttachShader(pendingProgram, pendingVertexShader);
+        glAttachShader(pendingProgram, pendingFragmentShader);
+        if (!pendingKey.empty())
+            glProgramParameteri(pendingProgram, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+        glLinkProgram(pendingProgram);
+        state = STATE_COMPILING;
+    }
+
+    //the status queries below block until the driver is done with the program
+    void Shader::finishPending()
+    {
+        float elapsedMs = std::chrono::duration<float, std::milli>(std::chrono::high_resolution_clock::now() - submitTime).count();
+
+        if (state == STATE_LOADING_BINARY) {
+            GLint success;
+            glGetProgramiv(pendingProgram, GL_LINK_STATUS, &success);
+            if (success) {
+                programCacheStats.hits++;
+                programCacheStats.cachedCompileMs += pendingCachedCompileMs;
+                programCacheStats.loadMs += elapsedMs;
+                adoptPending();
+                state = STATE_READY;
+            }
+            else {
+                //not an error: compile from source and overwrite the entry
+                glDeleteProgram(pendingProgram);
+                programCacheStats.rejected++;
+                submitTime = std::chrono::high_resolution_clock::now();
+                submitCompile();
+            }
+            return;
+        }
+
+        if (state == STATE_COMPILING) {
+            //check compilation and linking status
+            bool vertexCompiled = shaderCompileLog(pendingVertexShader, vertexShaderFileName);
+            bool fragmentCompiled = shaderCompileLog(pendingFragmentShader, fragmentShaderFileName);
+            bool linked = vertexCompiled && fragmentCompiled && shaderLinkLog(pendingProgram);
+            glDeleteShader(pendingVertexShader);
+            glDeleteShader(pendingFragmentShader);
+            pendingVertexShader = 0;
+            pendingFragmentShader = 0;
+
+            if (linked && !pendingKey.empty()) {
+                programCacheStats.misses++;
+                programCacheStats.compileMs += elapsedMs;
+                saveProgramBinary(pendingKey, elapsedMs);
+            }
+
+            //a first build is adopted even when broken, as before; a reload only when it links
+            if (linked || this->shaderProgram == 0) {
+                adoptPending();
+            }
+            else {
+                std::cout << "Keeping the previous program" << std::endl;
+                glDeleteProgram(pendingProgram);
+                pendingProgram = 0;
+            }
+            state = STATE_READY;
+        }
+
+        pendingVertexSource.clear();
+        pendingFragmentSource.clear();
+    }
+
+    bool Shader::enableParallelCompile()
+    {
+        if (GLEW_KHR_parallel_shader_compile) {
+            glMaxShaderCompilerThreadsKHR(0xFFFFFFFF);
+            return true;
+        }
+        if (GLEW_ARB_parallel_shader_compile) {
+            glMaxShaderCompilerThreadsARB(0xFFFFFFFF);
+            return true;
+        }
+        return false;
+    }
+
+    std::string Shader::programCacheDirectory = "";
+    Shader::ProgramCacheStats Shader::programCacheStats = {};
+
+    //cache file layout: magic, GLenum binary format, compile time in ms, binary length, binary
+    const char PROGRAM_CACHE_MAGIC[4] = { 'G', 'P', 'S', '1' };
+
+    void Shader::setProgramCacheDirectory(std::string directory)
+    {
+        if (!directory.empty()) {
+#ifdef _WIN32
+            _mkdir(directory.c_str());
+#else
+            mkdir(directory.c_str(), 0755);
+#endif
+        }
+        programCacheDirectory = directory;
+    }
+
+    void Shader::printProgramCacheStats(std::ostream& out)
+    {
+        int lookups = programCacheStats.hits + programCacheStats.misses;
+        if (lookups == 0) {
+            out << "Program cache: no lookups" << std::endl;
+            return;
+        }
+        out << "Program cache: " << programCacheStats.hits << "/" << lookups << " hits ("
+            << 100 * programCacheStats.hits / lookups << "%), " << programCacheStats.rejected << " rejected by the driver" << std::endl;
+        out << "  hits loaded in " << programCacheStats.loadMs << " ms instead of " << programCacheStats.cachedCompileMs
+            << " ms, saving " << programCacheStats.cachedCompileMs - programCacheStats.loadMs << " ms" << std::endl;
+        out << "  misses compiled in " << programCacheStats.compileMs << " ms" << std::endl;
+    }
+
+    //64 bit FNV-1a over everything that decides whether a binary is still valid
+    std::string Shader::programCacheKey(const std::string& vertexSource, const std::string& fragmentSource)
+    {
+        if (programCacheDirectory.empty())
+            return "";
+        GLint formatCount = 0;
+        glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formatCount);
+        if (formatCount == 0)
+            return "";
+
+        std::string parts[4] = {
+            vertexSource,
+            fragmentSource,
+            (const char*)glGetString(GL_RENDERER),
+            (const char*)glGetString(GL_VERSION)
+        };
+        unsigned long long hash = 14695981039346656037ULL;
+        for (int i = 0; i < 4; i++) {
+            //the terminating zero keeps "ab" + "c" apart from "a" + "bc"
+            for (size_t c = 0; c <= parts[i].size(); c++) {
+                hash ^= (unsigned char)parts[i].c_str()[c];
+                hash *= 1099511628211ULL;
+            }
+        }
+
+        std::ostringstream key;
+        key << std::hex << hash;
+        return key.str();
+    }
+
+    //starts loading the cached binary; whether the driver accepts it is known once the program is ready
+    bool Shader::submitProgramBinary(const std::string& key)
+    {
+        std::ifstream file((programCacheDirectory + "/" + key + ".bin").c_str(), std::ios::binary);
+        if (!file)
+            return false;
+
+        char magic[4];
+        GLenum format;
+        GLint length;
+        file.read(magic, sizeof(magic));
+        file.read((char*)&format, sizeof(format));
+        file.read((char*)&pendingCachedCompileMs, sizeof(pendingCachedCompileMs));
+        file.read((char*)&length, sizeof(length));
+        if (!file || std::memcmp(magic, PROGRAM_CACHE_MAGIC, sizeof(magic)) != 0 || length <= 0)
+            return false;
+        std::vector<char> binary(length);
+        file.read(binary.data(), length);
+        if (!file)
+            return false;
+
+        pendingProgram = glCreateProgram();
+        glProgramBinary(pendingProgram, format, binary.data(), length);
+        state = STATE_LOADING_BINARY;
+        return true;
+    }
+
+    void Shader::saveProgramBinary(const std::string& key, float compileMs)
+    {
+        GLint length = 0;
+        glGetProgramiv(pendingProgram, GL_PROGRAM_BINARY_LENGTH, &length);
+        if (length <= 0)
+            return;
+
+        std::vector<char> binary(length);
+        GLenum format;
+        glGetProgramBinary(pendingProgram, length, NULL, &format, binary.data());
+
+        std::ofstream file((programCacheDirectory + "/" + key + ".bin").c_str(), std::ios::binary);
+        file.write(PROGRAM_CACHE_MAGIC, sizeof(PROGRAM_CACHE_MAGIC));
+        file.write((const char*)&format, sizeof(format));
+        file.write((const char*)&compileMs, sizeof(compileMs));
+        file.write((const char*)&length, sizeof(length));
+        file.write(binary.data(), length);
     }
 
     void Shader::useShaderProgram()
@@ -87,4 +462,14 @@ namespace gps {
         glUseProgram(this->shaderProgram);
     }
 
+    GLint Shader::getUniformLocation(const std::string& name)
+    {
+        std::unordered_map<std::string, GLint>::iterator it = uniformLocations.find(name);
+        if (it != uniformLocations.end())
+            return it->second;
+        GLint location = glGetUniformLocation(this->shaderProgram, name.c_str());
+        uniformLocations[name] = location;
+        return location;
+    }
+
 }
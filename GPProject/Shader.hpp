@@ -3,25 +3,106 @@
 
 #include <GL/glew.h>
 
+#include <chrono>
 #include <iostream>
 #include <fstream>
 #include <sstream>
 #include <iostream>
 #include <string>
+#include <unordered_map>
 
 namespace gps {
 
 class Shader
 {
 public:
-    GLuint shaderProgram;
-    void loadShader(std::string vertexShaderFileName, std::string fragmentShaderFileName);
+    //the program to draw with, 0 until the first build is done
+    GLuint shaderProgram = 0;
+    //defines (e.g. "#define SHADOW_FILTER 1\n") are inserted right after the #version line of both stages
+    void loadShader(std::string vertexShaderFileName, std::string fragmentShaderFileName, std::string defines = "");
+    //single compute stage (GL 4.3), built synchronously and neither cached nor hot reloaded
+    void loadComputeShader(std::string computeShaderFileName, std::string defines = "");
+    //same as loadShader, but returns as soon as the driver has the work; poll isReady() before drawing
+    void submitShader(std::string vertexShaderFileName, std::string fragmentShaderFileName, std::string defines = "");
+    //never blocks when the driver supports parallel shader compile, otherwise finishes the program on the spot
+    bool isReady();
+    //blocks until the program is linked
+    void finish();
+    //rebuilds in the background when either source file changed on disk; the new program replaces
+    //the current one only if it links, so a broken edit keeps the last working version on screen
+    bool reloadIfChanged();
+    //binding point of a uniform block, applied again to every reloaded program
+    void setUniformBlockBinding(const std::string& blockName, GLuint binding);
+    //deletes the current program and any build still in flight
+    void deleteProgram();
     void useShaderProgram();
+    //looked up once per program and cached, -1 for uniforms the program does not use
+    GLint getUniformLocation(const std::string& name);
+
+    //linked programs are saved as driver binaries under this directory, keyed by the final
+    //sources, GL_RENDERER and GL_VERSION; an empty directory turns the cache off
+    static void setProgramCacheDirectory(std::string directory);
+    static void printProgramCacheStats(std::ostream& out);
+
+    //hands every compiler thread to the driver; true when KHR/ARB_parallel_shader_compile is present
+    static bool enableParallelCompile();
 
 private:
+    std::unordered_map<std::string, GLint> uniformLocations;
+    std::unordered_map<std::string, GLuint> uniformBlockBindings;
+
+    //what the program was built from, for reloads
+    std::string vertexShaderFileName;
+    std::string fragmentShaderFileName;
+    std::string defines;
+    //modification time and size of each file when it was read; a second save can land in the same
+    //second (or the same timestamp tick of a coarse filesystem), so either changing counts as an edit
+    struct SourceStamp {
+        long long time;
+        long long size;
+    };
+    SourceStamp sourceStamps[2] = {};
+
+    enum State {
+        STATE_READY,
+        STATE_COMPILING,
+        STATE_LOADING_BINARY
+    };
+    State state = STATE_READY;
+    //kept until the program is ready: the logs need the shader objects, a rejected binary needs the sources
+    GLuint pendingProgram = 0;
+    GLuint pendingVertexShader = 0;
+    GLuint pendingFragmentShader = 0;
+    std::string pendingVertexSource;
+    std::string pendingFragmentSource;
+    std::string pendingKey;
+    float pendingCachedCompileMs = 0.0f;
+    std::chrono::high_resolution_clock::time_point submitTime;
+
+    struct ProgramCacheStats {
+        int hits;
+        int misses;
+        //binaries the driver refused (driver update, different GPU) and recompiled from source
+        int rejected;
+        double loadMs;
+        //what the hits took to compile when they were first cached
+        double cachedCompileMs;
+        double compileMs;
+    };
+    static std::string programCacheDirectory;
+    static ProgramCacheStats programCacheStats;
+
     std::string readShaderFile(std::string fileName);
-    void shaderCompileLog(GLuint shaderId);
-    void shaderLinkLog(GLuint shaderProgramId);
+    std::string injectDefines(std::string source, std::string defines);
+    bool shaderCompileLog(GLuint shaderId, const std::string& fileName);
+    bool shaderLinkLog(GLuint shaderProgramId);
+    void discardPending();
+    void adoptPending();
+    void submitCompile();
+    void finishPending();
+    std::string programCacheKey(const std::string& vertexSource, const std::string& fragmentSource);
+    bool submitProgramBinary(const std::string& key);
+    void saveProgramBinary(const std::string& key, float compileMs);
 };
 
 }
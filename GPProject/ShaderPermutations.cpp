@@ -0,0 +1,63 @@
+#include "ShaderPermutations.hpp"
+
+namespace gps {
+
+    std::string getShaderFeatureDefines(unsigned features) {
+        static const char* names[SHADER_FEATURE_COUNT] = { "SHADOWS", "SPECULAR_MAP", "EMISSIVE", "INSTANCED" };
+        std::string defines;
+        for (int i = 0; i < SHADER_FEATURE_COUNT; i++) {
+            if (features & (1u << i))
+                defines += std::string("#define ") + names[i] + "\n";
+        }
+        return defines;
+    }
+
+    ShaderPermutations::~ShaderPermutations() {
+        clear();
+    }
+
+    void ShaderPermutations::init(std::string vertexShaderFileName, std::string fragmentShaderFileName, std::string baseDefines) {
+        this->vertexShaderFileName = vertexShaderFileName;
+        this->fragmentShaderFileName = fragmentShaderFileName;
+        setBaseDefines(baseDefines);
+    }
+
+    void ShaderPermutations::setBaseDefines(std::string baseDefines) {
+        if (baseDefines == this->baseDefines && !permutations.empty())
+            return;
+        clear();
+        this->baseDefines = baseDefines;
+    }
+
+    gps::Shader& ShaderPermutations::get(unsigned features) {
+        std::map<unsigned, gps::Shader>::iterator it = permutations.find(features);
+        if (it != permutations.end())
+            return it->second;
+
+        gps::Shader& shader = permutations[features];
+        shader.submitShader(vertexShaderFileName, fragmentShaderFileName, baseDefines + getShaderFeatureDefines(features));
+        return shader;
+    }
+
+    void ShaderPermutations::finishAll() {
+        for (std::map<unsigned, gps::Shader>::iterator it = permutations.begin(); it != permutations.end(); it++)
+            it->second.finish();
+    }
+
+    int ShaderPermutations::reloadIfChanged() {
+        int reloaded = 0;
+        for (std::map<unsigned, gps::Shader>::iterator it = permutations.begin(); it != permutations.end(); it++)
+            reloaded += it->second.reloadIfChanged() ? 1 : 0;
+        return reloaded;
+    }
+
+    size_t ShaderPermutations::getCompiledCount() {
+        return permutations.size();
+    }
+
+    void ShaderPermutations::clear() {
+        for (std::map<unsigned, gps::Shader>::iterator it = permutations.begin(); it != permutations.end(); it++)
+            it->second.deleteProgram();
+        permutations.clear();
+    }
+}
@@ -0,0 +1,54 @@
+#ifndef ShaderPermutations_hpp
+#define ShaderPermutations_hpp
+
+#include "Shader.hpp"
+
+#include <map>
+#include <string>
+
+namespace gps {
+
+    //optional features of a shader pair, each one a #define in the sources
+    enum ShaderFeature {
+        //receives shadows from the shadow atlas
+        SHADER_FEATURE_SHADOWS = 1 << 0,
+        //samples specularTexture instead of reusing the diffuse texture as the specular mask
+        SHADER_FEATURE_SPECULAR_MAP = 1 << 1,
+        //self-lit, no light or shadow computation at all
+        SHADER_FEATURE_EMISSIVE = 1 << 2,
+        //model matrix comes from a per-instance attribute instead of the uniform
+        SHADER_FEATURE_INSTANCED = 1 << 3,
+        SHADER_FEATURE_COUNT = 4
+    };
+
+    //"#define SHADOWS\n..." for the bits set in features
+    std::string getShaderFeatureDefines(unsigned features);
+
+    //every feature combination of one vertex/fragment pair, compiled the first time it is asked for
+    class ShaderPermutations {
+    public:
+        ~ShaderPermutations();
+
+        //baseDefines go into every permutation (e.g. the shadow filter tier); changing them drops all programs
+        void init(std::string vertexShaderFileName, std::string fragmentShaderFileName, std::string baseDefines = "");
+        void setBaseDefines(std::string baseDefines);
+
+        //the first call for a bitmask only submits the program; check isReady() before drawing with it
+        gps::Shader& get(unsigned features);
+        //blocks until every submitted permutation is linked
+        void finishAll();
+        //see Shader::reloadIfChanged; returns how many permutations started a rebuild
+        int reloadIfChanged();
+
+        size_t getCompiledCount();
+        void clear();
+
+    private:
+        std::string vertexShaderFileName;
+        std::string fragmentShaderFileName;
+        std::string baseDefines;
+        std::map<unsigned, gps::Shader> permutations;
+    };
+}
+
+#endif /* ShaderPermutations_hpp */
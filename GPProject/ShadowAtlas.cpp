@@ -0,0 +1,448 @@
+#include "ShadowAtlas.hpp"
+
+#include "CpuProfiler.hpp"
+#include "DrawStats.hpp"
+
+#include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtc/type_ptr.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+namespace gps {
+
+    const GLsizei MIN_TILE_SIZE = 32;
+    const GLsizei MAX_TILE_SIZE = 1024;
+    //far plane of every tile frustum, measured from the light; covers the whole system
+    const float SHADOW_FAR = 400.0f;
+    //frustums are fitted slightly wider than the bounding sphere
+    const float FRUSTUM_PADDING = 1.05f;
+
+    const char* getShadowFilterName(ShadowFilter filter) {
+        switch (filter) {
+        case SHADOW_FILTER_PCF:
+            return "pcf";
+        case SHADOW_FILTER_POISSON:
+            return "poisson";
+        case SHADOW_FILTER_VSM:
+            return "vsm";
+        default:
+            return "unknown";
+        }
+    }
+
+    static GLsizei nextPowerOfTwo(float value) {
+        GLsizei size = 1;
+        while (size < value)
+            size *= 2;
+        return size;
+    }
+
+    static GLuint createColorTarget(GLsizei size, GLuint& texture, GLuint depthTexture) {
+        glGenTextures(1, &texture);
+        glBindTexture(GL_TEXTURE_2D, texture);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RG32F, size, size, 0, GL_RG, GL_FLOAT, NULL);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glBindTexture(GL_TEXTURE_2D, 0);
+
+        GLuint framebuffer;
+        glGenFramebuffers(1, &framebuffer);
+        glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, texture, 0);
+        if (depthTexture != 0)
+            glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, depthTexture, 0);
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        return framebuffer;
+    }
+
+    static GLuint createSampler(GLint filter, GLint wrap, bool compare) {
+        GLuint sampler;
+        glGenSamplers(1, &sampler);
+        glSamplerParameteri(sampler, GL_TEXTURE_MIN_FILTER, filter);
+        glSamplerParameteri(sampler, GL_TEXTURE_MAG_FILTER, filter);
+        glSamplerParameteri(sampler, GL_TEXTURE_WRAP_S, wrap);
+        glSamplerParameteri(sampler, GL_TEXTURE_WRAP_T, wrap);
+        GLfloat borderColor[] = { 1.0f, 1.0f, 1.0f, 1.0f };
+        glSamplerParameterfv(sampler, GL_TEXTURE_BORDER_COLOR, borderColor);
+        if (compare) {
+            glSamplerParameteri(sampler, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_REF_TO_TEXTURE);
+            glSamplerParameteri(sampler, GL_TEXTURE_COMPARE_FUNC, GL_LEQUAL);
+        }
+        return sampler;
+    }
+
+    ShadowAtlas::~ShadowAtlas() {
+        glDeleteFramebuffers(1, &framebuffer);
+        glDeleteFramebuffers(1, &momentsFramebuffer);
+        glDeleteTextures(1, &depthTexture);
+        glDeleteTextures(1, &momentsTexture);
+        glDeleteVertexArrays(1, &emptyVAO);
+        glDeleteSamplers(1, &compareSampler);
+        glDeleteSamplers(1, &pointSampler);
+        glDeleteSamplers(1, &linearSampler);
+    }
+
+    void ShadowAtlas::init(GLsizei atlasSize) {
+        this->atlasSize = atlasSize;
+
+        glGenTextures(1, &depthTexture);
+        glBindTexture(GL_TEXTURE_2D, depthTexture);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT24, atlasSize, atlasSize, 0, GL_DEPTH_COMPONENT, GL_FLOAT, NULL);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_BORDER);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_BORDER);
+        GLfloat borderColor[] = { 1.0f, 1.0f, 1.0f, 1.0f };
+        glTexParameterfv(GL_TEXTURE_2D, GL_TEXTURE_BORDER_COLOR, borderColor);
+        glBindTexture(GL_TEXTURE_2D, 0);
+
+        glGenFramebuffers(1, &framebuffer);
+        glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, depthTexture, 0);
+        glDrawBuffer(GL_NONE);
+        glReadBuffer(GL_NONE);
+        glClear(GL_DEPTH_BUFFER_BIT);
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+        momentsFramebuffer = createColorTarget(atlasSize, momentsTexture, depthTexture);
+        //the blur draws a fullscreen triangle from gl_VertexID, but core profile still wants a VAO bound
+        glGenVertexArrays(1, &emptyVAO);
+
+        compareSampler = createSampler(GL_LINEAR, GL_CLAMP_TO_BORDER, true);
+        pointSampler = createSampler(GL_NEAREST, GL_CLAMP_TO_BORDER, false);
+        linearSampler = createSampler(GL_LINEAR, GL_CLAMP_TO_EDGE, false);
+    }
+
+    bool ShadowAtlas::addCaster(gps::Model3D* model, const glm::mat4* modelMatrix, bool sphere) {
+        if ((int)casters.size() >= MAX_CASTERS)
+            return false;
+        Caster caster;
+        caster.model = model;
+        caster.modelMatrix = modelMatrix;
+        caster.sphere = sphere;
+        caster.cachedMatrix = *modelMatrix;
+        caster.lightSpaceMatrix = glm::mat4(1.0f);
+        caster.visible = false;
+        caster.dirty = true;
+        caster.tileX = 0;
+        caster.tileY = 0;
+        caster.tileSize = 0;
+        caster.requestedSize = 0;
+        caster.desiredSize = 0;
+        casters.push_back(caster);
+        return true;
+    }
+
+    void ShadowAtlas::setUpdateInterval(int frames) {
+        updateInterval = frames < 1 ? 1 : frames;
+    }
+
+    int ShadowAtlas::getUpdateInterval() {
+        return updateInterval;
+    }
+
+    void ShadowAtlas::setFilter(ShadowFilter filter) {
+        this->filter = filter;
+        invalidate();
+    }
+
+    void ShadowAtlas::invalidate() {
+        for (size_t i = 0; i < casters.size(); i++)
+            casters[i].dirty = true;
+    }
+
+    ShadowFilter ShadowAtlas::getFilter() {
+        return filter;
+    }
+
+    void ShadowAtlas::setBlurShader(gps::Shader* shader) {
+        blurShader = shader;
+    }
+
+    void ShadowAtlas::setBlurTarget(GLuint framebuffer, GLuint texture) {
+        blurFramebuffer = framebuffer;
+        blurTexture = texture;
+    }
+
+    GLsizei ShadowAtlas::getBlurTargetSize() {
+        return MAX_TILE_SIZE;
+    }
+
+    void ShadowAtlas::setCachingEnabled(bool enabled) {
+        cachingEnabled = enabled;
+    }
+
+    bool ShadowAtlas::isCachingEnabled() {
+        return cachingEnabled;
+    }
+
+    GLuint ShadowAtlas::getTexture() {
+        return depthTexture;
+    }
+
+    GLuint ShadowAtlas::getFramebuffer() {
+        return framebuffer;
+    }
+
+    //tile edge in texels: about one texel per covered screen pixel, rounded to a power of two
+    GLsizei ShadowAtlas::computeDesiredSize(const gps::BoundingSphere& sphere, const glm::mat4& view,
+        const glm::mat4& projection, int viewportHeight, GLsizei previousSize) {
+        float distance = glm::length(glm::vec3(view * glm::vec4(sphere.center, 1.0f)));
+        if (distance <= sphere.radius)
+            return MAX_TILE_SIZE;
+
+        float screenDiameter = sphere.radius * projection[1][1] / distance * (float)viewportHeight;
+        GLsizei desired = nextPowerOfTwo(glm::clamp(screenDiameter, (float)MIN_TILE_SIZE, (float)MAX_TILE_SIZE));
+
+        //only shrink once the last request is four times too large, so small camera moves do not repack
+        if (previousSize > 0 && desired < previousSize && desired * 4 > previousSize)
+            return previousSize;
+        return desired;
+    }
+
+    //power of two tiles packed largest first into quad-tree splits of the atlas
+    bool ShadowAtlas::pack() {
+        struct Square {
+            GLint x, y;
+            GLsizei size;
+        };
+
+        std::vector<int> sorted;
+        for (size_t i = 0; i < casters.size(); i++) {
+            casters[i].tileSize = 0;
+            if (casters[i].visible)
+                sorted.push_back((int)i);
+        }
+        std::stable_sort(sorted.begin(), sorted.end(), [this](int a, int b) {
+            return casters[a].desiredSize > casters[b].desiredSize;
+        });
+
+        std::vector<Square> freeSquares;
+        freeSquares.push_back(Square{ 0, 0, atlasSize });
+        for (size_t n = 0; n < sorted.size(); n++) {
+            Caster& caster = casters[sorted[n]];
+
+            int best = -1;
+            for (size_t f = 0; f < freeSquares.size(); f++) {
+                if (freeSquares[f].size >= caster.desiredSize &&
+                    (best == -1 || freeSquares[f].size < freeSquares[best].size))
+                    best = (int)f;
+            }
+            if (best == -1)
+                return false;
+
+            Square square = freeSquares[best];
+            freeSquares.erase(freeSquares.begin() + best);
+            while (square.size > caster.desiredSize) {
+                GLsizei half = square.size / 2;
+                freeSquares.push_back(Square{ square.x + half, square.y, half });
+                freeSquares.push_back(Square{ square.x, square.y + half, half });
+                freeSquares.push_back(Square{ square.x + half, square.y + half, half });
+                square.size = half;
+            }
+            caster.tileX = square.x;
+            caster.tileY = square.y;
+            caster.tileSize = square.size;
+        }
+        return true;
+    }
+
+    void ShadowAtlas::renderTile(gps::Shader& depthShader, GLint modelLocation, GLint lightSpaceLocation,
+        Caster& caster, glm::vec3 lightPosition) {
+        caster.cachedMatrix = *caster.modelMatrix;
+        gps::BoundingSphere sphere = caster.model->getBoundingSphere(caster.cachedMatrix);
+
+        glm::vec3 direction = sphere.center - lightPosition;
+        float distance = glm::length(direction);
+        float radius = sphere.radius * FRUSTUM_PADDING;
+        glm::vec3 up = std::fabs(direction.y) > 0.99f * distance ? glm::vec3(1.0f, 0.0f, 0.0f) : glm::vec3(0.0f, 1.0f, 0.0f);
+
+        float halfAngle = std::asin(glm::min(radius / distance, 0.999f));
+        float nearPlane = glm::max(distance - radius, 0.05f);
+        float farPlane = glm::max(SHADOW_FAR, distance + radius);
+        glm::mat4 lightProjection = glm::perspective(2.0f * halfAngle, 1.0f, nearPlane, farPlane);
+        glm::mat4 lightView = glm::lookAt(lightPosition, sphere.center, up);
+        caster.lightSpaceMatrix = lightProjection * lightView;
+
+        glViewport(caster.tileX, caster.tileY, caster.tileSize, caster.tileSize);
+        glScissor(caster.tileX, caster.tileY, caster.tileSize, caster.tileSize);
+        if (filter == SHADOW_FILTER_VSM)
+            glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+        else
+            glClear(GL_DEPTH_BUFFER_BIT);
+
+        glUniformMatrix4fv(lightSpaceLocation, 1, GL_FALSE, glm::value_ptr(caster.lightSpaceMatrix));
+        glUniformMatrix4fv(modelLocation, 1, GL_FALSE, glm::value_ptr(caster.cachedMatrix));
+        caster.model->Draw(depthShader);
+        caster.dirty = false;
+
+        if (filter == SHADOW_FILTER_VSM && blurShader != NULL && blurFramebuffer != 0) {
+            blurTile(caster);
+            depthShader.useShaderProgram();
+            glBindFramebuffer(GL_FRAMEBUFFER, momentsFramebuffer);
+        }
+    }
+
+    //separable gaussian over the tile's moments: atlas tile -> blur texture -> atlas tile
+    void ShadowAtlas::blurTile(const Caster& caster) {
+        GLint sourceLocation = blurShader->getUniformLocation("source");
+        GLint sourceRectLocation = blurShader->getUniformLocation("sourceRect");
+        GLint directionLocation = blurShader->getUniformLocation("direction");
+        float tileUV = (float)caster.tileSize / atlasSize;
+        float blurUV = (float)caster.tileSize / MAX_TILE_SIZE;
+
+        glDisable(GL_DEPTH_TEST);
+        blurShader->useShaderProgram();
+        glBindVertexArray(emptyVAO);
+        glActiveTexture(GL_TEXTURE0);
+        glBindSampler(0, linearSampler);
+        glUniform1i(sourceLocation, 0);
+
+        glBindFramebuffer(GL_FRAMEBUFFER, blurFramebuffer);
+        glViewport(0, 0, caster.tileSize, caster.tileSize);
+        glScissor(0, 0, caster.tileSize, caster.tileSize);
+        glBindTexture(GL_TEXTURE_2D, momentsTexture);
+        glUniform4f(sourceRectLocation, (float)caster.tileX / atlasSize, (float)caster.tileY / atlasSize, tileUV, tileUV);
+        glUniform2f(directionLocation, 1.0f / atlasSize, 0.0f);
+        glDrawArrays(GL_TRIANGLES, 0, 3);
+        countDraw(1);
+
+        glBindFramebuffer(GL_FRAMEBUFFER, momentsFramebuffer);
+        glViewport(caster.tileX, caster.tileY, caster.tileSize, caster.tileSize);
+        glScissor(caster.tileX, caster.tileY, caster.tileSize, caster.tileSize);
+        glBindTexture(GL_TEXTURE_2D, blurTexture);
+        glUniform4f(sourceRectLocation, 0.0f, 0.0f, blurUV, blurUV);
+        glUniform2f(directionLocation, 0.0f, 1.0f / MAX_TILE_SIZE);
+        glDrawArrays(GL_TRIANGLES, 0, 3);
+        countDraw(1);
+
+        glBindTexture(GL_TEXTURE_2D, 0);
+        glBindSampler(0, 0);
+        glBindVertexArray(0);
+        glEnable(GL_DEPTH_TEST);
+    }
+
+    void ShadowAtlas::update(gps::Shader& depthShader, GLint modelLocation, GLint lightSpaceLocation,
+        glm::vec3 lightPosition, const glm::mat4& view, const glm::mat4& projection, int viewportHeight) {
+        GPS_PROFILE_FUNCTION();
+        bool lightMoved = std::memcmp(&lightPosition, &cachedLightPosition, sizeof(glm::vec3)) != 0;
+        cachedLightPosition = lightPosition;
+
+        bool repack = false;
+        for (size_t i = 0; i < casters.size(); i++) {
+            Caster& caster = casters[i];
+            gps::BoundingSphere sphere = caster.model->getBoundingSphere(*caster.modelMatrix);
+
+            //a light inside the caster (the sun itself) casts nothing from it
+            bool visible = glm::length(sphere.center - lightPosition) > sphere.radius * FRUSTUM_PADDING;
+            GLsizei requested = visible ? computeDesiredSize(sphere, view, projection, viewportHeight, caster.requestedSize) : 0;
+            repack = repack || visible != caster.visible || requested != caster.requestedSize;
+            caster.visible = visible;
+            caster.requestedSize = requested;
+
+            bool moved;
+            if (caster.sphere) {
+                gps::BoundingSphere cached = caster.model->getBoundingSphere(caster.cachedMatrix);
+                moved = cached.center != sphere.center || cached.radius != sphere.radius;
+            }
+            else {
+                moved = std::memcmp(caster.modelMatrix, &caster.cachedMatrix, sizeof(glm::mat4)) != 0;
+            }
+            caster.dirty = caster.dirty || moved || lightMoved || !cachingEnabled;
+        }
+
+        if (repack) {
+            //halve every request until the tiles fit
+            for (size_t i = 0; i < casters.size(); i++)
+                casters[i].desiredSize = casters[i].requestedSize;
+            while (!pack()) {
+                for (size_t i = 0; i < casters.size(); i++)
+                    casters[i].desiredSize = glm::max(casters[i].desiredSize / 2, MIN_TILE_SIZE);
+            }
+            for (size_t i = 0; i < casters.size(); i++)
+                casters[i].dirty = true;
+        }
+
+        //empty moment texels read as "far", i.e. lit
+        GLfloat clearColor[4];
+        glGetFloatv(GL_COLOR_CLEAR_VALUE, clearColor);
+        glClearColor(1.0f, 1.0f, 0.0f, 0.0f);
+        glUniform1f(depthShader.getUniformLocation("shadowFar"), SHADOW_FAR);
+
+        glBindFramebuffer(GL_FRAMEBUFFER, filter == SHADOW_FILTER_VSM ? momentsFramebuffer : framebuffer);
+        glEnable(GL_SCISSOR_TEST);
+        //slope scaled offset instead of a per-fragment bias in the lit shader
+        glEnable(GL_POLYGON_OFFSET_FILL);
+        glPolygonOffset(2.0f, 4.0f);
+
+        //new tile positions invalidate the old contents, so everything goes in one frame;
+        //otherwise the refreshes are spread round robin over the update interval
+        int casterCount = (int)casters.size();
+        int budget = repack ? casterCount : (casterCount + updateInterval - 1) / updateInterval;
+        for (int n = 0; n < casterCount && budget > 0; n++) {
+            Caster& caster = casters[(nextCaster + n) % casterCount];
+            if (!caster.dirty || !caster.visible || caster.tileSize == 0)
+                continue;
+            renderTile(depthShader, modelLocation, lightSpaceLocation, caster, lightPosition);
+            budget--;
+            nextCaster = (nextCaster + n + 1) % casterCount;
+        }
+
+        glDisable(GL_POLYGON_OFFSET_FILL);
+        glDisable(GL_SCISSOR_TEST);
+        glClearColor(clearColor[0], clearColor[1], clearColor[2], clearColor[3]);
+    }
+
+    void ShadowAtlas::bindForSampling(GLuint unit) {
+        glActiveTexture(GL_TEXTURE0 + unit);
+        if (filter == SHADOW_FILTER_VSM) {
+            glBindTexture(GL_TEXTURE_2D, momentsTexture);
+            glBindSampler(unit, linearSampler);
+        }
+        else {
+            glBindTexture(GL_TEXTURE_2D, depthTexture);
+            glBindSampler(unit, filter == SHADOW_FILTER_PCF ? compareSampler : pointSampler);
+        }
+    }
+
+    void ShadowAtlas::applyUniforms(gps::Shader& shader) {
+        glm::mat4 matrices[MAX_CASTERS];
+        glm::vec4 tiles[MAX_CASTERS];
+        int count = 0;
+        for (size_t i = 0; i < casters.size(); i++) {
+            const Caster& caster = casters[i];
+            if (!caster.visible || caster.tileSize == 0)
+                continue;
+            matrices[count] = caster.lightSpaceMatrix;
+            tiles[count] = glm::vec4((float)caster.tileX / atlasSize, (float)caster.tileY / atlasSize,
+                (float)caster.tileSize / atlasSize, (float)caster.tileSize / atlasSize);
+            count++;
+        }
+
+        glUniform1i(shader.getUniformLocation("shadowCasterCount"), count);
+        glUniform2f(shader.getUniformLocation("shadowTexelSize"), 1.0f / atlasSize, 1.0f / atlasSize);
+        glUniform1f(shader.getUniformLocation("shadowFar"), SHADOW_FAR);
+        if (count > 0) {
+            glUniformMatrix4fv(shader.getUniformLocation("casterLightSpace"), count, GL_FALSE,
+                glm::value_ptr(matrices[0]));
+            glUniform4fv(shader.getUniformLocation("casterTile"), count, glm::value_ptr(tiles[0]));
+        }
+    }
+
+    void ShadowAtlas::printStats(std::ostream& out) {
+        int tiles = 0;
+        long long texels = 0;
+        for (size_t i = 0; i < casters.size(); i++) {
+            if (casters[i].visible && casters[i].tileSize > 0) {
+                tiles++;
+                texels += (long long)casters[i].tileSize * casters[i].tileSize;
+            }
+        }
+        out << "Shadow atlas: " << tiles << " tiles, " << texels << " texels in use of "
+            << (long long)atlasSize * atlasSize << " (a 1024 cubemap would be " << 6LL * 1024 * 1024 << ")" << std::endl;
+    }
+}
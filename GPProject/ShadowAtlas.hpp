@@ -0,0 +1,125 @@
+#ifndef ShadowAtlas_hpp
+#define ShadowAtlas_hpp
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+
+#include "Model3D.hpp"
+#include "Shader.hpp"
+
+#include <vector>
+
+namespace gps {
+
+    //filtering tiers, matching SHADOW_FILTER in basic.frag
+    enum ShadowFilter {
+        //sampler2DShadow with compare mode, 2x2 PCF done by the texture unit
+        SHADOW_FILTER_PCF = 0,
+        //16 tap poisson disk rotated per pixel
+        SHADOW_FILTER_POISSON = 1,
+        //variance shadow map built from a blurred moment atlas
+        SHADOW_FILTER_VSM = 2,
+        SHADOW_FILTER_COUNT = 3
+    };
+
+    const char* getShadowFilterName(ShadowFilter filter);
+
+    //shadow atlas for a point light: every caster gets its own tile rendered through a
+    //perspective frustum fitted from the light to the caster's bounding sphere, with a
+    //resolution that follows how large the caster appears on screen
+    class ShadowAtlas {
+    public:
+        //must match MAX_SHADOW_CASTERS in basic.frag
+        static const int MAX_CASTERS = 16;
+
+        ~ShadowAtlas();
+
+        void init(GLsizei atlasSize);
+
+        //sphere casters only depend on their bounding sphere, so spinning in place does not dirty their tile;
+        //false once MAX_CASTERS are in, the caster then casts no shadow
+        bool addCaster(gps::Model3D* model, const glm::mat4* modelMatrix, bool sphere);
+
+        //every dirty tile is refreshed at least once every `frames` frames; 1 refreshes them all each frame
+        void setUpdateInterval(int frames);
+        int getUpdateInterval();
+
+        //switching marks every tile dirty; VSM needs setBlurShader() first
+        void setFilter(ShadowFilter filter);
+        ShadowFilter getFilter();
+        void setBlurShader(gps::Shader* shader);
+        //VSM scratch the tiles are blurred through, a GL_RG32F target at least getBlurTargetSize() square
+        //lent for the update (the frame graph's transient); without one the moments go unblurred
+        void setBlurTarget(GLuint framebuffer, GLuint texture);
+        static GLsizei getBlurTargetSize();
+        //re-renders every tile on the next update, e.g. after the caster shader was reloaded
+        void invalidate();
+
+        //when disabled every tile is re-rendered every frame
+        void setCachingEnabled(bool enabled);
+        bool isCachingEnabled();
+
+        //picks tile sizes, packs the atlas and re-renders the dirty tiles; expects the
+        //depth shader to be in use (the SHADOW_MOMENTS variant for SHADOW_FILTER_VSM)
+        void update(gps::Shader& depthShader, GLint modelLocation, GLint lightSpaceLocation,
+            glm::vec3 lightPosition, const glm::mat4& view, const glm::mat4& projection, int viewportHeight);
+
+        //binds the depth or moment atlas and the sampler the current filter needs
+        void bindForSampling(GLuint unit);
+        //sends the tile matrices and rectangles to the lit shader
+        void applyUniforms(gps::Shader& shader);
+
+        GLuint getTexture();
+        GLuint getFramebuffer();
+        void printStats(std::ostream& out);
+
+    private:
+        struct Caster {
+            gps::Model3D* model;
+            const glm::mat4* modelMatrix;
+            bool sphere;
+            //state the tile was last rendered with
+            glm::mat4 cachedMatrix;
+            glm::mat4 lightSpaceMatrix;
+            bool visible;
+            bool dirty;
+            //tile in texels, size 0 when the caster has no tile
+            GLint tileX, tileY;
+            GLsizei tileSize;
+            //the size the caster's screen coverage asks for, and the one pack places after halving
+            //everything until it fits; repacks compare against the first, which the halving leaves alone
+            GLsizei requestedSize;
+            GLsizei desiredSize;
+        };
+
+        GLsizei atlasSize = 0;
+        GLuint depthTexture = 0;
+        GLuint framebuffer = 0;
+        //VSM: moments share the depth atlas as depth buffer, blurTexture (not owned) holds one tile between the two blur passes
+        GLuint momentsTexture = 0;
+        GLuint momentsFramebuffer = 0;
+        GLuint blurTexture = 0;
+        GLuint blurFramebuffer = 0;
+        GLuint emptyVAO = 0;
+        gps::Shader* blurShader = NULL;
+        //compare (PCF), point (poisson) and linear (moments) samplers
+        GLuint compareSampler = 0;
+        GLuint pointSampler = 0;
+        GLuint linearSampler = 0;
+        ShadowFilter filter = SHADOW_FILTER_PCF;
+        std::vector<Caster> casters;
+        glm::vec3 cachedLightPosition;
+        bool cachingEnabled = true;
+        int updateInterval = 1;
+        int nextCaster = 0;
+
+        GLsizei computeDesiredSize(const gps::BoundingSphere& sphere, const glm::mat4& view,
+            const glm::mat4& projection, int viewportHeight, GLsizei previousSize);
+        bool pack();
+        void renderTile(gps::Shader& depthShader, GLint modelLocation, GLint lightSpaceLocation,
+            Caster& caster, glm::vec3 lightPosition);
+        void blurTile(const Caster& caster);
+    };
+}
+
+#endif /* ShadowAtlas_hpp */
@@ -0,0 +1,142 @@
+#include "SimulationThread.hpp"
+
+#include "CpuProfiler.hpp"
+
+#include <algorithm>
+#include <chrono>
+
+namespace gps {
+
+    //the ticks are stamped with it and the render thread measures against it
+    static double secondsNow() {
+        static const std::chrono::steady_clock::time_point epoch = std::chrono::steady_clock::now();
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - epoch).count();
+    }
+
+    //linear, then the rotation and scale columns are brought back to their blended lengths, so a body
+    //turning between two ticks does not shrink on the way
+    static glm::mat4 blend(const glm::mat4& a, const glm::mat4& b, float t) {
+        glm::mat4 result;
+        for (int c = 0; c < 4; c++)
+            result[c] = a[c] + (b[c] - a[c]) * t;
+        for (int c = 0; c < 3; c++) {
+            float lengthA = glm::length(glm::vec3(a[c]));
+            float length = glm::length(glm::vec3(result[c]));
+            if (length > 0.0f)
+                result[c] = result[c] * ((lengthA + (glm::length(glm::vec3(b[c])) - lengthA) * t) / length);
+        }
+        return result;
+    }
+
+    SimulationThread::~SimulationThread() {
+        stop();
+    }
+
+    void SimulationThread::start(Scene* scene, float tickRate) {
+        stop();
+        this->scene = scene;
+        tickInterval = 1.0 / tickRate;
+
+        //every slot starts as the state drawn so far
+        double time = secondsNow();
+        for (int i = 0; i < 3; i++) {
+            slots[i].time = slots[i].previousTime = time;
+            slots[i].matrices = slots[i].previousMatrices = scene->getDrawnMatrices();
+        }
+        lastTick = scene->getDrawnMatrices();
+        lastTickTime = time;
+        back = 0;
+        front = 1;
+        shared.store(2);
+        ticks.store(0);
+        resetRequested.store(false);
+
+        running.store(true);
+        thread = std::thread(&SimulationThread::run, this);
+    }
+
+    void SimulationThread::stop() {
+        if (!running.load())
+            return;
+        running.store(false);
+        thread.join();
+    }
+
+    bool SimulationThread::isRunning() {
+        return running.load();
+    }
+
+    void SimulationThread::setPaused(bool paused) {
+        this->paused.store(paused);
+    }
+
+    void SimulationThread::requestReset() {
+        resetRequested.store(true);
+    }
+
+    long long SimulationThread::getTickCount() {
+        return ticks.load();
+    }
+
+    void SimulationThread::run() {
+        GPS_PROFILE_THREAD("simulation");
+        TransformSystem& transforms = scene->getTransforms();
+        double next = secondsNow() + tickInterval;
+        while (running.load()) {
+            std::this_thread::sleep_for(std::chrono::duration<double>(std::max(0.0, next - secondsNow())));
+            {
+                GPS_PROFILE_SCOPE("simulationTick");
+                bool reset = resetRequested.exchange(false);
+                if (reset)
+                    transforms.reset();
+                transforms.update(paused.load() ? 0.0f : (float)tickInterval);
+                publish(next, reset);
+                ticks.fetch_add(1);
+            }
+
+            //after a stall (a debugger, a swapped out process) the missed ticks are dropped, not raced through
+            next += tickInterval;
+            double now = secondsNow();
+            if (now - next > 0.25)
+                next = now;
+        }
+    }
+
+    //the slot's old previous half is traded for lastTick instead of copied, lastTick is overwritten below
+    void SimulationThread::publish(double time, bool reset) {
+        Snapshot& slot = slots[back];
+        TransformSystem& transforms = scene->getTransforms();
+        for (size_t i = 0; i < slot.matrices.size(); i++)
+            slot.matrices[i] = *transforms.getModelMatrix(i);
+        slot.time = time;
+        if (reset) {
+            slot.previousMatrices = slot.matrices;
+            slot.previousTime = time;
+        }
+        else {
+            slot.previousMatrices.swap(lastTick);
+            slot.previousTime = lastTickTime;
+        }
+        lastTick = slot.matrices;
+        lastTickTime = time;
+        back = shared.exchange(back | FRESH, std::memory_order_acq_rel) & ~FRESH;
+    }
+
+    void SimulationThread::interpolate() {
+        GPS_PROFILE_FUNCTION();
+        if (shared.load(std::memory_order_relaxed) & FRESH)
+            front = shared.exchange(front, std::memory_order_acq_rel) & ~FRESH;
+
+        //a tick behind, so the next snapshot is usually in before it is needed
+        const Snapshot& latest = slots[front];
+        std::vector<glm::mat4>& drawn = scene->getDrawnMatrices();
+        if (latest.time <= latest.previousTime) {
+            std::copy(latest.matrices.begin(), latest.matrices.end(), drawn.begin());
+            return;
+        }
+        double t = (secondsNow() - tickInterval - latest.previousTime) / (latest.time - latest.previousTime);
+        float blendFactor = (float)std::min(std::max(t, 0.0), 1.0);
+        for (size_t i = 0; i < drawn.size(); i++)
+            drawn[i] = blend(latest.previousMatrices[i], latest.matrices[i], blendFactor);
+    }
+}
@@ -0,0 +1,72 @@
+#ifndef SimulationThread_hpp
+#define SimulationThread_hpp
+
+#include "Scene.hpp"
+
+#include <glm/glm.hpp>
+
+#include <atomic>
+#include <thread>
+#include <vector>
+
+namespace gps {
+
+    //steps a scene's transforms on a thread of its own at a fixed tick rate, so a slow frame does not slow
+    //the simulation and a heavy tick does not drop frames. Each tick publishes an immutable snapshot of the
+    //matrices, its own and the tick's before, through a lock-free triple buffer; the render thread draws a
+    //tick behind, blending the two
+    class SimulationThread {
+    public:
+        ~SimulationThread();
+
+        //the scene's transforms belong to the thread until stop, the render thread only calls interpolate
+        void start(Scene* scene, float tickRate);
+        void stop();
+        bool isRunning();
+
+        //paused ticks keep publishing the same state
+        void setPaused(bool paused);
+        //back to the scene file's state on the next tick, drawn without blending across it
+        void requestReset();
+
+        //render thread, once per frame: picks up the newest snapshot and writes the blend of the last two
+        //into the scene's drawn matrices
+        void interpolate();
+        long long getTickCount();
+
+    private:
+        struct Snapshot {
+            //steady clock seconds the tick and the one before stand for; the same after a reset, so
+            //nothing is blended across it
+            double time;
+            double previousTime;
+            std::vector<glm::mat4> matrices;
+            std::vector<glm::mat4> previousMatrices;
+        };
+
+        //set in the shared index when the slot there is newer than the reader's
+        static const int FRESH = 4;
+
+        Scene* scene = NULL;
+        double tickInterval = 1.0 / 60.0;
+        std::thread thread;
+        std::atomic<bool> running{ false };
+        std::atomic<bool> paused{ false };
+        std::atomic<bool> resetRequested{ false };
+        std::atomic<long long> ticks{ 0 };
+
+        //the writer fills back, the reader draws from front, and they trade through the shared index
+        Snapshot slots[3];
+        int back = 0;
+        int front = 1;
+        std::atomic<int> shared{ 2 };
+        //the writer's last tick, the previous half of the next snapshot
+        std::vector<glm::mat4> lastTick;
+        double lastTickTime = 0.0;
+
+        void run();
+        void publish(double time, bool reset);
+    };
+}
+
+#endif /* SimulationThread_hpp */
@@ -0,0 +1,196 @@
+#include "SoftwareOcclusion.hpp"
+
+#include "CpuProfiler.hpp"
+
+#include <algorithm>
+#include <cfloat>
+#include <chrono>
+#include <cmath>
+
+#include <xmmintrin.h>
+
+namespace gps {
+
+    //the sphere meshes are faceted, their faces lie slightly inside the bounding sphere
+    const float OCCLUDER_SHRINK = 0.95f;
+
+    const char* getOcclusionModeName(OcclusionMode mode) {
+        switch (mode) {
+        case OCCLUSION_OFF:
+            return "off";
+        case OCCLUSION_CPU:
+            return "cpu";
+        case OCCLUSION_GPU:
+            return "gpu";
+        default:
+            return "unknown";
+        }
+    }
+
+    SoftwareOcclusion::~SoftwareOcclusion() {
+        collect();
+    }
+
+    void SoftwareOcclusion::setJobSystem(JobSystem* jobs) {
+        collect();
+        this->jobs = jobs;
+    }
+
+    void SoftwareOcclusion::addObject(gps::Model3D* object, const glm::mat4* modelMatrix, bool occluder) {
+        collect();
+        objects.push_back({ object, modelMatrix, occluder });
+        visible.push_back(1);
+    }
+
+    void SoftwareOcclusion::beginFrame(const glm::mat4& view, const glm::mat4& projection, float zNear) {
+        //the previous job was never waited for if nothing was drawn
+        collect();
+
+        bounds.resize(objects.size());
+        for (size_t i = 0; i < objects.size(); i++) {
+            BoundingSphere sphere = objects[i].model->getBoundingSphere(*objects[i].modelMatrix);
+            bounds[i].center = glm::vec3(view * glm::vec4(sphere.center, 1.0f));
+            bounds[i].radius = sphere.radius;
+            bounds[i].occluder = objects[i].occluder;
+        }
+        projectionX = projection[0][0];
+        projectionY = projection[1][1];
+        this->zNear = zNear;
+
+        if (jobs != NULL)
+            jobs->run([this]() { cull(); }, &job);
+        else
+            cull();
+    }
+
+    bool SoftwareOcclusion::isVisible(size_t object) {
+        collect();
+        return object >= visible.size() || visible[object] != 0;
+    }
+
+    void SoftwareOcclusion::collect() {
+        if (jobs != NULL)
+            jobs->wait(job);
+    }
+
+    void SoftwareOcclusion::cull() {
+        GPS_PROFILE_FUNCTION();
+        auto start = std::chrono::high_resolution_clock::now();
+
+        depth.resize(WIDTH * HEIGHT);
+        __m128 farthest = _mm_set1_ps(FLT_MAX);
+        for (int i = 0; i < WIDTH * HEIGHT; i += 4)
+            _mm_storeu_ps(&depth[i], farthest);
+
+        for (size_t i = 0; i < bounds.size(); i++) {
+            if (bounds[i].occluder)
+                rasterizeOccluder(bounds[i]);
+        }
+
+        culledCount = 0;
+        for (size_t i = 0; i < bounds.size(); i++) {
+            visible[i] = testOccludee(bounds[i]) ? 1 : 0;
+            culledCount += visible[i] ? 0 : 1;
+        }
+
+        lastCullMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+    }
+
+    //the cross section through the center faces the camera at a single depth, its projection is a
+    //disc inside the silhouette and the surface in front of it is nearer, so writing the center
+    //depth into the pixels that disc fully covers never hides anything the sphere does not
+    void SoftwareOcclusion::rasterizeOccluder(const Bounds& occluder) {
+        float radius = occluder.radius * OCCLUDER_SHRINK;
+        float centerDepth = -occluder.center.z;
+        if (centerDepth <= zNear)
+            return;
+
+        //disc center and radii in pixels
+        float centerX = (occluder.center.x * projectionX / centerDepth + 1.0f) * 0.5f * WIDTH;
+        float centerY = (occluder.center.y * projectionY / centerDepth + 1.0f) * 0.5f * HEIGHT;
+        float radiusX = radius * projectionX / centerDepth * 0.5f * WIDTH;
+        float radiusY = radius * projectionY / centerDepth * 0.5f * HEIGHT;
+
+        //a pixel whose center is inside the disc may still be partly uncovered, so the test runs against
+        //the disc shrunk by half a pixel diagonal: a center inside that means the whole pixel is covered.
+        //Scaling both radii by the same factor keeps that true when the window's aspect stretches the disc
+        float shrink = 1.0f - 0.70710678f / std::min(radiusX, radiusY);
+        if (shrink <= 0.0f)
+            return;
+        radiusX *= shrink;
+        radiusY *= shrink;
+
+        //only pixels whose centers are inside the shrunk disc are written
+        int firstY = std::max(0, (int)std::ceil(centerY - radiusY - 0.5f));
+        int lastY = std::min(HEIGHT - 1, (int)std::floor(centerY + radiusY - 0.5f));
+        __m128 value = _mm_set1_ps(centerDepth);
+
+        for (int y = firstY; y <= lastY; y++) {
+            float t = (y + 0.5f - centerY) / radiusY;
+            float halfWidth = radiusX * std::sqrt(std::max(0.0f, 1.0f - t * t));
+            int firstX = std::max(0, (int)std::ceil(centerX - halfWidth - 0.5f));
+            int lastX = std::min(WIDTH - 1, (int)std::floor(centerX + halfWidth - 0.5f));
+
+            float* row = &depth[y * WIDTH];
+            int x = firstX;
+            for (; x <= lastX && (x & 3) != 0; x++)
+                row[x] = std::min(row[x], centerDepth);
+            for (; x + 3 <= lastX; x += 4)
+                _mm_storeu_ps(row + x, _mm_min_ps(_mm_loadu_ps(row + x), value));
+            for (; x <= lastX; x++)
+                row[x] = std::min(row[x], centerDepth);
+        }
+    }
+
+    //visible if any pixel under the sphere's screen rectangle is farther than its nearest point
+    bool SoftwareOcclusion::testOccludee(const Bounds& occludee) {
+        float radius = occludee.radius;
+        float nearDepth = -occludee.center.z - radius;
+        float farDepth = -occludee.center.z + radius;
+        //crossing the near plane, the rectangle is unbounded
+        if (nearDepth <= zNear)
+            return farDepth > zNear;
+
+        //screen extent of the bounding box; x/z is extreme at one of the two depths
+        const glm::vec3& center = occludee.center;
+        float left = std::min((center.x - radius) / nearDepth, (center.x - radius) / farDepth) * projectionX;
+        float right = std::max((center.x + radius) / nearDepth, (center.x + radius) / farDepth) * projectionX;
+        float bottom = std::min((center.y - radius) / nearDepth, (center.y - radius) / farDepth) * projectionY;
+        float top = std::max((center.y + radius) / nearDepth, (center.y + radius) / farDepth) * projectionY;
+        //outside the view frustum
+        if (left > 1.0f || right < -1.0f || bottom > 1.0f || top < -1.0f)
+            return false;
+
+        //widened to whole SSE blocks, testing extra pixels only makes the answer more conservative
+        int firstX = std::max(0, (int)std::floor((left + 1.0f) * 0.5f * WIDTH)) & ~3;
+        int lastX = std::min(WIDTH - 1, (int)std::floor((right + 1.0f) * 0.5f * WIDTH)) | 3;
+        int firstY = std::max(0, (int)std::floor((bottom + 1.0f) * 0.5f * HEIGHT));
+        int lastY = std::min(HEIGHT - 1, (int)std::floor((top + 1.0f) * 0.5f * HEIGHT));
+        __m128 value = _mm_set1_ps(nearDepth);
+
+        for (int y = firstY; y <= lastY; y++) {
+            const float* row = &depth[y * WIDTH];
+            for (int x = firstX; x < lastX; x += 4) {
+                if (_mm_movemask_ps(_mm_cmpgt_ps(_mm_loadu_ps(row + x), value)) != 0)
+                    return true;
+            }
+        }
+        return false;
+    }
+
+    double SoftwareOcclusion::getLastCullMs() {
+        collect();
+        return lastCullMs;
+    }
+
+    int SoftwareOcclusion::getCulledCount() {
+        collect();
+        return culledCount;
+    }
+
+    void SoftwareOcclusion::printStats(std::ostream& out) {
+        collect();
+        out << "Occlusion culling: " << culledCount << " of " << objects.size() << " objects culled, "
+            << lastCullMs << " ms on the worker" << std::endl;
+    }
+}
@@ -0,0 +1,89 @@
+#ifndef SoftwareOcclusion_hpp
+#define SoftwareOcclusion_hpp
+
+#include <glm/glm.hpp>
+
+#include "JobSystem.hpp"
+#include "Model3D.hpp"
+
+#include <iostream>
+#include <vector>
+
+namespace gps {
+
+    enum OcclusionMode {
+        OCCLUSION_OFF = 0,
+        //occluder spheres rasterized on the cpu, see gps::SoftwareOcclusion
+        OCCLUSION_CPU = 1,
+        //bounding box proxies in hardware occlusion queries, see gps::GpuOcclusion
+        OCCLUSION_GPU = 2,
+        OCCLUSION_MODE_COUNT = 3
+    };
+
+    const char* getOcclusionModeName(OcclusionMode mode);
+
+    //cpu occlusion culling: the large spheres (planets, the sun) are rasterized as conservative
+    //discs into a small linear depth buffer with SSE, then the bounding sphere of every object is
+    //tested against it; both run as one job while the render thread draws the shadow pass
+    class SoftwareOcclusion {
+    public:
+        //multiples of 4, so every row splits into whole SSE blocks
+        static const int WIDTH = 256;
+        static const int HEIGHT = 144;
+
+        ~SoftwareOcclusion();
+
+        //runs the job on the pool; NULL (the default) culls right in beginFrame
+        void setJobSystem(JobSystem* jobs);
+
+        //occluders are tested as well, so a planet behind another one is culled too
+        void addObject(gps::Model3D* object, const glm::mat4* modelMatrix, bool occluder);
+
+        //snapshots the bounds of every object and starts the job, once this frame's matrices are final;
+        //projection must be a symmetric perspective
+        void beginFrame(const glm::mat4& view, const glm::mat4& projection, float zNear);
+        //object is the index in addObject order, bodies sharing a model each have their own;
+        //waits for the job the first time it is called in a frame; unknown objects are always visible
+        bool isVisible(size_t object);
+
+        //worker time of the last job and its result
+        double getLastCullMs();
+        int getCulledCount();
+        void printStats(std::ostream& out);
+
+    private:
+        struct Object {
+            gps::Model3D* model;
+            const glm::mat4* modelMatrix;
+            bool occluder;
+        };
+
+        //view space sphere, snapshotted for the worker
+        struct Bounds {
+            glm::vec3 center;
+            float radius;
+            bool occluder;
+        };
+
+        std::vector<Object> objects;
+        std::vector<Bounds> bounds;
+        std::vector<char> visible;
+        //linear view depth, cleared to the largest float
+        std::vector<float> depth;
+        float projectionX = 1.0f;
+        float projectionY = 1.0f;
+        float zNear = 0.1f;
+
+        JobSystem* jobs = NULL;
+        JobSystem::Counter job;
+        double lastCullMs = 0.0;
+        int culledCount = 0;
+
+        void collect();
+        void cull();
+        void rasterizeOccluder(const Bounds& occluder);
+        bool testOccludee(const Bounds& occludee);
+    };
+}
+
+#endif /* SoftwareOcclusion_hpp */
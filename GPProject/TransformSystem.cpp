@@ -0,0 +1,398 @@
+#include "TransformSystem.hpp"
+
+#include "CpuProfiler.hpp"
+
+#include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtc/type_ptr.hpp>
+
+#include <algorithm>
+#include <cstring>
+
+#ifdef __AVX2__
+#include <immintrin.h>
+#else
+#include <emmintrin.h>
+#endif
+
+namespace gps {
+
+    const float DEGREES_TO_RADIANS = 0.01745329252f;
+
+    //the few operations the kernels need, on 8 or 4 lanes
+#ifdef __AVX2__
+    const size_t WIDTH = 8;
+    typedef __m256 Floats;
+    typedef __m256i Ints;
+
+    static inline Floats set1(float value) { return _mm256_set1_ps(value); }
+    static inline Floats load(const float* source) { return _mm256_loadu_ps(source); }
+    static inline void store(float* target, Floats value) { _mm256_storeu_ps(target, value); }
+    static inline Floats add(Floats a, Floats b) { return _mm256_add_ps(a, b); }
+    static inline Floats sub(Floats a, Floats b) { return _mm256_sub_ps(a, b); }
+    static inline Floats mul(Floats a, Floats b) { return _mm256_mul_ps(a, b); }
+    static inline Ints roundToInt(Floats value) { return _mm256_cvtps_epi32(value); }
+    static inline Ints truncateToInt(Floats value) { return _mm256_cvttps_epi32(value); }
+    static inline Floats toFloat(Ints value) { return _mm256_cvtepi32_ps(value); }
+    static inline Ints addInt(Ints a, int b) { return _mm256_add_epi32(a, _mm256_set1_epi32(b)); }
+    //the float sign bit wherever bit 1 of value is set
+    static inline Floats signOfBit1(Ints value) {
+        return _mm256_castsi256_ps(_mm256_slli_epi32(_mm256_and_si256(value, _mm256_set1_epi32(2)), 30));
+    }
+    static inline Floats flipSign(Floats value, Floats sign) { return _mm256_xor_ps(value, sign); }
+    //b wherever bit 0 of value is set, a elsewhere
+    static inline Floats selectOnBit0(Ints value, Floats a, Floats b) {
+        Ints one = _mm256_set1_epi32(1);
+        return _mm256_blendv_ps(a, b, _mm256_castsi256_ps(_mm256_cmpeq_epi32(_mm256_and_si256(value, one), one)));
+    }
+#else
+    const size_t WIDTH = 4;
+    typedef __m128 Floats;
+    typedef __m128i Ints;
+
+    static inline Floats set1(float value) { return _mm_set1_ps(value); }
+    static inline Floats load(const float* source) { return _mm_loadu_ps(source); }
+    static inline void store(float* target, Floats value) { _mm_storeu_ps(target, value); }
+    static inline Floats add(Floats a, Floats b) { return _mm_add_ps(a, b); }
+    static inline Floats sub(Floats a, Floats b) { return _mm_sub_ps(a, b); }
+    static inline Floats mul(Floats a, Floats b) { return _mm_mul_ps(a, b); }
+    static inline Ints roundToInt(Floats value) { return _mm_cvtps_epi32(value); }
+    static inline Ints truncateToInt(Floats value) { return _mm_cvttps_epi32(value); }
+    static inline Floats toFloat(Ints value) { return _mm_cvtepi32_ps(value); }
+    static inline Ints addInt(Ints a, int b) { return _mm_add_epi32(a, _mm_set1_epi32(b)); }
+    static inline Floats signOfBit1(Ints value) {
+        return _mm_castsi128_ps(_mm_slli_epi32(_mm_and_si128(value, _mm_set1_epi32(2)), 30));
+    }
+    static inline Floats flipSign(Floats value, Floats sign) { return _mm_xor_ps(value, sign); }
+    static inline Floats selectOnBit0(Ints value, Floats a, Floats b) {
+        Ints one = _mm_set1_epi32(1);
+        Floats mask = _mm_castsi128_ps(_mm_cmpeq_epi32(_mm_and_si128(value, one), one));
+        return _mm_or_ps(_mm_and_ps(mask, b), _mm_andnot_ps(mask, a));
+    }
+#endif
+
+    //keeps accumulated angles within one turn, so they stay precise and the sine kernel's range holds
+    static inline float wrapDegrees(float degrees) {
+        return degrees - 360.0f * (float)(int)(degrees * (1.0f / 360.0f));
+    }
+
+    static inline Floats wrapDegrees(Floats degrees) {
+        return sub(degrees, mul(set1(360.0f), toFloat(truncateToInt(mul(degrees, set1(1.0f / 360.0f))))));
+    }
+
+    //sine and cosine of angles within one turn: whole quarter turns plus a remainder within 45 degrees,
+    //the remainder through the cephes sinf/cosf polynomials
+    static inline void sinCosDegrees(Floats degrees, Floats& sine, Floats& cosine) {
+        Ints quadrant = roundToInt(mul(degrees, set1(1.0f / 90.0f)));
+        Floats x = mul(sub(degrees, mul(toFloat(quadrant), set1(90.0f))), set1(DEGREES_TO_RADIANS));
+        Floats z = mul(x, x);
+
+        Floats s = add(mul(set1(-1.9515295891e-4f), z), set1(8.3321608736e-3f));
+        s = add(mul(s, z), set1(-1.6666654611e-1f));
+        s = add(mul(mul(s, z), x), x);
+        Floats c = add(mul(set1(2.443315711809948e-5f), z), set1(-1.388731625493765e-3f));
+        c = add(mul(c, z), set1(4.166664568298827e-2f));
+        c = add(sub(mul(mul(c, z), z), mul(set1(0.5f), z)), set1(1.0f));
+
+        //quarter turn 0..3: sine is s, c, -s, -c and cosine c, -s, -c, s
+        sine = flipSign(selectOnBit0(quadrant, s, c), signOfBit1(quadrant));
+        cosine = flipSign(selectOnBit0(quadrant, c, s), signOfBit1(addInt(quadrant, 1)));
+    }
+
+    //four y rotations scaled by s (cosine * s in a, sine * s in b) and positions, as columns of glm matrices
+    static inline void storeModelMatrices(glm::mat4* target, __m128 a, __m128 b, __m128 s, __m128 x, __m128 y, __m128 z) {
+        __m128 zero = _mm_setzero_ps();
+        __m128 column0[4] = { a, zero, _mm_sub_ps(zero, b), zero };
+        __m128 column1[4] = { zero, s, zero, zero };
+        __m128 column2[4] = { b, zero, a, zero };
+        __m128 column3[4] = { x, y, z, _mm_set1_ps(1.0f) };
+        __m128* columns[4] = { column0, column1, column2, column3 };
+        for (int c = 0; c < 4; c++) {
+            __m128* rows = columns[c];
+            _MM_TRANSPOSE4_PS(rows[0], rows[1], rows[2], rows[3]);
+            for (int body = 0; body < 4; body++)
+                _mm_storeu_ps(glm::value_ptr(target[body]) + 4 * c, rows[body]);
+        }
+    }
+
+#ifdef __AVX2__
+    static inline void storeModelMatrices(glm::mat4* target, Floats a, Floats b, Floats s, Floats x, Floats y, Floats z) {
+        storeModelMatrices(target, _mm256_castps256_ps128(a), _mm256_castps256_ps128(b), _mm256_castps256_ps128(s),
+            _mm256_castps256_ps128(x), _mm256_castps256_ps128(y), _mm256_castps256_ps128(z));
+        storeModelMatrices(target + 4, _mm256_extractf128_ps(a, 1), _mm256_extractf128_ps(b, 1), _mm256_extractf128_ps(s, 1),
+            _mm256_extractf128_ps(x, 1), _mm256_extractf128_ps(y, 1), _mm256_extractf128_ps(z, 1));
+    }
+#endif
+
+    const char* TransformSystem::getKernelName() {
+#ifdef __AVX2__
+        return "avx2";
+#else
+        return "sse2";
+#endif
+    }
+
+    void TransformSystem::clear() {
+        count = 0;
+        parents.clear();
+        subtreeEnds.clear();
+        moving.clear();
+        movingBodies = 0;
+        initial.clear();
+        resize(0);
+    }
+
+    void TransformSystem::resize(size_t size) {
+        size_t padded = (size + WIDTH - 1) / WIDTH * WIDTH;
+        std::vector<float>* arrays[] = {
+            &orbitRadius, &orbitSpeed, &orbitAngle, &spinSpeed, &spinAngle, &scale,
+            &offsetX, &offsetY, &offsetZ, &velocityX, &velocityY, &velocityZ,
+            &localCos, &localSin, &localX, &localY, &localZ,
+            &frameCos, &frameSin, &frameX, &frameY, &frameZ, &spinCos, &spinSin
+        };
+        for (std::vector<float>* array : arrays)
+            array->resize(padded, 0.0f);
+        dirty.resize(padded, 0);
+        modelMatrices.resize(padded, glm::mat4(1.0f));
+    }
+
+    size_t TransformSystem::addBody(const BodyMotion& motion) {
+        size_t body = count++;
+        resize(count);
+        parents.push_back(motion.parent);
+        subtreeEnds.push_back(count);
+        moving.push_back(0);
+        initial.push_back(motion);
+        subtreesChanged = true;
+        setBody(body, motion);
+        return body;
+    }
+
+    void TransformSystem::setMotion(size_t body, const BodyMotion& motion) {
+        initial[body] = motion;
+        initial[body].parent = parents[body];
+        setBody(body, motion);
+    }
+
+    void TransformSystem::setBody(size_t body, const BodyMotion& motion) {
+        orbitRadius[body] = motion.orbitRadius;
+        orbitSpeed[body] = motion.orbitSpeed;
+        spinSpeed[body] = motion.spinSpeed;
+        scale[body] = motion.scale;
+        velocityX[body] = motion.velocity.x;
+        velocityY[body] = motion.velocity.y;
+        velocityZ[body] = motion.velocity.z;
+        orbitAngle[body] = motion.orbitPhase;
+        spinAngle[body] = motion.heading;
+        offsetX[body] = motion.position.x;
+        offsetY[body] = motion.position.y;
+        offsetZ[body] = motion.position.z;
+        movingBodies -= moving[body];
+        moving[body] = motion.orbitSpeed != 0.0f || motion.spinSpeed != 0.0f || motion.velocity != glm::vec3(0.0f);
+        movingBodies += moving[body];
+        dirty[body] = 1;
+        edited = true;
+    }
+
+    //children close their parent's range, so one backwards pass finds every subtree's end
+    void TransformSystem::updateSubtreeEnds() {
+        for (size_t i = 0; i < count; i++)
+            subtreeEnds[i] = i + 1;
+        for (size_t i = count; i-- > 0;) {
+            if (parents[i] >= 0)
+                subtreeEnds[parents[i]] = std::max(subtreeEnds[parents[i]], subtreeEnds[i]);
+        }
+        subtreesChanged = false;
+    }
+
+    void TransformSystem::reset() {
+        for (size_t i = 0; i < count; i++) {
+            orbitAngle[i] = initial[i].orbitPhase;
+            spinAngle[i] = initial[i].heading;
+            offsetX[i] = initial[i].position.x;
+            offsetY[i] = initial[i].position.y;
+            offsetZ[i] = initial[i].position.z;
+            dirty[i] = 1;
+        }
+        edited = true;
+    }
+
+    //any dirty flag in the block starting at first, all at once
+    bool TransformSystem::isBlockDirty(size_t first) {
+        unsigned long long flags = 0;
+        std::memcpy(&flags, &dirty[first], WIDTH);
+        return flags != 0;
+    }
+
+    void TransformSystem::setJobSystem(JobSystem* jobs) {
+        this->jobs = jobs;
+    }
+
+    void TransformSystem::parallelFor(size_t count, const JobSystem::RangeJob& body, size_t minChunk) {
+        if (jobs != NULL)
+            jobs->parallelFor(count, body, minChunk);
+        else if (count > 0)
+            body(0, count);
+    }
+
+    void TransformSystem::update(float deltaTime) {
+        GPS_PROFILE_FUNCTION();
+        if (subtreesChanged)
+            updateSubtreeEnds();
+        //still bodies only change when edited, and nothing moves while the simulation is paused
+        bool stepping = deltaTime != 0.0f && movingBodies > 0;
+        if (!stepping && !edited)
+            return;
+        if (stepping) {
+            for (size_t i = 0; i < count; i++)
+                dirty[i] |= moving[i];
+        }
+        edited = false;
+
+        parallelFor(orbitAngle.size() / WIDTH, [this, deltaTime](size_t begin, size_t end) {
+            updateLocals(begin * WIDTH, end * WIDTH, deltaTime);
+        }, 256);
+
+        //dirty subtrees are contiguous ranges, found in one scan that steps over clean bodies a block
+        //or a flag at a time
+        dirtyRanges.clear();
+        dirtyBlocks.clear();
+        size_t body = 0;
+        while (body < count) {
+            if (body % WIDTH == 0 && !isBlockDirty(body)) {
+                body += WIDTH;
+                continue;
+            }
+            if (!dirty[body]) {
+                body++;
+                continue;
+            }
+            size_t end = subtreeEnds[body];
+            dirtyRanges.push_back(body);
+            dirtyRanges.push_back(end);
+            for (size_t i = body / WIDTH * WIDTH; i < end; i += WIDTH) {
+                if (dirtyBlocks.empty() || dirtyBlocks.back() != i)
+                    dirtyBlocks.push_back(i);
+            }
+            body = end;
+        }
+
+        //each range is composed into its parents' frames; those lie outside every range, so they are
+        //final already and the ranges are independent
+        parallelFor(dirtyRanges.size() / 2, [this](size_t begin, size_t end) {
+            for (size_t r = begin; r < end; r++) {
+                for (size_t i = dirtyRanges[2 * r]; i < dirtyRanges[2 * r + 1]; i++) {
+                    composeFrame(i);
+                    dirty[i] = 0;
+                }
+            }
+        }, 1);
+        //whole blocks, once even when ranges share them; their clean bodies get the same matrices again
+        parallelFor(dirtyBlocks.size(), [this](size_t begin, size_t end) {
+            for (size_t b = begin; b < end; b++)
+                storeBlock(dirtyBlocks[b]);
+        }, 256);
+    }
+
+    //everything relative to the parent, no dependencies between bodies; blocks without a dirty body
+    //keep their values, the still bodies in the others advance by zero
+    void TransformSystem::updateLocals(size_t first, size_t end, float deltaTime) {
+        Floats delta = set1(deltaTime);
+        for (size_t i = first; i < end; i += WIDTH) {
+            if (!isBlockDirty(i))
+                continue;
+
+            Floats orbit = wrapDegrees(add(load(&orbitAngle[i]), mul(load(&orbitSpeed[i]), delta)));
+            Floats spin = wrapDegrees(add(load(&spinAngle[i]), mul(load(&spinSpeed[i]), delta)));
+            Floats x = add(load(&offsetX[i]), mul(load(&velocityX[i]), delta));
+            Floats y = add(load(&offsetY[i]), mul(load(&velocityY[i]), delta));
+            Floats z = add(load(&offsetZ[i]), mul(load(&velocityZ[i]), delta));
+            store(&orbitAngle[i], orbit);
+            store(&spinAngle[i], spin);
+            store(&offsetX[i], x);
+            store(&offsetY[i], y);
+            store(&offsetZ[i], z);
+
+            Floats orbitSin, orbitCos, sine, cosine;
+            sinCosDegrees(orbit, orbitSin, orbitCos);
+            sinCosDegrees(spin, sine, cosine);
+            x = add(x, load(&orbitRadius[i]));
+            store(&localCos[i], orbitCos);
+            store(&localSin[i], orbitSin);
+            store(&localX[i], add(mul(orbitCos, x), mul(orbitSin, z)));
+            store(&localY[i], y);
+            store(&localZ[i], sub(mul(orbitCos, z), mul(orbitSin, x)));
+            store(&spinCos[i], cosine);
+            store(&spinSin[i], sine);
+        }
+    }
+
+    //into the parent's frame: the angles add, the offset turns by the parent's angle; a handful of flops,
+    //scalar since a child may sit in the same block as its parent
+    void TransformSystem::composeFrame(size_t body) {
+        int parent = parents[body];
+        if (parent < 0) {
+            frameCos[body] = localCos[body];
+            frameSin[body] = localSin[body];
+            frameX[body] = localX[body];
+            frameY[body] = localY[body];
+            frameZ[body] = localZ[body];
+            return;
+        }
+        float parentCos = frameCos[parent];
+        float parentSin = frameSin[parent];
+        frameCos[body] = parentCos * localCos[body] - parentSin * localSin[body];
+        frameSin[body] = parentSin * localCos[body] + parentCos * localSin[body];
+        frameX[body] = frameX[parent] + parentCos * localX[body] + parentSin * localZ[body];
+        frameY[body] = frameY[parent] + localY[body];
+        frameZ[body] = frameZ[parent] - parentSin * localX[body] + parentCos * localZ[body];
+    }
+
+    //the spin on top of the frame angle, then the matrices of one block
+    void TransformSystem::storeBlock(size_t first) {
+        Floats frameC = load(&frameCos[first]);
+        Floats frameS = load(&frameSin[first]);
+        Floats spinC = load(&spinCos[first]);
+        Floats spinS = load(&spinSin[first]);
+        Floats s = load(&scale[first]);
+        Floats cosine = sub(mul(frameC, spinC), mul(frameS, spinS));
+        Floats sine = add(mul(frameS, spinC), mul(frameC, spinS));
+        storeModelMatrices(&modelMatrices[first], mul(cosine, s), mul(sine, s), s,
+            load(&frameX[first]), load(&frameY[first]), load(&frameZ[first]));
+    }
+
+    void TransformSystem::updateReference(float deltaTime) {
+        GPS_PROFILE_FUNCTION();
+        referenceFrames.resize(count);
+        const glm::vec3 yAxis(0.0f, 1.0f, 0.0f);
+        for (size_t i = 0; i < count; i++) {
+            orbitAngle[i] = wrapDegrees(orbitAngle[i] + orbitSpeed[i] * deltaTime);
+            spinAngle[i] = wrapDegrees(spinAngle[i] + spinSpeed[i] * deltaTime);
+            offsetX[i] += velocityX[i] * deltaTime;
+            offsetY[i] += velocityY[i] * deltaTime;
+            offsetZ[i] += velocityZ[i] * deltaTime;
+
+            glm::mat4 frame = parents[i] >= 0 ? referenceFrames[parents[i]] : glm::mat4(1.0f);
+            frame = glm::rotate(frame, glm::radians(orbitAngle[i]), yAxis);
+            frame = glm::translate(frame, glm::vec3(orbitRadius[i] + offsetX[i], offsetY[i], offsetZ[i]));
+            referenceFrames[i] = frame;
+
+            glm::mat4 model = glm::rotate(frame, glm::radians(spinAngle[i]), yAxis);
+            modelMatrices[i] = glm::scale(model, glm::vec3(scale[i]));
+            //the SIMD path's per body state is stale now, so it starts over
+            dirty[i] = 1;
+        }
+        edited = true;
+    }
+
+    size_t TransformSystem::getCount() {
+        return count;
+    }
+
+    const glm::mat4* TransformSystem::getModelMatrix(size_t body) {
+        return &modelMatrices[body];
+    }
+
+    glm::vec3 TransformSystem::getVelocity(size_t body) {
+        return glm::vec3(velocityX[body], velocityY[body], velocityZ[body]);
+    }
+}
@@ -0,0 +1,102 @@
+#ifndef TransformSystem_hpp
+#define TransformSystem_hpp
+
+#include "JobSystem.hpp"
+
+#include <glm/glm.hpp>
+
+#include <vector>
+
+namespace gps {
+
+    //how one body moves: parent frame * orbit rotation * (radius + position + velocity * t) translation,
+    //then spin and scale for the model matrix; angles in degrees, speeds per second
+    struct BodyMotion {
+        //an earlier body, or -1 for the world origin
+        int parent;
+        float orbitRadius;
+        float orbitSpeed;
+        float orbitPhase;
+        float spinSpeed;
+        float heading;
+        float scale;
+        glm::vec3 position;
+        glm::vec3 velocity;
+    };
+
+    //model matrices of every body, kept as structure of arrays. Every rotation is about y, so a body's
+    //frame is one angle and a position, and each matrix has a closed form: the sines and cosines and the
+    //matrices are computed 4 (SSE2) or 8 (AVX2 builds) bodies at a time, and only the short walk along
+    //the parent links is scalar.
+    //Bodies are a scene graph in depth-first order, so every subtree is one contiguous range: moving or
+    //edited bodies are dirty, and update recomputes each dirty subtree in one linear sweep and skips the rest
+    class TransformSystem {
+    public:
+        //"avx2" or "sse2", whichever the build compiled in
+        static const char* getKernelName();
+
+        void clear();
+        //in depth-first order: a body comes after its parent and the parent's earlier children's
+        //subtrees; returns the body's index
+        size_t addBody(const BodyMotion& motion);
+        //replaces a body's motion (not its parent) and restarts it from the new phase, heading and position
+        void setMotion(size_t body, const BodyMotion& motion);
+        //back to the phases, headings and positions the bodies were added with
+        void reset();
+
+        //spreads update over the pool, NULL (the default) keeps it on the calling thread
+        void setJobSystem(JobSystem* jobs);
+        void update(float deltaTime);
+        //the same result as update with one glm::rotate/translate/rotate/scale chain per body, for comparison
+        void updateReference(float deltaTime);
+
+        size_t getCount();
+        //stable until the next add or clear, other systems keep the pointer
+        const glm::mat4* getModelMatrix(size_t body);
+        glm::vec3 getVelocity(size_t body);
+
+    private:
+        size_t count = 0;
+        JobSystem* jobs = NULL;
+
+        std::vector<int> parents;
+        //one past the body's last descendant
+        std::vector<size_t> subtreeEnds;
+        bool subtreesChanged = false;
+        //any speed or velocity, so it changes every step
+        std::vector<unsigned char> moving;
+        size_t movingBodies = 0;
+        //needs its matrix and its whole subtree recomputed; padded like the float arrays
+        std::vector<unsigned char> dirty;
+        //per update: first and end body of each dirty subtree, and the blocks they touch
+        std::vector<size_t> dirtyRanges;
+        std::vector<size_t> dirtyBlocks;
+        //a body was added, edited or reset since the last update
+        bool edited = false;
+        std::vector<BodyMotion> initial;
+        //inputs, each array padded to whole SIMD blocks
+        std::vector<float> orbitRadius, orbitSpeed, orbitAngle;
+        std::vector<float> spinSpeed, spinAngle, scale;
+        std::vector<float> offsetX, offsetY, offsetZ;
+        std::vector<float> velocityX, velocityY, velocityZ;
+        //orbit frame relative to the parent, then in the world: the frame angle's cosine and sine and the position
+        std::vector<float> localCos, localSin, localX, localY, localZ;
+        std::vector<float> frameCos, frameSin, frameX, frameY, frameZ;
+        std::vector<float> spinCos, spinSin;
+
+        std::vector<glm::mat4> modelMatrices;
+        //world frames of the reference path
+        std::vector<glm::mat4> referenceFrames;
+
+        void parallelFor(size_t count, const JobSystem::RangeJob& body, size_t minChunk);
+        void resize(size_t size);
+        void setBody(size_t body, const BodyMotion& motion);
+        void updateSubtreeEnds();
+        void updateLocals(size_t first, size_t end, float deltaTime);
+        void composeFrame(size_t body);
+        void storeBlock(size_t first);
+        bool isBlockDirty(size_t first);
+    };
+}
+
+#endif /* TransformSystem_hpp */
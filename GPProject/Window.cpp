@@ -1,15 +1,23 @@
 #include "Window.h"
 
+#ifdef GPS_HEADLESS_EGL
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+
+#include <cstring>
+#include <string>
+#endif
+
 namespace gps {
 
-    void Window::Create(int width, int height, const char *title) {
+    void Window::Create(int width, int height, const char *title, int samples) {
         if (!glfwInit()) {
             throw std::runtime_error("Could not start GLFW3!");
         }
 
         //window hints
         glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4);
-        glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 1);
+        glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
         glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
         glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
 
@@ -17,15 +25,21 @@ namespace gps {
         glfwWindowHint(GLFW_SRGB_CAPABLE, GLFW_TRUE);
 
         // for multisampling/antialising
-        glfwWindowHint(GLFW_SAMPLES, 4);
+        glfwWindowHint(GLFW_SAMPLES, samples);
 
+        //4.3 enables the gpu-driven path; 4.1 is the most macOS offers
         this->window = glfwCreateWindow(width, height, title, NULL, NULL);
+        if (!this->window) {
+            glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 1);
+            this->window = glfwCreateWindow(width, height, title, NULL, NULL);
+        }
         if (!this->window) {
             throw std::runtime_error("Could not create GLFW3 window!");
         }
 
         glfwMakeContextCurrent(window);
 
+        //vsync until the caller picks a mode (see gps::FramePacer)
         glfwSwapInterval(1);
 
         // start GLEW extension handler
@@ -42,7 +56,119 @@ namespace gps {
         glfwGetFramebufferSize(window, &this->dimensions.width, &this->dimensions.height);
     }
 
+    void Window::CreateHeadless(int width, int height) {
+#ifdef GPS_HEADLESS_EGL
+        //the surfaceless platform needs no display server; the default display is the fallback
+        EGLDisplay display = EGL_NO_DISPLAY;
+        PFNEGLGETPLATFORMDISPLAYEXTPROC getPlatformDisplay =
+            (PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
+        if (getPlatformDisplay)
+            display = getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, NULL);
+        if (display == EGL_NO_DISPLAY)
+            display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+        if (display == EGL_NO_DISPLAY || !eglInitialize(display, NULL, NULL)) {
+            throw std::runtime_error("Could not initialize an EGL display!");
+        }
+        if (!eglBindAPI(EGL_OPENGL_API)) {
+            eglTerminate(display);
+            throw std::runtime_error("EGL has no desktop OpenGL!");
+        }
+
+        //no surface is ever made, so any config that renders desktop GL will do
+        EGLConfig config = EGL_NO_CONFIG_KHR;
+        const char* extensions = eglQueryString(display, EGL_EXTENSIONS);
+        if (!extensions || !std::strstr(extensions, "EGL_KHR_no_config_context")) {
+            EGLint configAttributes[] = {
+                EGL_SURFACE_TYPE, EGL_PBUFFER_BIT,
+                EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+                EGL_NONE
+            };
+            EGLint configCount = 0;
+            if (!eglChooseConfig(display, configAttributes, &config, 1, &configCount) || configCount == 0) {
+                eglTerminate(display);
+                throw std::runtime_error("No EGL config renders desktop OpenGL!");
+            }
+        }
+
+        //same versions as the windowed path: 4.3 for the gpu-driven path, 4.1 otherwise
+        EGLContext context = EGL_NO_CONTEXT;
+        const EGLint minorVersions[] = { 3, 1 };
+        for (int i = 0; i < 2 && context == EGL_NO_CONTEXT; i++) {
+            EGLint contextAttributes[] = {
+                EGL_CONTEXT_MAJOR_VERSION, 4,
+                EGL_CONTEXT_MINOR_VERSION, minorVersions[i],
+                EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,
+                EGL_CONTEXT_OPENGL_FORWARD_COMPATIBLE, EGL_TRUE,
+                EGL_NONE
+            };
+            context = eglCreateContext(display, config, EGL_NO_CONTEXT, contextAttributes);
+        }
+        if (context == EGL_NO_CONTEXT || !eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, context)) {
+            eglTerminate(display);
+            throw std::runtime_error("Could not create a headless OpenGL 4.1 context!");
+        }
+
+        this->headless = true;
+        this->eglDisplay = display;
+        this->eglContext = context;
+        this->headlessStart = std::chrono::steady_clock::now();
+
+        // start GLEW extension handler; a GLX build of GLEW finds no GLX display under EGL, but it has
+        // loaded the GL entry points by then, so only that error is let through
+        glewExperimental = GL_TRUE;
+        GLenum glewStatus = glewInit();
+        if (glewStatus != GLEW_OK && !(glewStatus == GLEW_ERROR_NO_GLX_DISPLAY && glGenFramebuffers != NULL)) {
+            eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+            eglDestroyContext(display, context);
+            eglTerminate(display);
+            this->headless = false;
+            throw std::runtime_error(std::string("Could not start GLEW: ") + (const char*)glewGetErrorString(glewStatus));
+        }
+        glGetError();
+
+        const GLubyte* renderer = glGetString(GL_RENDERER);
+        const GLubyte* version = glGetString(GL_VERSION);
+        std::cout << "Renderer: " << renderer << " (headless)" << std::endl;
+        std::cout << "OpenGL version: " << version << std::endl;
+
+        //stands in for the default framebuffer, sRGB like the windowed one
+        glGenRenderbuffers(1, &colorRenderbuffer);
+        glBindRenderbuffer(GL_RENDERBUFFER, colorRenderbuffer);
+        glRenderbufferStorage(GL_RENDERBUFFER, GL_SRGB8_ALPHA8, width, height);
+        glGenRenderbuffers(1, &depthRenderbuffer);
+        glBindRenderbuffer(GL_RENDERBUFFER, depthRenderbuffer);
+        glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH24_STENCIL8, width, height);
+        glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+        glGenFramebuffers(1, &framebuffer);
+        glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+        glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, colorRenderbuffer);
+        glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_RENDERBUFFER, depthRenderbuffer);
+        if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+            throw std::runtime_error("Headless framebuffer is incomplete!");
+        }
+
+        this->dimensions.width = width;
+        this->dimensions.height = height;
+#else
+        (void)width;
+        (void)height;
+        throw std::runtime_error("Headless mode needs a build with GPS_HEADLESS_EGL defined and libEGL linked!");
+#endif
+    }
+
     void Window::Delete() {
+#ifdef GPS_HEADLESS_EGL
+        if (headless) {
+            glDeleteFramebuffers(1, &framebuffer);
+            glDeleteRenderbuffers(1, &colorRenderbuffer);
+            glDeleteRenderbuffers(1, &depthRenderbuffer);
+            eglMakeCurrent(eglDisplay, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+            eglDestroyContext(eglDisplay, eglContext);
+            eglTerminate(eglDisplay);
+            return;
+        }
+#endif
         if (window)
             glfwDestroyWindow(window);
         //close GL context and any other GLFW resources
@@ -53,6 +179,44 @@ namespace gps {
         return this->window;
     }
 
+    bool Window::isHeadless() {
+        return headless;
+    }
+
+    GLuint Window::getFramebuffer() {
+        return framebuffer;
+    }
+
+    bool Window::shouldClose() {
+        return closeRequested || (window && glfwWindowShouldClose(window));
+    }
+
+    void Window::setShouldClose(bool close) {
+        closeRequested = close;
+        if (window)
+            glfwSetWindowShouldClose(window, close);
+    }
+
+    void Window::pollEvents() {
+        if (!headless)
+            glfwPollEvents();
+    }
+
+    void Window::swapBuffers() {
+        if (headless) {
+            //nothing is presented; waiting for the frame keeps the cpu from queueing frames without bound
+            glFinish();
+            return;
+        }
+        glfwSwapBuffers(window);
+    }
+
+    double Window::getTime() {
+        if (headless)
+            return std::chrono::duration<double>(std::chrono::steady_clock::now() - headlessStart).count();
+        return glfwGetTime();
+    }
+
     WindowDimensions Window::getWindowDimensions() {
         return this->dimensions;
     }
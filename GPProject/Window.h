@@ -4,6 +4,7 @@
 #include <GL/glew.h>
 #include <GLFW/glfw3.h>
 #include <stdexcept>
+#include <chrono>
 #include <iostream>
 
 struct WindowDimensions {
@@ -16,16 +17,43 @@ namespace gps {
     class Window {
 
     public:
-        void Create(int width=800, int height=600, const char *title="OpenGL Project");
+        //samples: multisampling of the default framebuffer, 0 to turn it off
+        void Create(int width=800, int height=600, const char *title="OpenGL Project", int samples=4);
+        //no window at all: a core context from EGL's surfaceless platform (e.g. Mesa llvmpipe on a
+        //machine without display or gpu) drawing into an offscreen framebuffer of the given size;
+        //only available in builds that define GPS_HEADLESS_EGL and link libEGL, as the CMake build does
+        void CreateHeadless(int width, int height);
         void Delete();
 
+        //NULL when headless
         GLFWwindow* getWindow();
+        bool isHeadless();
+        //what the frame ends up in: 0, or the offscreen framebuffer when headless
+        GLuint getFramebuffer();
         WindowDimensions getWindowDimensions();
         void setWindowDimensions(WindowDimensions dimensions);
 
+        //the few per-frame calls main makes, so the loop runs unchanged in both modes
+        bool shouldClose();
+        void setShouldClose(bool close);
+        void pollEvents();
+        void swapBuffers();
+        //seconds since the window was created
+        double getTime();
+
     private:
         WindowDimensions dimensions;
-        GLFWwindow *window;
+        GLFWwindow *window = NULL;
+
+        bool headless = false;
+        bool closeRequested = false;
+        //EGLDisplay and EGLContext, kept opaque so this header needs no EGL
+        void* eglDisplay = NULL;
+        void* eglContext = NULL;
+        GLuint framebuffer = 0;
+        GLuint colorRenderbuffer = 0;
+        GLuint depthRenderbuffer = 0;
+        std::chrono::steady_clock::time_point headlessStart;
     };
 }
 
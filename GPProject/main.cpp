@@ -9,15 +9,54 @@
 
 #include "Window.h"
 #include "Shader.hpp"
+#include "ShaderPermutations.hpp"
 #include "Camera.hpp"
 #include "Model3D.hpp"
-
+#include "FrameGraph.hpp"
+#include "ShadowAtlas.hpp"
+#include "GpuTimer.hpp"
+#include "GpuProfiler.hpp"
+#include "CpuProfiler.hpp"
+#include "FramePacer.hpp"
+#include "CameraPath.hpp"
+#include "BenchmarkReport.hpp"
+#include "DrawStats.hpp"
+#include "InputRecorder.hpp"
+#include "GoldenImage.hpp"
+#include "DepthPrepass.hpp"
+#include "SoftwareOcclusion.hpp"
+#include "GpuOcclusion.hpp"
+#include "GpuDrivenRenderer.hpp"
+#include "ClusteredLighting.hpp"
+#include "Scene.hpp"
+#include "JobSystem.hpp"
+#include "SimulationThread.hpp"
+
+#include <chrono>
+#include <cstdio>
 #include <iostream>
+#include <random>
+#include <sstream>
+#include <thread>
 
 #include "SkyBox.hpp"
 
 // window
 gps::Window myWindow;
+int windowWidth = 1024;
+int windowHeight = 728;
+int msaaSamples = 4;
+// no window, an offscreen framebuffer instead (CI and benchmark hosts without a display)
+bool headless = false;
+// the loop stops after this many frames or seconds, 0 for no limit
+int frameLimit = 0;
+float durationLimit = 0.0f;
+// vsync, frame cap and the frame time histogram
+gps::FramePacer framePacer;
+gps::VsyncMode vsyncMode = gps::VSYNC_ON;
+// P stops the orbits; with the camera still too the loop drops to the idle frame cap
+bool simulationPaused = false;
+bool cameraMoved = false;
 
 // matrices
 glm::mat4 model;
@@ -28,14 +67,6 @@ glm::mat3 normalMatrix;
 // light parameters
 glm::vec3 lightColor;
 
-// shader uniform locations
-GLint modelLoc;
-GLint viewLoc;
-GLint projectionLoc;
-GLint normalMatrixLoc;
-GLint lightDirLoc;
-GLint lightColorLoc;
-
 // camera
 gps::Camera myCamera(
     glm::vec3(0.0f, 0.0f, 3.0f),
@@ -46,97 +77,105 @@ GLfloat cameraSpeed = 1.0f;
 
 GLboolean pressedKeys[1024];
 
-// models
-//gps::Model3D solarSystem;
-gps::Model3D sun;
-gps::Model3D mercury;
-gps::Model3D venus;
-gps::Model3D earth;
-gps::Model3D mars;
-gps::Model3D jupiter;
-gps::Model3D saturn;
-gps::Model3D uranus;
-gps::Model3D neptune;
-gps::Model3D spaceship1;
-gps::Model3D spaceship2;
-
-glm::mat4 sunModel = glm::mat4(1.0f);
-glm::mat4 mercuryModel = glm::mat4(1.0f);
-glm::mat4 venusModel = glm::mat4(1.0f);
-glm::mat4 earthModel = glm::mat4(1.0f);
-glm::mat4 marsModel = glm::mat4(1.0f);
-glm::mat4 jupiterModel = glm::mat4(1.0f);
-glm::mat4 saturnModel = glm::mat4(1.0f);
-glm::mat4 uranusModel = glm::mat4(1.0f);
-glm::mat4 neptuneModel = glm::mat4(1.0f);
-glm::mat4 spaceship1Model = glm::mat4(1.0f);
-glm::mat4 spaceship2Model = glm::mat4(1.0f);
-
-const float sunRotationSpeed = 1.0f;
-const float mercuryRotationSpeed = 256.0f;
-const float venusRotationSpeed = 128.0f;
-const float earthRotationSpeed = 64.0f;
-const float marsRotationSpeed = 32.0f;
-const float jupiterRotationSpeed = 16.0f;
-const float saturnRotationSpeed = 8.0f;
-const float uranusRotationSpeed = 4.0f;
-const float neptuneRotationSpeed = 2.0f;
-const float spaceship1Speed = 1.0f;
-const float spaceship2Speed = 1.0f;
+// worker threads for loading, the transform update, light binning and occlusion culling; -1 starts
+// one per hardware thread besides the main one. Before every system that queues jobs, so it outlives them
+gps::JobSystem jobSystem;
+int jobWorkers = -1;
+// CPU only: the job system's workloads on 1 thread up to every hardware thread
+bool jobBenchmark = false;
+
+// every body of the scene file, in drawing order of the opaque pass
+gps::Scene scene;
+std::string sceneFile = "scenes/solarSystem.scene";
+// CPU only: times loading and updating generated scenes of 1k to 100k bodies, and the dirty
+// subtree updates of wide, deep and balanced hierarchies
+bool sceneBenchmark = false;
+// ticks per second of the simulation thread in the interactive loop; 0 steps the scene in the frame,
+// like the benchmarks, golden images and input recordings always do so their frames are reproducible
+float simulationRate = 60.0f;
+gps::SimulationThread simulationThread;
 
 GLfloat angle;
-GLfloat sunAngle = 0.0f;
-GLfloat mercuryOrbitAngle = 0.0f;
-GLfloat venusOrbitAngle = 0.0f;
-GLfloat earthOrbitAngle = 0.0f;
-GLfloat marsOrbitAngle = 0.0f;
-GLfloat jupiterOrbitAngle = 0.0f;
-GLfloat saturnOrbitAngle = 0.0f;
-GLfloat uranusOrbitAngle = 0.0f;
-GLfloat neptuneOrbitAngle = 0.0f;
-GLfloat spaceship1Distance = 0.0f;
-GLfloat spaceship2Distance = 0.0f;
 
 // shaders
-gps::Shader myBasicShader;
+// basic.vert/basic.frag, one program per feature combination
+gps::ShaderPermutations basicShaders;
+// depth-only pass ahead of the lit draws, chosen per frame from the measured overdraw
+gps::DepthPrepass depthPrepass;
+gps::Shader depthPrepassShader;
+bool drawingDepthPrepass = false;
+bool prepassBenchmark = false;
+
+gps::SoftwareOcclusion softwareOcclusion;
+gps::GpuOcclusion gpuOcclusion;
+gps::OcclusionMode occlusionMode = gps::OCCLUSION_CPU;
+// GL 4.3 path: compute culled multi draw indirect instead of one draw per mesh
+gps::GpuDrivenRenderer gpuDrivenRenderer;
+gps::Shader depthPrepassInstancedShader;
+bool gpuDriven = false;
+// program whose per-frame uniforms are already set in the current pass
+GLuint boundBasicProgram = 0;
+// unlit stand-in for basic permutations that are still compiling
+gps::Shader fallbackShader;
 gps::SkyBox mySkyBox;
 gps::Shader skyBoxShader;
 gps::Shader depthMapShader;
+gps::Shader depthMomentsShader;
+gps::Shader shadowBlurShader;
 
 glm::vec3 sunPosition;
 
-// depth map FBO and texture
-GLuint shadowMapFBO;
-GLuint depthMapTexture;
-const GLuint SHADOW_WIDTH = 1024;
-const GLuint SHADOW_HEIGHT = 1024;
-
-void initShadowMapping() { // initFBO
-    // Generate and bind the framebuffer
-    glGenFramebuffers(1, &shadowMapFBO);
-
-    // Create the depth texture
-    glGenTextures(1, &depthMapTexture);
-    glBindTexture(GL_TEXTURE_2D, depthMapTexture);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT,
-        SHADOW_WIDTH, SHADOW_HEIGHT, 0, GL_DEPTH_COMPONENT,
-        GL_FLOAT, NULL);
-
-    // Set texture parameters
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_BORDER);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_BORDER);
-    GLfloat borderColor[] = { 1.0, 1.0, 1.0, 1.0 };
-    glTexParameterfv(GL_TEXTURE_2D, GL_TEXTURE_BORDER_COLOR, borderColor);
-
-    // Attach the texture as the depth buffer of the FBO
-    glBindFramebuffer(GL_FRAMEBUFFER, shadowMapFBO);
-    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, depthMapTexture, 0);
-    glDrawBuffer(GL_NONE);
-    glReadBuffer(GL_NONE);
-    glBindFramebuffer(GL_FRAMEBUFFER, 0);
-}
+// frame graph
+gps::FrameGraph frameGraph;
+GLfloat frameDeltaTime = 0.0f;
+
+// shadow atlas, one tile per caster
+const GLuint SHADOW_ATLAS_SIZE = 2048;
+gps::ShadowAtlas shadowAtlas;
+gps::GpuTimer shadowPassTimer;
+gps::GpuTimer opaquePassTimer;
+gps::GpuTimer prepassTimer;
+// per pass (and optionally per object) gpu times, off unless asked for on the command line
+gps::GpuProfiler gpuProfiler;
+std::string gpuProfileFile = "gpu_profile.csv";
+// cpu zones (see CpuProfiler.hpp), only recorded once asked for
+std::string cpuTraceFile = "cpu_trace.json";
+int shadowUpdateInterval = 1;
+gps::ShadowFilter shadowFilter = gps::SHADOW_FILTER_PCF;
+bool shadowBenchmark = false;
+
+// clustered point lights, the sun stays the only shadowed light
+const float CAMERA_NEAR = 0.1f;
+const float CAMERA_FAR = 1000.0f;
+gps::ClusteredLighting clusteredLighting;
+// the first lights follow the bodies with a headlight, one each
+std::vector<size_t> headlightBodies;
+bool shipHeadlights = true;
+bool lightBenchmark = false;
+
+// input sessions saved for replay; a replay feeds the recorded deltas and events instead of live ones
+gps::InputRecorder inputRecorder;
+std::string inputRecordFile;
+std::string inputReplayFile;
+
+// deterministic run along a scripted camera path, see runBenchmark
+std::string benchmarkFile;
+std::string benchmarkBaselineFile;
+double benchmarkThreshold = 0.05;
+int benchmarkWarmupFrames = 120;
+
+// fixed frames compared against stored images, see runGoldenTests; a missing golden fails, only
+// updateGoldenImages writes them. No goldens ship with the project, they depend on the driver that
+// renders them: bootstrap a directory once with --golden <dir> --update-golden on the reference host
+// (e.g. --headless on llvmpipe in CI), check the images in, then run --golden <dir> against them
+std::string goldenDirectory;
+bool updateGoldenImages = false;
+// CIE76 delta E a pixel may differ by, and the share of pixels allowed past it
+double goldenTolerance = 3.0;
+double goldenMaxDiffering = 0.001;
+
+// linked programs are cached as driver binaries here, empty to always compile from source
+std::string shaderCacheDirectory = "shadercache";
 
 GLenum glCheckError_(const char* file, int line)
 {
@@ -172,14 +211,113 @@ GLenum glCheckError_(const char* file, int line)
 }
 #define glCheckError() glCheckError_(__FILE__, __LINE__)
 
+void setShadowFilter(gps::ShadowFilter filter);
+
 void windowResizeCallback(GLFWwindow* window, int width, int height) {
     fprintf(stdout, "Window resized! New width: %d , and height: %d\n", width, height);
     //TODO
 }
 
 void keyboardCallback(GLFWwindow* window, int key, int scancode, int action, int mode) {
+    GPS_PROFILE_FUNCTION();
+    inputRecorder.recordKey(key, scancode, action, mode);
     if (key == GLFW_KEY_ESCAPE && action == GLFW_PRESS) {
-        glfwSetWindowShouldClose(window, GL_TRUE);
+        myWindow.setShouldClose(true);
+    }
+
+    if (key == GLFW_KEY_F1 && action == GLFW_PRESS) {
+        frameGraph.printTimings(std::cout);
+        std::cout << "Shadow pass gpu: " << shadowPassTimer.getAverageMs() << " ms ("
+            << (shadowAtlas.isCachingEnabled() ? "cached" : "uncached") << ", "
+            << shadowPassTimer.getSampleCount() << " frames)" << std::endl;
+        std::cout << "Opaque pass gpu: " << opaquePassTimer.getAverageMs() << " ms ("
+            << gps::getShadowFilterName(shadowFilter) << " shadows)" << std::endl;
+        shadowAtlas.printStats(std::cout);
+        depthPrepass.printStats(std::cout);
+        framePacer.printStats(std::cout);
+        if (gpuDriven)
+            gpuDrivenRenderer.printStats(std::cout);
+        if (gpuProfiler.isEnabled())
+            gpuProfiler.printStats(std::cout);
+        std::cout << "Occlusion: " << gps::getOcclusionModeName(occlusionMode) << std::endl;
+        if (occlusionMode == gps::OCCLUSION_CPU)
+            softwareOcclusion.printStats(std::cout);
+        else if (occlusionMode == gps::OCCLUSION_GPU)
+            gpuOcclusion.printStats(std::cout);
+        std::cout << "Depth pre-pass gpu: " << prepassTimer.getAverageMs() << " ms" << std::endl;
+        prepassTimer.reset();
+        std::cout << "Point lights: " << clusteredLighting.getLights().size() << " lights, "
+            << clusteredLighting.getAssignedIndexCount() << " cluster entries, "
+            << clusteredLighting.getLastUpdateMs() << " ms to assign" << std::endl;
+        std::cout << "Basic shader permutations compiled: " << basicShaders.getCompiledCount() << std::endl;
+        gps::Shader::printProgramCacheStats(std::cout);
+        shadowPassTimer.reset();
+        opaquePassTimer.reset();
+    }
+
+    if (key == GLFW_KEY_F2 && action == GLFW_PRESS) {
+        shadowAtlas.setCachingEnabled(!shadowAtlas.isCachingEnabled());
+        shadowPassTimer.reset();
+    }
+
+    if (key == GLFW_KEY_F4 && action == GLFW_PRESS) {
+        depthPrepass.setMode((gps::DepthPrepassMode)((depthPrepass.getMode() + 1) % gps::DEPTH_PREPASS_MODE_COUNT));
+        std::cout << "Depth pre-pass: " << gps::getDepthPrepassModeName(depthPrepass.getMode()) << std::endl;
+    }
+
+    if (key == GLFW_KEY_F5 && action == GLFW_PRESS) {
+        occlusionMode = (gps::OcclusionMode)((occlusionMode + 1) % gps::OCCLUSION_MODE_COUNT);
+        // results from before the queries were last turned off are stale
+        gpuOcclusion.reset();
+        std::cout << "Occlusion: " << gps::getOcclusionModeName(occlusionMode) << std::endl;
+    }
+
+    if (key == GLFW_KEY_F6 && action == GLFW_PRESS && gpuDrivenRenderer.isInitialized()) {
+        gpuDriven = !gpuDriven;
+        // the per-object path has not issued queries while the indirect one ran
+        gpuOcclusion.reset();
+        std::cout << "GPU-driven rendering: " << (gpuDriven ? "on" : "off") << std::endl;
+    }
+
+    // starts the profiler the first time, writes what it has so far after that
+    if (key == GLFW_KEY_F7 && action == GLFW_PRESS) {
+        if (!gpuProfiler.isEnabled()) {
+            gpuProfiler.setEnabled(true);
+            std::cout << "GPU profiler on, F7 again writes " << gpuProfileFile << std::endl;
+        }
+        else if (gpuProfiler.writeCsv(gpuProfileFile)) {
+            std::cout << "GPU profile written to " << gpuProfileFile << std::endl;
+        }
+    }
+
+    if (key == GLFW_KEY_F9 && action == GLFW_PRESS) {
+        vsyncMode = (gps::VsyncMode)((vsyncMode + 1) % gps::VSYNC_MODE_COUNT);
+        framePacer.setVsyncMode(vsyncMode);
+        std::cout << "Vsync: " << gps::getVsyncModeName(vsyncMode) << std::endl;
+    }
+
+    if (key == GLFW_KEY_P && action == GLFW_PRESS) {
+        simulationPaused = !simulationPaused;
+        std::cout << "Simulation " << (simulationPaused ? "paused" : "resumed") << std::endl;
+    }
+
+    // same for the cpu zones
+    if (key == GLFW_KEY_F8 && action == GLFW_PRESS) {
+        if (!GPS_PROFILER_COMPILED) {
+            std::cout << "CPU profiler is compiled out of this build (define GPS_ENABLE_PROFILER)" << std::endl;
+        }
+        else if (!gps::CpuProfiler::isEnabled()) {
+            gps::CpuProfiler::setEnabled(true);
+            std::cout << "CPU profiler on, F8 again writes " << cpuTraceFile << std::endl;
+        }
+        else if (gps::CpuProfiler::writeChromeTrace(cpuTraceFile)) {
+            std::cout << "CPU trace written to " << cpuTraceFile << std::endl;
+        }
+    }
+
+    if (key == GLFW_KEY_F3 && action == GLFW_PRESS) {
+        setShadowFilter((gps::ShadowFilter)((shadowFilter + 1) % gps::SHADOW_FILTER_COUNT));
+        std::cout << "Shadow filter: " << gps::getShadowFilterName(shadowFilter) << std::endl;
     }
 
     if (key >= 0 && key < 1024) {
@@ -195,6 +333,8 @@ void keyboardCallback(GLFWwindow* window, int key, int scancode, int action, int
 bool firstMouse = true;
 float lastX = 300, lastY = 150;
 void mouseCallback(GLFWwindow* window, double xpos, double ypos) {
+    GPS_PROFILE_FUNCTION();
+    inputRecorder.recordCursor(xpos, ypos);
     if (firstMouse) {
         lastX = xpos;
         lastY = ypos;
@@ -212,17 +352,19 @@ void mouseCallback(GLFWwindow* window, double xpos, double ypos) {
 
     myCamera.rotate(yoffset, xoffset);
     view = myCamera.getViewMatrix();
-    myBasicShader.useShaderProgram();
-    glUniformMatrix4fv(viewLoc, 1, GL_FALSE, glm::value_ptr(view));
+    cameraMoved = true;
 }
 
 void processMovement() {
+    GPS_PROFILE_FUNCTION();
+    if (pressedKeys[GLFW_KEY_W] || pressedKeys[GLFW_KEY_S] || pressedKeys[GLFW_KEY_A] || pressedKeys[GLFW_KEY_D] ||
+        pressedKeys[GLFW_KEY_Q] || pressedKeys[GLFW_KEY_E])
+        cameraMoved = true;
+
     if (pressedKeys[GLFW_KEY_W]) {
         myCamera.move(gps::MOVE_FORWARD, cameraSpeed);
         //update view matrix
         view = myCamera.getViewMatrix();
-        myBasicShader.useShaderProgram();
-        glUniformMatrix4fv(viewLoc, 1, GL_FALSE, glm::value_ptr(view));
         // compute normal matrix for teapot
         normalMatrix = glm::mat3(glm::inverseTranspose(view * model));
     }
@@ -231,8 +373,6 @@ void processMovement() {
         myCamera.move(gps::MOVE_BACKWARD, cameraSpeed);
         //update view matrix
         view = myCamera.getViewMatrix();
-        myBasicShader.useShaderProgram();
-        glUniformMatrix4fv(viewLoc, 1, GL_FALSE, glm::value_ptr(view));
         // compute normal matrix for teapot
         normalMatrix = glm::mat3(glm::inverseTranspose(view * model));
     }
@@ -241,8 +381,6 @@ void processMovement() {
         myCamera.move(gps::MOVE_LEFT, cameraSpeed);
         //update view matrix
         view = myCamera.getViewMatrix();
-        myBasicShader.useShaderProgram();
-        glUniformMatrix4fv(viewLoc, 1, GL_FALSE, glm::value_ptr(view));
         // compute normal matrix for teapot
         normalMatrix = glm::mat3(glm::inverseTranspose(view * model));
     }
@@ -251,8 +389,6 @@ void processMovement() {
         myCamera.move(gps::MOVE_RIGHT, cameraSpeed);
         //update view matrix
         view = myCamera.getViewMatrix();
-        myBasicShader.useShaderProgram();
-        glUniformMatrix4fv(viewLoc, 1, GL_FALSE, glm::value_ptr(view));
         // compute normal matrix for teapot
         normalMatrix = glm::mat3(glm::inverseTranspose(view * model));
     }
@@ -275,11 +411,23 @@ void processMovement() {
 }
 
 void initOpenGLWindow() {
-    myWindow.Create(1024, 728, "OpenGL Project Core");
+    GPS_PROFILE_FUNCTION();
+    if (headless) {
+        myWindow.CreateHeadless(windowWidth, windowHeight);
+        // nothing is presented, so there is nothing to sync to
+        vsyncMode = gps::VSYNC_OFF;
+        framePacer.setVsyncMode(vsyncMode);
+        return;
+    }
+    myWindow.Create(windowWidth, windowHeight, "OpenGL Project Core", msaaSamples);
+    framePacer.setVsyncMode(vsyncMode);
     glfwSetInputMode(myWindow.getWindow(), GLFW_CURSOR, GLFW_CURSOR_DISABLED);
 }
 
 void setWindowCallbacks() {
+    // a replay is driven by the recording alone
+    if (myWindow.isHeadless() || !inputReplayFile.empty())
+        return;
     glfwSetWindowSizeCallback(myWindow.getWindow(), windowResizeCallback);
     glfwSetKeyCallback(myWindow.getWindow(), keyboardCallback);
     glfwSetCursorPosCallback(myWindow.getWindow(), mouseCallback);
@@ -297,65 +445,173 @@ void initOpenGLState() {
 }
 
 void initModels() {
-    sun.LoadModel("models/planets/star.obj");
-    mercury.LoadModel("models/planets/mercury.obj");
-    venus.LoadModel("models/planets/venus.obj");
-    earth.LoadModel("models/planets/earth.obj");
-    mars.LoadModel("models/planets/mars.obj");
-    jupiter.LoadModel("models/planets/jupiter.obj");
-    saturn.LoadModel("models/planets/bakedSaturn.obj");
-    uranus.LoadModel("models/planets/uranus.obj");
-    neptune.LoadModel("models/planets/neptune.obj");
-    spaceship1.LoadModel("models/spaceship1/spaceship1.obj");
-    spaceship2.LoadModel("models/spaceship2/spaceship2.obj");
+    GPS_PROFILE_FUNCTION();
+    scene.loadModels();
+}
+
+// the shadow filter tier is specialized at compile time, in every permutation
+std::string basicShaderDefines() {
+    return "#define SHADOW_FILTER " + std::to_string((int)shadowFilter) + "\n";
+}
+
+// the permutations the scene draws with, submitted ahead of the first frame that needs them
+void prepareBasicShaders(bool wait) {
+    basicShaders.get(gps::SHADER_FEATURE_EMISSIVE);
+    basicShaders.get(gps::SHADER_FEATURE_SHADOWS);
+    if (gpuDriven) {
+        basicShaders.get(gps::SHADER_FEATURE_EMISSIVE | gps::SHADER_FEATURE_INSTANCED);
+        basicShaders.get(gps::SHADER_FEATURE_SHADOWS | gps::SHADER_FEATURE_INSTANCED);
+    }
+    if (wait)
+        basicShaders.finishAll();
+}
+
+// the programs initShaders submits, all linked
+bool startupShadersReady() {
+    if (!basicShaders.get(gps::SHADER_FEATURE_EMISSIVE).isReady() || !basicShaders.get(gps::SHADER_FEATURE_SHADOWS).isReady())
+        return false;
+    if (gpuDriven && (!basicShaders.get(gps::SHADER_FEATURE_EMISSIVE | gps::SHADER_FEATURE_INSTANCED).isReady()
+        || !basicShaders.get(gps::SHADER_FEATURE_SHADOWS | gps::SHADER_FEATURE_INSTANCED).isReady()
+        || !depthPrepassInstancedShader.isReady()))
+        return false;
+    return skyBoxShader.isReady() && depthMapShader.isReady() && depthMomentsShader.isReady()
+        && depthPrepassShader.isReady() && shadowBlurShader.isReady();
+}
+
+// once per run, when the startup programs are in and the cache hits and misses are all counted
+void printStartupProgramCacheStats() {
+    static bool printed = false;
+    if (printed)
+        return;
+    printed = true;
+    gps::Shader::printProgramCacheStats(std::cout);
+}
+
+// blocks on whatever is still compiling; for runs that measure frame times
+void finishShaders() {
+    prepareBasicShaders(true);
+    skyBoxShader.finish();
+    depthMapShader.finish();
+    depthMomentsShader.finish();
+    depthPrepassShader.finish();
+    if (gpuDriven)
+        depthPrepassInstancedShader.finish();
+    shadowBlurShader.finish();
+    printStartupProgramCacheStats();
 }
 
+// every program is only submitted here; the driver compiles them while the models load,
+// and passes skip or fall back on whatever is not linked yet when the first frames are drawn
 void initShaders() {
-    myBasicShader.loadShader(
-        "shaders/basic.vert",
-        "shaders/basic.frag");
-    skyBoxShader.loadShader("shaders/skyboxShader.vert", "shaders/skyboxShader.frag");
-    skyBoxShader.useShaderProgram();
-    depthMapShader.loadShader("shaders/depthMapShader.vert", "shaders/depthMapShader.frag");
-    depthMapShader.useShaderProgram();
+    GPS_PROFILE_FUNCTION();
+    double start = myWindow.getTime();
+    bool parallel = gps::Shader::enableParallelCompile();
+    gps::Shader::setProgramCacheDirectory(shaderCacheDirectory);
+
+    // the only program that is waited for, everything else can fall back to it
+    fallbackShader.loadShader("shaders/fallback.vert", "shaders/fallback.frag");
+
+    basicShaders.init("shaders/basic.vert", "shaders/basic.frag", basicShaderDefines());
+    skyBoxShader.submitShader("shaders/skyboxShader.vert", "shaders/skyboxShader.frag");
+    depthMapShader.submitShader("shaders/depthMapShader.vert", "shaders/depthMapShader.frag");
+    depthMomentsShader.submitShader("shaders/depthMapShader.vert", "shaders/depthMapShader.frag", "#define SHADOW_MOMENTS\n");
+    depthPrepassShader.submitShader("shaders/depthMapShader.vert", "shaders/depthMapShader.frag", "#define DEPTH_PREPASS\n");
+    if (gps::GpuDrivenRenderer::isSupported())
+        depthPrepassInstancedShader.submitShader("shaders/depthMapShader.vert", "shaders/depthMapShader.frag",
+            "#define DEPTH_PREPASS\n#define INSTANCED\n");
+    shadowBlurShader.submitShader("shaders/shadowBlur.vert", "shaders/shadowBlur.frag");
+    prepareBasicShaders(false);
+
+    std::cout << "Shaders submitted in " << (myWindow.getTime() - start) * 1000.0 << " ms ("
+        << (parallel ? "parallel" : "serial") << " compile)" << std::endl;
 }
 
-void initUniforms() {
-    myBasicShader.useShaderProgram();
+// picks up edited shader sources; programs swap in once they link, the frame never waits on them
+void reloadChangedShaders() {
+    GPS_PROFILE_FUNCTION();
+    basicShaders.reloadIfChanged();
+    fallbackShader.reloadIfChanged();
+    skyBoxShader.reloadIfChanged();
+    shadowBlurShader.reloadIfChanged();
+    depthMapShader.reloadIfChanged();
+    depthMomentsShader.reloadIfChanged();
+    depthPrepassShader.reloadIfChanged();
+    depthPrepassInstancedShader.reloadIfChanged();
+}
 
+void initUniforms() {
+    GPS_PROFILE_FUNCTION();
     // create model matrix for teapot
     model = glm::rotate(glm::mat4(1.0f), glm::radians(angle), glm::vec3(0.0f, 1.0f, 0.0f));
-    modelLoc = glGetUniformLocation(myBasicShader.shaderProgram, "model");
 
     // get view matrix for current camera
     view = myCamera.getViewMatrix();
-    viewLoc = glGetUniformLocation(myBasicShader.shaderProgram, "view");
-    // send view matrix to shader
-    glUniformMatrix4fv(viewLoc, 1, GL_FALSE, glm::value_ptr(view));
 
     // compute normal matrix for teapot
     normalMatrix = glm::mat3(glm::inverseTranspose(view * model));
-    normalMatrixLoc = glGetUniformLocation(myBasicShader.shaderProgram, "normalMatrix");
 
     // create projection matrix
     projection = glm::perspective(glm::radians(45.0f),
         (float)myWindow.getWindowDimensions().width / (float)myWindow.getWindowDimensions().height,
-        0.1f, 1000.0f);
-    projectionLoc = glGetUniformLocation(myBasicShader.shaderProgram, "projection");
-    // send projection matrix to shader
-    glUniformMatrix4fv(projectionLoc, 1, GL_FALSE, glm::value_ptr(projection));
-
-    GLint sunPosLoc = glGetUniformLocation(myBasicShader.shaderProgram, "sunPosition");
-    glUniform3fv(sunPosLoc, 1, glm::value_ptr(sunPosition));
+        CAMERA_NEAR, CAMERA_FAR);
 
     //set light color
     lightColor = glm::vec3(20.0f, 20.0f, 20.0f); //white light
-    lightColorLoc = glGetUniformLocation(myBasicShader.shaderProgram, "lightColor");
-    // send light color to shader
-    glUniform3fv(lightColorLoc, 1, glm::value_ptr(lightColor));
+}
+
+// uniforms shared by every object of the frame, sent to a permutation the first time it is bound in a pass
+void applyFrameUniforms(gps::Shader& shader) {
+    glUniformMatrix4fv(shader.getUniformLocation("view"), 1, GL_FALSE, glm::value_ptr(view));
+    glUniformMatrix4fv(shader.getUniformLocation("projection"), 1, GL_FALSE, glm::value_ptr(projection));
+    glUniform3fv(shader.getUniformLocation("sunPosition"), 1, glm::value_ptr(sunPosition));
+    glUniform3fv(shader.getUniformLocation("sunPositionEye"), 1, glm::value_ptr(glm::vec3(view * glm::vec4(sunPosition, 1.0f))));
+    glUniform3fv(shader.getUniformLocation("lightColor"), 1, glm::value_ptr(lightColor));
+
+    glUniform1i(shader.getUniformLocation("shadowMap"), 3);
+    shadowAtlas.applyUniforms(shader);
+    clusteredLighting.applyUniforms(shader, 4,
+        myWindow.getWindowDimensions().width, myWindow.getWindowDimensions().height);
+}
+
+gps::Shader& useBasicShader(unsigned features) {
+    gps::Shader* shader = &basicShaders.get(features);
+    // drawing with a program that is still compiling would stall the frame
+    if (!shader->isReady())
+        shader = &fallbackShader;
+    shader->useShaderProgram();
+    if (shader->shaderProgram != boundBasicProgram) {
+        applyFrameUniforms(*shader);
+        boundBasicProgram = shader->shaderProgram;
+    }
+    return *shader;
+}
+
+// the program an opaque object is drawn with in the current pass
+gps::Shader& sceneShader(unsigned features) {
+    if (drawingDepthPrepass) {
+        depthPrepassShader.useShaderProgram();
+        return depthPrepassShader;
+    }
+    return useBasicShader(features);
+}
+
+// cheapest permutation for a lit object: shadowed, and the specular map only when the model has one
+unsigned litFeatures(gps::Model3D& object) {
+    unsigned features = gps::SHADER_FEATURE_SHADOWS;
+    if (object.hasTexture("specularTexture"))
+        features |= gps::SHADER_FEATURE_SPECULAR_MAP;
+    return features;
+}
+
+// per-object constants: the model matrix and its eye space normal matrix
+void setModelUniforms(gps::Shader& shader, const glm::mat4& modelMatrix) {
+    glUniformMatrix4fv(shader.getUniformLocation("model"), 1, GL_FALSE, glm::value_ptr(modelMatrix));
+    glm::mat3 objectNormalMatrix = glm::mat3(glm::inverseTranspose(view * modelMatrix));
+    glUniformMatrix3fv(shader.getUniformLocation("normalMatrix"), 1, GL_FALSE, glm::value_ptr(objectNormalMatrix));
 }
 
 void initSkyBox() {
+    GPS_PROFILE_FUNCTION();
     std::vector<const GLchar*> faces;
     faces.push_back("skybox/starfield_rt.tga");
     faces.push_back("skybox/starfield_lf.tga");
@@ -367,298 +623,983 @@ void initSkyBox() {
     mySkyBox.Load(faces);
 }
 
-glm::mat4 computeLightSpaceTrMatrix() {
-    // Adjust these parameters based on your scene's size and the light's position
-    const GLfloat near_plane = 1.0f, far_plane = 7.5f;
-    glm::mat4 lightProjection = glm::ortho(-10.0f, 10.0f, -10.0f, 10.0f, near_plane, far_plane);
-    glm::mat4 lightView = glm::lookAt(sunPosition, glm::vec3(0.0f), glm::vec3(0.0f, 1.0f, 0.0f));
-    glm::mat4 lightSpaceTrMatrix = lightProjection * lightView;
-    return lightSpaceTrMatrix;
+// skips the draw of a body the occlusion pass found hidden; its animation still advances.
+// The results are per body, bodies sharing a model are culled each on its own
+void drawSceneObject(size_t body, gps::Shader& shader) {
+    if (occlusionMode == gps::OCCLUSION_CPU && !softwareOcclusion.isVisible(body))
+        return;
+    if (occlusionMode == gps::OCCLUSION_GPU && !gpuOcclusion.beginDraw(body))
+        return;
+    scene.getModel(body)->Draw(shader);
+    if (occlusionMode == gps::OCCLUSION_GPU)
+        gpuOcclusion.endDraw();
 }
 
-void renderSun(gps::Shader shader, float deltaTime) {
-    shader.useShaderProgram();
-    // update rotation angle
-    sunAngle += sunRotationSpeed * deltaTime;
-    sunModel = glm::rotate(glm::mat4(1.0f), glm::radians(sunAngle), glm::vec3(0.0f, 1.0f, 0.0f));
-    glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(sunModel));
-    sun.Draw(shader);
+void renderToShadowMap() {
+    GPS_PROFILE_FUNCTION();
+    // Use the shader for rendering the depth map (moments for VSM)
+    gps::Shader& casterShader = shadowAtlas.getFilter() == gps::SHADOW_FILTER_VSM ? depthMomentsShader : depthMapShader;
+    // the atlas keeps its old tiles until the programs are linked
+    if (!casterShader.isReady() || (shadowAtlas.getFilter() == gps::SHADOW_FILTER_VSM && !shadowBlurShader.isReady()))
+        return;
+    // cached tiles were drawn by another program (filter switch or reload)
+    static GLuint lastCasterProgram = 0;
+    if (casterShader.shaderProgram != lastCasterProgram) {
+        shadowAtlas.invalidate();
+        lastCasterProgram = casterShader.shaderProgram;
+    }
+    casterShader.useShaderProgram();
+
+    // Each caster gets a frustum from the sun fitted to its bounding sphere;
+    // only the tiles whose caster moved since they were last drawn get re-rendered
+    shadowPassTimer.begin();
+    shadowAtlas.update(casterShader,
+        casterShader.getUniformLocation("model"),
+        casterShader.getUniformLocation("lightSpaceMatrix"),
+        sunPosition, view, projection, myWindow.getWindowDimensions().height);
+    shadowPassTimer.end();
 }
 
-void renderMercury(gps::Shader shader, float deltaTime) {
-    shader.useShaderProgram();
-    mercuryOrbitAngle += mercuryRotationSpeed * deltaTime;
-    // Resetting the model matrix
-    mercuryModel = glm::mat4(1.0f);
-    // Rotate around the origin (orbit rotation)
-    mercuryModel = glm::rotate(mercuryModel, glm::radians(mercuryOrbitAngle), glm::vec3(0.0f, 1.0f, 0.0f));
-    // Translate to the orbit radius
-    mercuryModel = glm::translate(mercuryModel, glm::vec3(50.0f, 0.0f, 0.0f));
-    mercuryModel = glm::rotate(mercuryModel, glm::radians(mercuryOrbitAngle), glm::vec3(0.0f, 1.0f, 0.0f));
-    glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(mercuryModel));
-    mercury.Draw(shader);
+// advances every orbit and ship by deltaTime, or with the simulation thread running draws its newest
+// ticks; the passes of the frame only read the matrices
+void updateSceneObjects(float deltaTime) {
+    if (simulationThread.isRunning()) {
+        simulationThread.setPaused(simulationPaused);
+        simulationThread.interpolate();
+    }
+    else {
+        scene.update(deltaTime);
+    }
 }
 
-void renderVenus(gps::Shader shader, float deltaTime) {
-    shader.useShaderProgram();
-    venusOrbitAngle += venusRotationSpeed * deltaTime;
-
-    // Resetting the model matrix
-    venusModel = glm::mat4(1.0f);
-
-    // Rotate around the origin (orbital rotation)
-    venusModel = glm::rotate(venusModel, glm::radians(venusOrbitAngle), glm::vec3(0.0f, 1.0f, 0.0f));
-
-    // Translate to the orbit radius
-    venusModel = glm::translate(venusModel, glm::vec3(60.0f, 0.0f, 0.0f));
-
-    // Rotate around its own axis (if needed)
-    venusModel = glm::rotate(venusModel, glm::radians(venusOrbitAngle), glm::vec3(0.0f, 1.0f, 0.0f));
-
-    // Scale Venus to make it 2 times bigger than Mercury
-    venusModel = glm::scale(venusModel, glm::vec3(2.0f, 2.0f, 2.0f));
-
-    glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(venusModel));
-    venus.Draw(shader);
+// permutation a body is lit with
+unsigned sceneObjectFeatures(size_t body) {
+    return (scene.getFlags(body) & gps::BODY_EMISSIVE) ? (unsigned)gps::SHADER_FEATURE_EMISSIVE : litFeatures(*scene.getModel(body));
 }
 
-void renderEarth(gps::Shader shader, float deltaTime) {
-    shader.useShaderProgram();
-    earthOrbitAngle += earthRotationSpeed * deltaTime;
-
-    // Resetting the model matrix
-    earthModel = glm::mat4(1.0f);
-
-    // Rotate around the origin (orbit rotation)
-    earthModel = glm::rotate(earthModel, glm::radians(earthOrbitAngle), glm::vec3(0.0f, 1.0f, 0.0f));
-
-    // Translate to the orbit radius
-    earthModel = glm::translate(earthModel, glm::vec3(70.0f, 0.0f, 0.0f));
-
-    // Rotate around its own axis if needed
-    earthModel = glm::rotate(earthModel, glm::radians(earthOrbitAngle), glm::vec3(0.0f, 1.0f, 0.0f));
-
-    // Apply scaling transformation to make Venus 2 times bigger than Mercury
-    earthModel = glm::scale(earthModel, glm::vec3(4.0f, 4.0f, 4.0f));
-
-    glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(earthModel));
-    earth.Draw(shader);
+// every body, each with the cheapest permutation that fits it (or the pre-pass program)
+void renderSceneObjects() {
+    GPS_PROFILE_FUNCTION();
+    bool zones = gpuProfiler.areDrawZonesEnabled();
+    for (size_t i = 0; i < scene.getBodyCount(); i++) {
+        if (zones)
+            gpuProfiler.beginZone(scene.getName(i).c_str());
+        gps::Shader& shader = sceneShader(sceneObjectFeatures(i));
+        setModelUniforms(shader, *scene.getModelMatrix(i));
+        drawSceneObject(i, shader);
+        if (zones)
+            gpuProfiler.endZone();
+    }
 }
 
-void renderMars(gps::Shader shader, float deltaTime) {
-    shader.useShaderProgram();
-    marsOrbitAngle += marsRotationSpeed * deltaTime;
-
-    // Resetting the model matrix
-    marsModel = glm::mat4(1.0f);
+// the instanced permutations the gpu-driven draws need; the per-object path stands in until they link
+bool gpuDrivenShadersReady() {
+    for (size_t i = 0; i < scene.getBodyCount(); i++) {
+        if (!basicShaders.get(sceneObjectFeatures(i) | gps::SHADER_FEATURE_INSTANCED).isReady())
+            return false;
+    }
+    return depthPrepassInstancedShader.isReady();
+}
 
-    // Rotate around the origin (orbit rotation)
-    marsModel = glm::rotate(marsModel, glm::radians(marsOrbitAngle), glm::vec3(0.0f, 1.0f, 0.0f));
+void renderOpaque() {
+    GPS_PROFILE_FUNCTION();
+    glBindFramebuffer(GL_FRAMEBUFFER, frameGraph.getFramebuffer("backbuffer"));
+    glViewport(0, 0, myWindow.getWindowDimensions().width, myWindow.getWindowDimensions().height);
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
-    // Translate to the orbit radius
-    marsModel = glm::translate(marsModel, glm::vec3(80.0f, 0.0f, 0.0f));
+    bool indirect = gpuDriven && gpuDrivenShadersReady();
+    gps::Shader& prepassShader = indirect ? depthPrepassInstancedShader : depthPrepassShader;
+
+    // depth only, so the lit pass below shades every pixel exactly once
+    bool prepass = depthPrepass.beginFrame(prepassShader.isReady());
+    if (prepass) {
+        prepassShader.useShaderProgram();
+        glUniformMatrix4fv(prepassShader.getUniformLocation("view"), 1, GL_FALSE, glm::value_ptr(view));
+        glUniformMatrix4fv(prepassShader.getUniformLocation("projection"), 1, GL_FALSE, glm::value_ptr(projection));
+        glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+
+        prepassTimer.begin();
+        depthPrepass.beginDepthPass();
+        if (indirect) {
+            gpuDrivenRenderer.drawDepth();
+        }
+        else {
+            drawingDepthPrepass = true;
+            renderSceneObjects();
+            drawingDepthPrepass = false;
+        }
+        depthPrepass.endDepthPass();
+        prepassTimer.end();
 
-    // Rotate around its own axis if needed
-    marsModel = glm::rotate(marsModel, glm::radians(marsOrbitAngle), glm::vec3(0.0f, 1.0f, 0.0f));
+        glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+        glDepthFunc(GL_EQUAL);
+        glDepthMask(GL_FALSE);
+    }
 
-    marsModel = glm::scale(marsModel, glm::vec3(3.0f, 3.0f, 3.0f));
+    shadowAtlas.bindForSampling(3);
+    // frame uniforms changed since the last pass
+    boundBasicProgram = 0;
+
+    opaquePassTimer.begin();
+    depthPrepass.beginLitPass();
+    if (indirect)
+        gpuDrivenRenderer.drawLit(useBasicShader);
+    else
+        renderSceneObjects();
+    depthPrepass.endLitPass();
+    opaquePassTimer.end();
+
+    if (prepass) {
+        glDepthFunc(GL_LESS);
+        glDepthMask(GL_TRUE);
+    }
 
-    glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(marsModel));
-    mars.Draw(shader);
+    // tested against this frame's depth, used by the next frame's draws
+    if (!indirect && occlusionMode == gps::OCCLUSION_GPU && depthPrepassShader.isReady())
+        gpuOcclusion.issueQueries(depthPrepassShader, view, projection, CAMERA_NEAR);
 }
 
-void renderJupiter(gps::Shader shader, float deltaTime) {
-    shader.useShaderProgram();
-    jupiterOrbitAngle += jupiterRotationSpeed * deltaTime;
+void setShadowFilter(gps::ShadowFilter filter) {
+    shadowFilter = filter;
+    shadowAtlas.setFilter(filter);
+    // permutations are rebuilt lazily with the new tier
+    basicShaders.setBaseDefines(basicShaderDefines());
+    shadowPassTimer.reset();
+    opaquePassTimer.reset();
+}
 
-    // Resetting the model matrix
-    jupiterModel = glm::mat4(1.0f);
+void initShadowAtlas() {
+    GPS_PROFILE_FUNCTION();
+    shadowAtlas.init(SHADOW_ATLAS_SIZE);
+    shadowAtlas.setUpdateInterval(shadowUpdateInterval);
+    shadowAtlas.setFilter(shadowFilter);
+    shadowAtlas.setBlurShader(&shadowBlurShader);
+    // the sun holds the light, so it never gets a tile
+    int ignoredCasters = 0;
+    for (size_t i = 0; i < scene.getBodyCount(); i++) {
+        if (!(scene.getFlags(i) & gps::BODY_EMISSIVE)
+            && !shadowAtlas.addCaster(scene.getModel(i), scene.getModelMatrix(i), (scene.getFlags(i) & gps::BODY_SPHERE) != 0))
+            ignoredCasters++;
+    }
+    if (ignoredCasters > 0)
+        std::cout << "Shadow atlas is full, " << ignoredCasters << " casters ignored" << std::endl;
+}
 
-    // Rotate around the origin (orbit rotation)
-    jupiterModel = glm::rotate(jupiterModel, glm::radians(jupiterOrbitAngle), glm::vec3(0.0f, 1.0f, 0.0f));
+void initOcclusion() {
+    GPS_PROFILE_FUNCTION();
+    softwareOcclusion.setJobSystem(&jobSystem);
+    // the spheres occlude, the spaceships are only tested; added in body order, drawSceneObject looks them up by index
+    for (size_t i = 0; i < scene.getBodyCount(); i++) {
+        softwareOcclusion.addObject(scene.getModel(i), scene.getModelMatrix(i), (scene.getFlags(i) & gps::BODY_SPHERE) != 0);
+        gpuOcclusion.addObject(scene.getModel(i), scene.getModelMatrix(i));
+    }
+}
 
-    // Translate to the orbit radius
-    jupiterModel = glm::translate(jupiterModel, glm::vec3(90.0f, 0.0f, 0.0f));
+// packs the scene for the indirect path; only on GL 4.3 contexts
+void initGpuDriven() {
+    GPS_PROFILE_FUNCTION();
+    if (!gps::GpuDrivenRenderer::isSupported()) {
+        if (gpuDriven)
+            std::cout << "GPU-driven rendering needs OpenGL 4.3, drawing per object" << std::endl;
+        gpuDriven = false;
+        return;
+    }
+    for (size_t i = 0; i < scene.getBodyCount(); i++)
+        gpuDrivenRenderer.addObject(scene.getModel(i), scene.getModelMatrix(i), sceneObjectFeatures(i));
+    gpuDrivenRenderer.init("shaders/cullDraws.comp");
+}
 
-    // Rotate around its own axis if needed
-    jupiterModel = glm::rotate(jupiterModel, glm::radians(jupiterOrbitAngle), glm::vec3(0.0f, 1.0f, 0.0f));
+void initPointLights() {
+    GPS_PROFILE_FUNCTION();
+    clusteredLighting.setJobSystem(&jobSystem);
+    clusteredLighting.init();
+    std::vector<gps::PointLight>& lights = clusteredLighting.getLights();
+
+    // spaceship headlights, placed every frame by updateShipLights
+    glm::vec3 position;
+    for (size_t i = 0; i < scene.getBodyCount(); i++) {
+        if (scene.getHeadlight(i, position)) {
+            headlightBodies.push_back(i);
+            lights.push_back({ position, 40.0f, glm::vec3(150.0f, 140.0f, 110.0f) });
+        }
+    }
 
-    jupiterModel = glm::scale(jupiterModel, glm::vec3(10.0f, 10.0f, 10.0f));
+    // beacons around the outer orbits
+    lights.push_back({ glm::vec3(130.0f, 10.0f, 0.0f), 50.0f, glm::vec3(200.0f, 20.0f, 20.0f) });
+    lights.push_back({ glm::vec3(0.0f, 10.0f, 130.0f), 50.0f, glm::vec3(20.0f, 200.0f, 20.0f) });
+    lights.push_back({ glm::vec3(-130.0f, 10.0f, 0.0f), 50.0f, glm::vec3(20.0f, 60.0f, 200.0f) });
+    lights.push_back({ glm::vec3(0.0f, 10.0f, -130.0f), 50.0f, glm::vec3(200.0f, 120.0f, 20.0f) });
+}
 
-    glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(jupiterModel));
-    jupiter.Draw(shader);
+// keeps the headlights in front of the spaceships
+void updateShipLights() {
+    std::vector<gps::PointLight>& lights = clusteredLighting.getLights();
+    if (!shipHeadlights || lights.size() < headlightBodies.size())
+        return;
+    for (size_t i = 0; i < headlightBodies.size(); i++)
+        scene.getHeadlight(headlightBodies[i], lights[i].position);
 }
 
-void renderSaturn(gps::Shader shader, float deltaTime) {
-    shader.useShaderProgram();
-    saturnOrbitAngle += saturnRotationSpeed * deltaTime;
+void initFrameGraph() {
+    GPS_PROFILE_FUNCTION();
+    frameGraph.importResource("backbuffer", myWindow.getFramebuffer());
+    // object matrices, written once per frame before any pass reads them
+    frameGraph.importResource("transforms", 0);
+    // persistent, so it is imported rather than taken from the transient pool
+    frameGraph.importResource("shadowMap", shadowAtlas.getFramebuffer(), shadowAtlas.getTexture());
+    // VSM blur scratch, only alive inside the shadow pass, so the pool hands it to any later transient of the same size
+    GLsizei blurSize = gps::ShadowAtlas::getBlurTargetSize();
+    frameGraph.createTransient("shadowBlur", { blurSize, blurSize, GL_RG32F });
+    // cpu side data uploaded to texture buffers, tracked so the ordering is explicit
+    frameGraph.importResource("lightClusters", 0);
+    // per object visibility, computed on a worker while the shadow and light passes run
+    frameGraph.importResource("visibility", 0);
+    // indirect draw commands written by the culling compute pass
+    frameGraph.importResource("drawCommands", 0);
+    frameGraph.markOutput("backbuffer");
+
+    frameGraph.addPass("animate", {}, { "transforms" }, []() {
+        updateSceneObjects(simulationPaused ? 0.0f : frameDeltaTime);
+    });
+    frameGraph.addPass("occlusion", { "transforms" }, { "visibility" }, []() {
+        if (occlusionMode == gps::OCCLUSION_CPU)
+            softwareOcclusion.beginFrame(view, projection, CAMERA_NEAR);
+        else if (occlusionMode == gps::OCCLUSION_GPU)
+            gpuOcclusion.beginFrame();
+    });
+    frameGraph.addPass("gpuCull", { "transforms" }, { "drawCommands" }, []() {
+        if (gpuDriven)
+            gpuDrivenRenderer.cull(view, projection);
+    });
+    frameGraph.addPass("shadow", { "transforms" }, { "shadowMap", "shadowBlur" }, []() {
+        shadowAtlas.setBlurTarget(frameGraph.getFramebuffer("shadowBlur"), frameGraph.getTexture("shadowBlur"));
+        renderToShadowMap();
+    });
+    frameGraph.addPass("lightAssign", { "transforms" }, { "lightClusters" }, []() {
+        updateShipLights();
+        clusteredLighting.update(view, projection, CAMERA_NEAR, CAMERA_FAR);
+    });
+    frameGraph.addPass("opaque", { "shadowMap", "lightClusters", "visibility", "drawCommands" }, { "backbuffer" }, []() {
+        renderOpaque();
+    });
+    frameGraph.addPass("skybox", { "backbuffer" }, { "backbuffer" }, []() {
+        if (skyBoxShader.isReady())
+            mySkyBox.Draw(skyBoxShader, view, projection);
+    });
+
+    frameGraph.setGpuProfiler(&gpuProfiler);
+    frameGraph.compile();
+    frameGraph.printGraph(std::cout);
+}
 
-    // Resetting the model matrix
-    saturnModel = glm::mat4(1.0f);
 
-    // Rotate around the origin (orbit rotation)
-    saturnModel = glm::rotate(saturnModel, glm::radians(saturnOrbitAngle), glm::vec3(0.0f, 1.0f, 0.0f));
+// restart every orbit from the same place so runs are comparable
+void resetSimulation() {
+    if (simulationThread.isRunning())
+        simulationThread.requestReset();
+    else
+        scene.reset();
+}
 
-    // Translate to the orbit radius
-    saturnModel = glm::translate(saturnModel, glm::vec3(100.0f, 0.0f, 0.0f));
+// a scene file of bodyCount bodies: a star per thousand bodies, planets around the stars and moons around
+// the planets, so the table has three levels like a real system would
+std::string makeBenchmarkScene(int bodyCount) {
+    std::mt19937 random(42);
+    std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+    std::ostringstream text;
+    int star = -1, planet = -1;
+    for (int i = 0; i < bodyCount; i++) {
+        text << "body b" << i << "\n    mesh models/planets/planet.obj\n";
+        if (i % 1000 == 0) {
+            star = planet = i;
+            text << "    position " << 400.0f * unit(random) - 200.0f << " 0 " << 400.0f * unit(random) - 200.0f << "\n";
+        }
+        else if (i % 10 == 1) {
+            planet = i;
+            text << "    parent b" << star << "\n    orbit " << 20.0f + 100.0f * unit(random) << " " << 64.0f * unit(random) << "\n";
+        }
+        else {
+            text << "    parent b" << planet << "\n    orbit " << 2.0f + 8.0f * unit(random) << " " << 256.0f * unit(random) << "\n";
+        }
+        text << "    phase " << 360.0f * unit(random) << "\n    spin " << 128.0f * unit(random) << "\n    scale " << 0.5f + 4.0f * unit(random) << "\n";
+    }
+    return text.str();
+}
 
-    // Rotate around its own axis if needed
-    saturnModel = glm::rotate(saturnModel, glm::radians(saturnOrbitAngle), glm::vec3(0.0f, 1.0f, 0.0f));
+// a still scene file of the given shape: "wide" hangs every body off one root, "deep" is one chain,
+// "balanced" gives every body four children
+std::string makeHierarchyScene(const std::string& shape, int bodyCount) {
+    std::ostringstream text;
+    for (int i = 0; i < bodyCount; i++) {
+        text << "body b" << i << "\n    mesh models/planets/planet.obj\n    orbit 2 0\n    phase " << i % 360 << "\n";
+        if (i > 0)
+            text << "    parent b" << (shape == "wide" ? 0 : shape == "deep" ? i - 1 : (i - 1) / 4) << "\n";
+    }
+    return text.str();
+}
 
-    saturnModel = glm::scale(saturnModel, glm::vec3(8.0f, 8.0f, 8.0f));
+// dirty subtree propagation on still hierarchies: everything dirty, nothing dirty, one leaf edited and
+// the root's first child (with its whole subtree) edited
+void runSceneGraphBenchmark() {
+    const int BODIES = 100000;
+    const int UPDATES = 100;
+    const float FIXED_DELTA_TIME = 1.0f / 60.0f;
+    const char* shapes[] = { "wide", "deep", "balanced" };
+
+    std::cout << "hierarchy, bodies, all dirty ms, clean ms, leaf edited ms, first child edited ms" << std::endl;
+    for (const char* shape : shapes) {
+        std::istringstream text(makeHierarchyScene(shape, BODIES));
+        gps::Scene generated;
+        if (!generated.load(text, shape))
+            return;
+        gps::TransformSystem& transforms = generated.getTransforms();
+        gps::BodyMotion edit = { -1, 3.0f, 0.0f, 45.0f, 0.0f, 0.0f, 1.0f, glm::vec3(0.0f), glm::vec3(0.0f) };
+        transforms.update(FIXED_DELTA_TIME);
+
+        double updateMs[4];
+        for (int test = 0; test < 4; test++) {
+            std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+            for (int i = 0; i < UPDATES; i++) {
+                if (test == 0)
+                    transforms.reset();
+                else if (test == 2)
+                    transforms.setMotion(transforms.getCount() - 1, edit);
+                else if (test == 3)
+                    transforms.setMotion(1, edit);
+                transforms.update(FIXED_DELTA_TIME);
+            }
+            updateMs[test] = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count() / UPDATES;
+        }
 
-    glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(saturnModel));
-    saturn.Draw(shader);
+        std::cout << shape << ", " << BODIES << ", " << updateMs[0] << ", " << updateMs[1] << ", "
+            << updateMs[2] << ", " << updateMs[3] << std::endl;
+    }
 }
 
-void renderUranus(gps::Shader shader, float deltaTime) {
-    shader.useShaderProgram();
-    uranusOrbitAngle += uranusRotationSpeed * deltaTime;
-
-    // Resetting the model matrix
-    uranusModel = glm::mat4(1.0f);
+// load and update times of generated scenes, no window or gpu involved: the SIMD transform kernel
+// against one glm rotate/translate/rotate/scale chain per body, and how far their matrices differ
+void runSceneBenchmark() {
+    const int UPDATES = 200;
+    const float FIXED_DELTA_TIME = 1.0f / 60.0f;
+    const int bodyCounts[] = { 1000, 10000, 100000 };
+
+    std::cout << "bodies, load ms, glm update ms, " << gps::TransformSystem::getKernelName()
+        << " update ms, speedup, ns per body, max difference" << std::endl;
+    for (int count : bodyCounts) {
+        std::istringstream text(makeBenchmarkScene(count));
+        gps::Scene generated;
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        if (!generated.load(text, "generated"))
+            return;
+        double loadMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+        // same steps on both paths, from the same start; one untimed pass touches every page first
+        gps::TransformSystem& transforms = generated.getTransforms();
+        double updateMs[2];
+        std::vector<glm::mat4> matrices[2];
+        for (int path = 0; path < 2; path++) {
+            transforms.reset();
+            path == 0 ? transforms.updateReference(FIXED_DELTA_TIME) : transforms.update(FIXED_DELTA_TIME);
+            start = std::chrono::steady_clock::now();
+            for (int i = 0; i < UPDATES; i++)
+                path == 0 ? transforms.updateReference(FIXED_DELTA_TIME) : transforms.update(FIXED_DELTA_TIME);
+            updateMs[path] = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count() / UPDATES;
+            for (size_t body = 0; body < transforms.getCount(); body++)
+                matrices[path].push_back(*transforms.getModelMatrix(body));
+        }
 
-    // Rotate around the origin (orbit rotation)
-    uranusModel = glm::rotate(uranusModel, glm::radians(uranusOrbitAngle), glm::vec3(0.0f, 1.0f, 0.0f));
+        float difference = 0.0f;
+        for (size_t body = 0; body < matrices[0].size(); body++) {
+            for (int c = 0; c < 4; c++)
+                for (int r = 0; r < 4; r++)
+                    difference = std::max(difference, std::abs(matrices[0][body][c][r] - matrices[1][body][c][r]));
+        }
 
-    // Translate to the orbit radius
-    uranusModel = glm::translate(uranusModel, glm::vec3(110.0f, 0.0f, 0.0f));
+        std::cout << count << ", " << loadMs << ", " << updateMs[0] << ", " << updateMs[1] << ", "
+            << updateMs[0] / updateMs[1] << ", " << updateMs[1] * 1e6 / count << ", " << difference << std::endl;
+    }
+}
 
-    // Rotate around its own axis if needed
-    uranusModel = glm::rotate(uranusModel, glm::radians(uranusOrbitAngle), glm::vec3(0.0f, 1.0f, 0.0f));
+// the job system's workloads on 1 thread up to every hardware thread: the transform update of a generated
+// 100k body scene, parsing the scene file's models (no gpu involved) and the cost of one empty job
+void runJobBenchmark() {
+    const int BODIES = 100000;
+    const int UPDATES = 100;
+    const int EMPTY_JOBS = 100000;
+    const float FIXED_DELTA_TIME = 1.0f / 60.0f;
+    int maxThreads = std::max(1, (int)std::thread::hardware_concurrency());
+
+    std::istringstream text(makeBenchmarkScene(BODIES));
+    gps::Scene generated;
+    if (!generated.load(text, "generated"))
+        return;
+
+    std::cout << "threads, update ms, update speedup, parse ms, parse speedup, ns per empty job" << std::endl;
+    double baseUpdateMs = 0.0, baseParseMs = 0.0;
+    for (int threads = 1; threads <= maxThreads; threads++) {
+        gps::JobSystem pool;
+        pool.init(threads - 1);
+
+        generated.setJobSystem(&pool);
+        generated.getTransforms().reset();
+        generated.getTransforms().update(FIXED_DELTA_TIME);
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        for (int i = 0; i < UPDATES; i++)
+            generated.getTransforms().update(FIXED_DELTA_TIME);
+        double updateMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count() / UPDATES;
+
+        // a fresh scene every time, parsed models stay parsed
+        gps::Scene parsed;
+        if (!parsed.load(sceneFile))
+            return;
+        parsed.setJobSystem(&pool);
+        start = std::chrono::steady_clock::now();
+        parsed.parseModels();
+        double parseMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+        gps::JobSystem::Counter counter;
+        start = std::chrono::steady_clock::now();
+        for (int i = 0; i < EMPTY_JOBS; i++)
+            pool.run([]() {}, &counter);
+        pool.wait(counter);
+        double jobNs = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / EMPTY_JOBS;
+
+        if (threads == 1) {
+            baseUpdateMs = updateMs;
+            baseParseMs = parseMs;
+        }
+        std::cout << threads << ", " << updateMs << ", " << baseUpdateMs / updateMs << ", "
+            << parseMs << ", " << baseParseMs / parseMs << ", " << jobNs << std::endl;
+        generated.setJobSystem(NULL);
+    }
+}
 
-    uranusModel = glm::scale(uranusModel, glm::vec3(6.0f, 6.0f, 6.0f));
+// renders the same camera orbit with every shadow filter tier and prints the gpu cost of each
+void runShadowBenchmark() {
+    const int WARMUP_FRAMES = 60;
+    const int MEASURED_FRAMES = 600;
+    const float FIXED_DELTA_TIME = 1.0f / 60.0f;
+
+    std::cout << "filter, shadow pass ms, opaque pass ms" << std::endl;
+    for (int filter = 0; filter < gps::SHADOW_FILTER_COUNT; filter++) {
+        setShadowFilter((gps::ShadowFilter)filter);
+        finishShaders();
+        resetSimulation();
+
+        for (int frame = 0; frame < WARMUP_FRAMES + MEASURED_FRAMES && !myWindow.shouldClose(); frame++) {
+            if (frame == WARMUP_FRAMES) {
+                shadowPassTimer.reset();
+                opaquePassTimer.reset();
+            }
+
+            // one slow orbit around the sun, slightly above the ecliptic
+            float t = glm::radians(360.0f * frame / (WARMUP_FRAMES + MEASURED_FRAMES));
+            myCamera.setPose(glm::vec3(150.0f * cos(t), 40.0f, 150.0f * sin(t)), glm::vec3(0.0f));
+            view = myCamera.getViewMatrix();
+
+            frameDeltaTime = FIXED_DELTA_TIME;
+            frameGraph.execute();
+            myWindow.pollEvents();
+            myWindow.swapBuffers();
+        }
 
-    glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(uranusModel));
-    uranus.Draw(shader);
+        std::cout << gps::getShadowFilterName((gps::ShadowFilter)filter) << ", "
+            << shadowPassTimer.getAverageMs() << ", " << opaquePassTimer.getAverageMs() << std::endl;
+    }
 }
 
-void renderNeptune(gps::Shader shader, float deltaTime) {
-    shader.useShaderProgram();
-    neptuneOrbitAngle += neptuneRotationSpeed * deltaTime;
+// frame time with 1, 64, 1024 and 4096 random point lights from a fixed camera
+void runLightBenchmark() {
+    const int WARMUP_FRAMES = 60;
+    const int MEASURED_FRAMES = 300;
+    const float FIXED_DELTA_TIME = 1.0f / 60.0f;
+    const int lightCounts[] = { 1, 64, 1024, 4096 };
 
-    // Resetting the model matrix
-    neptuneModel = glm::mat4(1.0f);
+    // uncapped, so the frame time is the actual cost
+    framePacer.setVsyncMode(gps::VSYNC_OFF);
+    finishShaders();
+    shipHeadlights = false;
+    std::vector<gps::PointLight> sceneLights = clusteredLighting.getLights();
 
-    // Rotate around the origin (orbit rotation)
-    neptuneModel = glm::rotate(neptuneModel, glm::radians(neptuneOrbitAngle), glm::vec3(0.0f, 1.0f, 0.0f));
+    myCamera.setPose(glm::vec3(0.0f, 80.0f, 200.0f), glm::vec3(0.0f));
+    view = myCamera.getViewMatrix();
 
-    // Translate to the orbit radius
-    neptuneModel = glm::translate(neptuneModel, glm::vec3(120.0f, 0.0f, 0.0f));
+    std::cout << "lights, frame ms, assign ms, opaque pass ms, cluster entries" << std::endl;
+    for (int count : lightCounts) {
+        // same seed for every run, lights scattered through the orbit disk
+        std::mt19937 random(42);
+        std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+        std::vector<gps::PointLight>& lights = clusteredLighting.getLights();
+        lights.clear();
+        for (int i = 0; i < count; i++) {
+            float orbitAngle = glm::radians(360.0f * unit(random));
+            float orbitRadius = 20.0f + 110.0f * unit(random);
+            glm::vec3 position(orbitRadius * cos(orbitAngle), 20.0f * unit(random) - 10.0f, orbitRadius * sin(orbitAngle));
+            glm::vec3 color = glm::vec3(unit(random), unit(random), unit(random)) * 100.0f;
+            lights.push_back({ position, 8.0f + 12.0f * unit(random), color });
+        }
+        resetSimulation();
+
+        double frameTime = 0.0;
+        double assignTime = 0.0;
+        for (int frame = 0; frame < WARMUP_FRAMES + MEASURED_FRAMES && !myWindow.shouldClose(); frame++) {
+            if (frame == WARMUP_FRAMES)
+                opaquePassTimer.reset();
+
+            double start = myWindow.getTime();
+            frameDeltaTime = FIXED_DELTA_TIME;
+            frameGraph.execute();
+            myWindow.pollEvents();
+            myWindow.swapBuffers();
+            // wait for the gpu so the cpu clock covers the whole frame
+            glFinish();
+
+            if (frame >= WARMUP_FRAMES) {
+                frameTime += myWindow.getTime() - start;
+                assignTime += clusteredLighting.getLastUpdateMs();
+            }
+        }
 
-    // Rotate around its own axis if needed
-    neptuneModel = glm::rotate(neptuneModel, glm::radians(neptuneOrbitAngle), glm::vec3(0.0f, 1.0f, 0.0f));
+        std::cout << count << ", " << frameTime * 1000.0 / MEASURED_FRAMES << ", "
+            << assignTime / MEASURED_FRAMES << ", " << opaquePassTimer.getAverageMs() << ", "
+            << clusteredLighting.getAssignedIndexCount() << std::endl;
+    }
 
-    neptuneModel = glm::scale(neptuneModel, glm::vec3(6.0f, 6.0f, 6.0f));
-    
-    glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(neptuneModel));
-    neptune.Draw(shader);
+    clusteredLighting.getLights() = sceneLights;
+    shipHeadlights = true;
 }
 
-void renderSpaceShip1(gps::Shader shader, float deltaTime) {
-    shader.useShaderProgram();
-    spaceship1Distance += spaceship1Speed * deltaTime;
+// looks down the line the planets start on, so they all overlap, and compares the pre-pass modes
+void runPrepassBenchmark() {
+    const int WARMUP_FRAMES = 60;
+    const int MEASURED_FRAMES = 600;
 
-    spaceship1Model = glm::mat4(1.0f);
-    
-    // spaceship1 is moving
-    spaceship1Model = glm::translate(spaceship1Model, glm::vec3(-spaceship1Distance, 0.0f, 0.0f));
+    framePacer.setVsyncMode(gps::VSYNC_OFF);
+    finishShaders();
+    // the planets start lined up on +x; a frozen simulation keeps them that way
+    resetSimulation();
+    myCamera.setPose(glm::vec3(200.0f, 4.0f, 0.0f), glm::vec3(0.0f));
+    view = myCamera.getViewMatrix();
+    // culling would remove the very overdraw being measured
+    gps::OcclusionMode sceneOcclusion = occlusionMode;
+    occlusionMode = gps::OCCLUSION_OFF;
+
+    std::cout << "mode, frame ms, pre-pass ms, lit pass ms, overdraw" << std::endl;
+    for (int mode = 0; mode < gps::DEPTH_PREPASS_MODE_COUNT; mode++) {
+        depthPrepass.setMode((gps::DepthPrepassMode)mode);
+
+        double frameTime = 0.0;
+        for (int frame = 0; frame < WARMUP_FRAMES + MEASURED_FRAMES && !myWindow.shouldClose(); frame++) {
+            if (frame == WARMUP_FRAMES) {
+                prepassTimer.reset();
+                opaquePassTimer.reset();
+            }
+
+            double start = myWindow.getTime();
+            frameDeltaTime = 0.0f;
+            frameGraph.execute();
+            myWindow.pollEvents();
+            myWindow.swapBuffers();
+            glFinish();
+            if (frame >= WARMUP_FRAMES)
+                frameTime += myWindow.getTime() - start;
+        }
 
-    // init position of spaceship1
-    spaceship1Model = glm::translate(spaceship1Model, glm::vec3(120.0f, 0.0f, 120.0f));
+        std::cout << gps::getDepthPrepassModeName((gps::DepthPrepassMode)mode) << ", "
+            << frameTime * 1000.0 / MEASURED_FRAMES << ", " << prepassTimer.getAverageMs() << ", "
+            << opaquePassTimer.getAverageMs() << ", " << depthPrepass.getOverdraw() << std::endl;
+    }
 
-    spaceship1Model = glm::scale(spaceship1Model, glm::vec3(2.0f, 2.0f, 2.0f));
-    glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(spaceship1Model));
-    spaceship1.Draw(shader);
+    occlusionMode = sceneOcclusion;
+    gpuOcclusion.reset();
 }
 
-void renderSpaceShip2(gps::Shader shader, float deltaTime) {
-    shader.useShaderProgram();
-    spaceship2Distance += spaceship2Speed * deltaTime;
-
-    spaceship2Model = glm::mat4(1.0f);
-
-    // spaceship2 is moving
-    spaceship2Model = glm::translate(spaceship2Model, glm::vec3(0.0f, 0.0f, -spaceship2Distance));
-
-    // init position of spaceship2
-    spaceship2Model = glm::translate(spaceship2Model, glm::vec3(-120.0f, 0.0f, 120.0f));
-    spaceship2Model = glm::rotate(spaceship2Model, glm::radians(180.0f), glm::vec3(0.0f, 1.0f, 0.0f));
-
-    spaceship2Model = glm::scale(spaceship2Model, glm::vec3(5.0f, 5.0f, 5.0f));
-    glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(spaceship2Model));
-    spaceship2.Draw(shader);
+// a closed flight through the system: in over the outer orbits, along the ecliptic past the inner
+// planets, out above the disk and back; t in [0, 1)
+gps::CameraPath makeBenchmarkPath() {
+    gps::CameraPath path;
+    path.addKey(glm::vec3(0.0f, 60.0f, 220.0f), glm::vec3(0.0f));
+    path.addKey(glm::vec3(130.0f, 15.0f, 90.0f), glm::vec3(60.0f, 0.0f, 0.0f));
+    path.addKey(glm::vec3(75.0f, 4.0f, 10.0f), glm::vec3(0.0f));
+    path.addKey(glm::vec3(10.0f, 6.0f, -70.0f), glm::vec3(-60.0f, 0.0f, 0.0f));
+    path.addKey(glm::vec3(-90.0f, 10.0f, -60.0f), glm::vec3(0.0f, 0.0f, 40.0f));
+    path.addKey(glm::vec3(-160.0f, 70.0f, 40.0f), glm::vec3(0.0f));
+    path.addKey(glm::vec3(-40.0f, 140.0f, 150.0f), glm::vec3(0.0f));
+    return path;
 }
 
-void renderToShadowMap() {
-    // Set the viewport to the size of the depth map
-    glViewport(0, 0, SHADOW_WIDTH, SHADOW_HEIGHT);
-
-    // Bind the framebuffer for the shadow map
-    glBindFramebuffer(GL_FRAMEBUFFER, shadowMapFBO);
-    glClear(GL_DEPTH_BUFFER_BIT);
-
-    // Use the shader for rendering the depth map
-    depthMapShader.useShaderProgram();
+// fixed timestep, scripted camera, fixed frame counts: two runs of the same build and settings
+// see the same frames, so their reports can be diffed
+int runBenchmark() {
+    const float FIXED_DELTA_TIME = 1.0f / 60.0f;
+    int measuredFrames = frameLimit > 0 ? frameLimit : 600;
+
+    framePacer.setVsyncMode(gps::VSYNC_OFF);
+    finishShaders();
+    resetSimulation();
+    gps::CameraPath path = makeBenchmarkPath();
+    // per pass gpu times; nothing is waited on, results trail by a few frames
+    bool gpuProfilerWasEnabled = gpuProfiler.isEnabled();
+    gpuProfiler.setEnabled(true);
+
+    gps::BenchmarkReport report;
+    report.setConfig("renderer", (const char*)glGetString(GL_RENDERER));
+    report.setConfig("gl_version", (const char*)glGetString(GL_VERSION));
+    report.setConfig("size", std::to_string(myWindow.getWindowDimensions().width) + "x" +
+        std::to_string(myWindow.getWindowDimensions().height));
+    report.setConfig("headless", headless ? "yes" : "no");
+    report.setConfig("scene", sceneFile);
+    report.setConfig("warmup_frames", std::to_string(benchmarkWarmupFrames));
+    report.setConfig("occlusion", gps::getOcclusionModeName(occlusionMode));
+    // query results arrive whenever the gpu gets to them, so which objects draw in a frame varies
+    if (occlusionMode == gps::OCCLUSION_GPU) {
+        report.setConfig("frame_reproducible", "no (gpu occlusion: draw counts depend on query timing)");
+        std::cout << "Note: with --occlusion gpu the draw counts depend on query timing, runs differ frame for frame" << std::endl;
+    }
+    report.setConfig("gpu_driven", gpuDriven ? "yes" : "no");
+    report.setConfig("depth_prepass", gps::getDepthPrepassModeName(depthPrepass.getMode()));
+    report.setConfig("shadow_filter", gps::getShadowFilterName(shadowFilter));
+
+    int totalFrames = benchmarkWarmupFrames + measuredFrames;
+    for (int frame = 0; frame < totalFrames && !myWindow.shouldClose(); frame++) {
+        if (frame == benchmarkWarmupFrames) {
+            frameGraph.takeTimings();
+            gpuProfiler.resetStats();
+        }
 
-    // Calculate and set the light space transformation matrix
-    glm::mat4 lightSpaceMatrix = computeLightSpaceTrMatrix();
-    glUniformMatrix4fv(glGetUniformLocation(depthMapShader.shaderProgram, "lightSpaceMatrix"), 1, GL_FALSE, glm::value_ptr(lightSpaceMatrix));
+        // the path is a loop: the warmup flies all of it, so every viewpoint's caches and occlusion history
+        // are warm, and ends back at the start pose where the measured frames take it round again
+        float t = frame < benchmarkWarmupFrames ? (float)frame / benchmarkWarmupFrames
+            : (float)(frame - benchmarkWarmupFrames) / measuredFrames;
+        glm::vec3 position, target;
+        path.sample(t, position, target);
+        myCamera.setPose(position, target);
+        view = myCamera.getViewMatrix();
 
-    // Render the scene (or parts of it) from the light's perspective
-    renderSun(depthMapShader, 0.0f); // Similarly render other objects
-    renderMercury(depthMapShader, 0.0f);
-    renderVenus(depthMapShader, 0.0f);
-    renderEarth(depthMapShader, 0.0f);
-    renderMars(depthMapShader, 0.0f);
-    renderJupiter(depthMapShader, 0.0f);
+        gps::resetDrawStats();
+        double start = myWindow.getTime();
+        frameDeltaTime = FIXED_DELTA_TIME;
+        frameGraph.execute();
+        double submitted = myWindow.getTime();
+        myWindow.pollEvents();
+        myWindow.swapBuffers();
+        // wait for the gpu so the cpu clock covers the whole frame
+        glFinish();
+
+        if (frame >= benchmarkWarmupFrames) {
+            gps::DrawStats draws = gps::getDrawStats();
+            report.addFrame({ (myWindow.getTime() - start) * 1000.0, (submitted - start) * 1000.0, draws.drawCalls, draws.triangles });
+        }
+    }
 
-    // Unbind the framebuffer
-    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    report.summarize();
+    std::vector<gps::FrameGraph::PassTiming> cpuPasses = frameGraph.takeTimings();
+    for (size_t i = 0; i < cpuPasses.size(); i++)
+        report.setMetric("cpu_" + cpuPasses[i].name + "_ms_avg", cpuPasses[i].averageMs);
+    // top level zones are the passes, their sum the gpu frame
+    std::vector<gps::GpuProfiler::ZoneStats> gpuZones = gpuProfiler.getStats();
+    double gpuFrameMs = 0.0;
+    for (size_t i = 0; i < gpuZones.size(); i++) {
+        if (gpuZones[i].name.find('/') != std::string::npos)
+            continue;
+        report.setMetric("gpu_" + gpuZones[i].name + "_ms_avg", gpuZones[i].avgMs);
+        gpuFrameMs += gpuZones[i].avgMs;
+    }
+    report.setMetric("gpu_ms_avg", gpuFrameMs);
+    gpuProfiler.setEnabled(gpuProfilerWasEnabled);
+
+    report.print(std::cout);
+    if (report.writeJson(benchmarkFile))
+        std::cout << "Benchmark report written to " << benchmarkFile << std::endl;
+    else
+        std::cerr << "Could not write " << benchmarkFile << std::endl;
+
+    if (benchmarkBaselineFile.empty())
+        return EXIT_SUCCESS;
+    int regressions = report.compareWithBaseline(benchmarkBaselineFile, benchmarkThreshold, std::cout);
+    return regressions == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
 
-    // Restore the original viewport size
-    glViewport(0, 0, myWindow.getWindowDimensions().width, myWindow.getWindowDimensions().height);
+// what the frame ended up as, alpha forced opaque
+gps::Image readFrame() {
+    gps::Image image;
+    image.width = myWindow.getWindowDimensions().width;
+    image.height = myWindow.getWindowDimensions().height;
+    image.pixels.resize((size_t)image.width * image.height * 4);
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, myWindow.getFramebuffer());
+    if (myWindow.getFramebuffer() == 0)
+        glReadBuffer(GL_BACK);
+    glPixelStorei(GL_PACK_ALIGNMENT, 1);
+    glReadPixels(0, 0, image.width, image.height, GL_RGBA, GL_UNSIGNED_BYTE, image.pixels.data());
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+    for (size_t i = 3; i < image.pixels.size(); i += 4)
+        image.pixels[i] = 255;
+    return image;
 }
 
+// renders fixed shots (a point on the benchmark path at a fixed simulation time), times them and
+// compares each against <goldenDirectory>/shot_<n>.tga; a missing golden fails the shot and leaves
+// shot_<n>.actual.tga, a mismatch leaves shot_<n>.actual.tga and shot_<n>.diff.tga next to it.
+// With updateGoldenImages the shots are written as the new goldens instead and nothing is compared
+int runGoldenTests() {
+    // lets the frame-to-frame state (shadow cache, occlusion results) settle before anything is kept
+    const int SETTLE_FRAMES = 4;
+    const int TIMED_FRAMES = 20;
+    // path position, seconds of simulation
+    const float shots[][2] = {
+        { 0.0f, 0.0f }, { 0.15f, 12.0f }, { 0.3f, 30.0f }, { 0.45f, 45.0f }, { 0.65f, 70.0f }, { 0.85f, 100.0f }
+    };
+
+    framePacer.setVsyncMode(gps::VSYNC_OFF);
+    finishShaders();
+    gps::CameraPath path = makeBenchmarkPath();
+
+    int failures = 0;
+    std::cout << "shot, frame ms, draw calls, differing pixels, mean delta E, max delta E, result" << std::endl;
+    for (int shot = 0; shot < (int)(sizeof(shots) / sizeof(shots[0])) && !myWindow.shouldClose(); shot++) {
+        resetSimulation();
+        glm::vec3 position, target;
+        path.sample(shots[shot][0], position, target);
+        myCamera.setPose(position, target);
+        view = myCamera.getViewMatrix();
 
-void renderScene(float deltaTime) {
-    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+        double frameTime = 0.0;
+        gps::DrawStats draws = { 0, 0 };
+        gps::Image image;
+        for (int frame = 0; frame < SETTLE_FRAMES + TIMED_FRAMES; frame++) {
+            gps::resetDrawStats();
+            double start = myWindow.getTime();
+            // the whole simulation step happens on the first frame, the rest are the same instant
+            frameDeltaTime = frame == 0 ? shots[shot][1] : 0.0f;
+            frameGraph.execute();
+            glFinish();
+            if (frame >= SETTLE_FRAMES)
+                frameTime += myWindow.getTime() - start;
+            if (frame == SETTLE_FRAMES + TIMED_FRAMES - 1) {
+                draws = gps::getDrawStats();
+                image = readFrame();
+            }
+            myWindow.pollEvents();
+            myWindow.swapBuffers();
+        }
 
-    renderToShadowMap();
-    glActiveTexture(GL_TEXTURE3);
-    glBindTexture(GL_TEXTURE_2D, depthMapTexture);
-    glUniform1i(glGetUniformLocation(myBasicShader.shaderProgram, "shadowMap"), 3);
+        std::string golden = goldenDirectory + "/shot_" + std::to_string(shot);
+        std::cout << shot << ", " << frameTime * 1000.0 / TIMED_FRAMES << ", " << draws.drawCalls << ", ";
+        if (updateGoldenImages) {
+            bool written = gps::writeTga(golden + ".tga", image);
+            std::cout << "-, -, -, " << (written ? "golden written" : "could not write golden") << std::endl;
+            failures += written ? 0 : 1;
+            continue;
+        }
+        // only --update-golden creates goldens, so a wrong or empty directory fails instead of passing
+        gps::Image expected;
+        if (!gps::readTga(golden + ".tga", expected)) {
+            failures++;
+            gps::writeTga(golden + ".actual.tga", image);
+            std::cout << "-, -, -, FAIL (no golden " << golden << ".tga, see --update-golden)" << std::endl;
+            continue;
+        }
 
-    glUniformMatrix4fv(glGetUniformLocation(myBasicShader.shaderProgram, "lightSpaceTrMatrix"),
-        1,
-        GL_FALSE,
-        glm::value_ptr(computeLightSpaceTrMatrix()));
+        gps::ImageDifference difference = gps::compareImages(expected, image, goldenTolerance);
+        bool passed = difference.differingFraction <= goldenMaxDiffering;
+        std::cout << difference.differingPixels << ", " << difference.meanDeltaE << ", " << difference.maxDeltaE << ", "
+            << (passed ? "pass" : "FAIL") << std::endl;
+        if (!passed) {
+            failures++;
+            gps::writeTga(golden + ".actual.tga", image);
+            gps::writeTga(golden + ".diff.tga", difference.diff);
+        }
+    }
 
-    //render the scene
-    renderSun(myBasicShader, deltaTime);
-    renderMercury(myBasicShader, deltaTime);
-    renderVenus(myBasicShader, deltaTime);
-    renderEarth(myBasicShader, deltaTime);
-    renderMars(myBasicShader, deltaTime);
-    renderJupiter(myBasicShader, deltaTime);
-    renderSaturn(myBasicShader, deltaTime);
-    renderUranus(myBasicShader, deltaTime);
-    renderNeptune(myBasicShader, deltaTime);
-    renderSpaceShip1(myBasicShader, deltaTime);
-    renderSpaceShip2(myBasicShader, deltaTime);
-    mySkyBox.Draw(skyBoxShader, view, projection);
+    std::cout << failures << " golden image failure" << (failures == 1 ? "" : "s") << std::endl;
+    return failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
 }
 
-
 void cleanup() {
+    if (gpuProfiler.isEnabled() && gpuProfiler.writeCsv(gpuProfileFile))
+        std::cout << "GPU profile written to " << gpuProfileFile << std::endl;
+    if (gps::CpuProfiler::isEnabled() && gps::CpuProfiler::writeChromeTrace(cpuTraceFile))
+        std::cout << "CPU trace written to " << cpuTraceFile << std::endl;
     myWindow.Delete();
     //cleanup code for your own data
 }
 
 
 
+void parseArguments(int argc, const char* argv[]) {
+    for (int i = 1; i < argc; i++) {
+        std::string argument = argv[i];
+        if (argument == "--shadow-update-interval" && i + 1 < argc) {
+            shadowUpdateInterval = std::atoi(argv[++i]);
+        }
+        else if (argument == "--shadow-filter" && i + 1 < argc) {
+            std::string name = argv[++i];
+            for (int filter = 0; filter < gps::SHADOW_FILTER_COUNT; filter++) {
+                if (name == gps::getShadowFilterName((gps::ShadowFilter)filter))
+                    shadowFilter = (gps::ShadowFilter)filter;
+            }
+        }
+        else if (argument == "--shadow-benchmark") {
+            shadowBenchmark = true;
+        }
+        else if (argument == "--light-benchmark") {
+            lightBenchmark = true;
+        }
+        else if (argument == "--scene" && i + 1 < argc) {
+            sceneFile = argv[++i];
+        }
+        else if (argument == "--scene-benchmark") {
+            sceneBenchmark = true;
+        }
+        else if (argument == "--simulation-rate" && i + 1 < argc) {
+            simulationRate = (float)std::atof(argv[++i]);
+        }
+        else if (argument == "--job-workers" && i + 1 < argc) {
+            jobWorkers = std::atoi(argv[++i]);
+        }
+        else if (argument == "--job-benchmark") {
+            jobBenchmark = true;
+        }
+        else if (argument == "--depth-prepass" && i + 1 < argc) {
+            std::string name = argv[++i];
+            for (int mode = 0; mode < gps::DEPTH_PREPASS_MODE_COUNT; mode++) {
+                if (name == gps::getDepthPrepassModeName((gps::DepthPrepassMode)mode))
+                    depthPrepass.setMode((gps::DepthPrepassMode)mode);
+            }
+        }
+        else if (argument == "--occlusion" && i + 1 < argc) {
+            std::string name = argv[++i];
+            for (int mode = 0; mode < gps::OCCLUSION_MODE_COUNT; mode++) {
+                if (name == gps::getOcclusionModeName((gps::OcclusionMode)mode))
+                    occlusionMode = (gps::OcclusionMode)mode;
+            }
+        }
+        else if (argument == "--gpu-profile" && i + 1 < argc) {
+            gpuProfileFile = argv[++i];
+            gpuProfiler.setEnabled(true);
+        }
+        else if (argument == "--gpu-profile-draws") {
+            gpuProfiler.setEnabled(true);
+            gpuProfiler.setDrawZonesEnabled(true);
+        }
+        else if (argument == "--cpu-trace" && i + 1 < argc) {
+            cpuTraceFile = argv[++i];
+            if (GPS_PROFILER_COMPILED)
+                gps::CpuProfiler::setEnabled(true);
+            else
+                std::cerr << "--cpu-trace: the CPU profiler is compiled out of this build (define GPS_ENABLE_PROFILER)" << std::endl;
+        }
+        else if (argument == "--vsync" && i + 1 < argc) {
+            std::string name = argv[++i];
+            for (int mode = 0; mode < gps::VSYNC_MODE_COUNT; mode++) {
+                if (name == gps::getVsyncModeName((gps::VsyncMode)mode))
+                    vsyncMode = (gps::VsyncMode)mode;
+            }
+        }
+        else if (argument == "--fps-cap" && i + 1 < argc) {
+            framePacer.setFrameCap((float)std::atof(argv[++i]));
+        }
+        else if (argument == "--idle-fps" && i + 1 < argc) {
+            framePacer.setIdleFrameCap((float)std::atof(argv[++i]));
+        }
+        else if (argument == "--headless") {
+            headless = true;
+        }
+        else if (argument == "--size" && i + 1 < argc) {
+            if (std::sscanf(argv[++i], "%dx%d", &windowWidth, &windowHeight) != 2 || windowWidth <= 0 || windowHeight <= 0) {
+                std::cerr << "--size expects WIDTHxHEIGHT" << std::endl;
+                windowWidth = 1024;
+                windowHeight = 728;
+            }
+        }
+        else if (argument == "--frames" && i + 1 < argc) {
+            frameLimit = std::atoi(argv[++i]);
+        }
+        else if (argument == "--duration" && i + 1 < argc) {
+            durationLimit = (float)std::atof(argv[++i]);
+        }
+        else if (argument == "--msaa" && i + 1 < argc) {
+            msaaSamples = std::atoi(argv[++i]);
+        }
+        else if (argument == "--gpu-driven") {
+            gpuDriven = true;
+        }
+        else if (argument == "--record" && i + 1 < argc) {
+            inputRecordFile = argv[++i];
+        }
+        else if (argument == "--replay" && i + 1 < argc) {
+            inputReplayFile = argv[++i];
+        }
+        else if (argument == "--golden" && i + 1 < argc) {
+            goldenDirectory = argv[++i];
+        }
+        else if (argument == "--update-golden") {
+            updateGoldenImages = true;
+        }
+        else if (argument == "--golden-tolerance" && i + 1 < argc) {
+            goldenTolerance = std::atof(argv[++i]);
+        }
+        else if (argument == "--golden-max-differing" && i + 1 < argc) {
+            goldenMaxDiffering = std::atof(argv[++i]);
+        }
+        else if (argument == "--benchmark" && i + 1 < argc) {
+            benchmarkFile = argv[++i];
+        }
+        else if (argument == "--baseline" && i + 1 < argc) {
+            benchmarkBaselineFile = argv[++i];
+        }
+        else if (argument == "--regression-threshold" && i + 1 < argc) {
+            benchmarkThreshold = std::atof(argv[++i]);
+        }
+        else if (argument == "--warmup" && i + 1 < argc) {
+            benchmarkWarmupFrames = std::max(0, std::atoi(argv[++i]));
+        }
+        else if (argument == "--prepass-benchmark") {
+            prepassBenchmark = true;
+        }
+        else if (argument == "--no-shader-cache") {
+            shaderCacheDirectory = "";
+        }
+        else {
+            std::cerr << "Unknown argument: " << argument << std::endl;
+        }
+    }
+    // with no window to close, a headless run always ends by itself
+    if (headless && benchmarkFile.empty() && inputReplayFile.empty() && frameLimit <= 0 && durationLimit <= 0.0f)
+        frameLimit = 300;
+}
+
+// the timings a run with --frames or --duration ends with
+void printRunStats(int frames, double seconds) {
+    std::cout << frames << " frames in " << seconds << " s (" << frames / seconds << " fps, "
+        << seconds * 1000.0 / frames << " ms per frame" << (headless ? ", headless" : "") << ")" << std::endl;
+    framePacer.printStats(std::cout);
+    if (simulationThread.isRunning()) {
+        std::cout << simulationThread.getTickCount() << " simulation ticks ("
+            << simulationThread.getTickCount() / seconds << " per second)" << std::endl;
+    }
+    frameGraph.printTimings(std::cout);
+}
+
 int main(int argc, const char* argv[]) {
 
+    GPS_PROFILE_THREAD("main");
+    parseArguments(argc, argv);
+
+    if (sceneBenchmark) {
+        runSceneBenchmark();
+        runSceneGraphBenchmark();
+        return EXIT_SUCCESS;
+    }
+    if (jobBenchmark) {
+        runJobBenchmark();
+        return EXIT_SUCCESS;
+    }
+    if (!scene.load(sceneFile))
+        return EXIT_FAILURE;
+    jobSystem.init(jobWorkers);
+    scene.setJobSystem(&jobSystem);
+
     try {
         initOpenGLWindow();
     }
@@ -668,32 +1609,135 @@ int main(int argc, const char* argv[]) {
     }
 
     initOpenGLState();
+    // compiles in the background while the models and textures load
+    initShaders();
     initModels();
     initSkyBox();
-    initShaders();
     initUniforms();
-    initShadowMapping();
+    initShadowAtlas();
+    initPointLights();
+    initOcclusion();
+    initGpuDriven();
+    initFrameGraph();
     setWindowCallbacks();
 
     glCheckError();
+
+    if (shadowBenchmark) {
+        runShadowBenchmark();
+        cleanup();
+        return EXIT_SUCCESS;
+    }
+
+    if (prepassBenchmark) {
+        runPrepassBenchmark();
+        cleanup();
+        return EXIT_SUCCESS;
+    }
+
+    if (lightBenchmark) {
+        runLightBenchmark();
+        cleanup();
+        return EXIT_SUCCESS;
+    }
+
+    // both can run in one go: the performance report and the image check of the same build
+    if (!benchmarkFile.empty() || !goldenDirectory.empty()) {
+        int result = EXIT_SUCCESS;
+        if (!benchmarkFile.empty() && runBenchmark() != EXIT_SUCCESS)
+            result = EXIT_FAILURE;
+        if (!goldenDirectory.empty() && runGoldenTests() != EXIT_SUCCESS)
+            result = EXIT_FAILURE;
+        cleanup();
+        return result;
+    }
+
+    if (!inputReplayFile.empty()) {
+        if (!inputRecorder.startReplay(inputReplayFile)) {
+            cleanup();
+            return EXIT_FAILURE;
+        }
+        std::cout << "Replaying " << inputRecorder.getFrameCount() << " frames from " << inputReplayFile << std::endl;
+    }
+    else if (!inputRecordFile.empty()) {
+        if (inputRecorder.startRecording(inputRecordFile))
+            std::cout << "Recording input to " << inputRecordFile << std::endl;
+        else
+            std::cerr << "Could not write " << inputRecordFile << std::endl;
+    }
+
+    if (simulationRate > 0.0f && !inputRecorder.isReplaying() && !inputRecorder.isRecording())
+        simulationThread.start(&scene, simulationRate);
+
     // application loop
-   
-    while (!glfwWindowShouldClose(myWindow.getWindow())) {
-        
+    int frames = 0;
+    double loopStart = myWindow.getTime();
+    while (!myWindow.shouldClose()) {
+        GPS_PROFILE_SCOPE("frame");
+
+        // waits out the frame cap; idle needs a still camera over the whole previous frame
+        {
+            GPS_PROFILE_SCOPE("framePacing");
+            framePacer.beginFrame(simulationPaused && !cameraMoved);
+            cameraMoved = false;
+        }
+
         // Compute delta time
-        static float lastTime = glfwGetTime();
-        float currentTime = glfwGetTime();
-        float deltaTime = currentTime - lastTime;
+        static float lastTime = myWindow.getTime();
+        float currentTime = myWindow.getTime();
+        frameDeltaTime = currentTime - lastTime;
         lastTime = currentTime;
+        if (inputRecorder.isReplaying()) {
+            if (!inputRecorder.nextFrame(frameDeltaTime))
+                break;
+        }
+        else {
+            inputRecorder.recordFrame(frameDeltaTime);
+        }
+
+        // a couple of stat calls per shader, no need to do it every frame
+        static float lastShaderCheck = 0.0f;
+        if (currentTime - lastShaderCheck > 0.5f) {
+            reloadChangedShaders();
+            lastShaderCheck = currentTime;
+        }
 
         processMovement();
-        renderToShadowMap();
-        renderScene(deltaTime);
-        glfwPollEvents();
-        glfwSwapBuffers(myWindow.getWindow());
+        frameGraph.execute();
+        {
+            GPS_PROFILE_SCOPE("pollEvents");
+            // still polled while replaying, so the window stays responsive and can be closed
+            myWindow.pollEvents();
+            if (inputRecorder.isReplaying()) {
+                inputRecorder.dispatchEvents(
+                    [](int key, int scancode, int action, int mods) { keyboardCallback(myWindow.getWindow(), key, scancode, action, mods); },
+                    [](double x, double y) { mouseCallback(myWindow.getWindow(), x, y); });
+            }
+        }
+        {
+            // with vsync on, time spent waiting for the display shows up here
+            GPS_PROFILE_SCOPE("swapBuffers");
+            myWindow.swapBuffers();
+        }
         glCheckError();
+
+        // the frames before this fell back on whatever had not linked yet
+        static bool shadersReady = false;
+        if (!shadersReady && startupShadersReady()) {
+            shadersReady = true;
+            printStartupProgramCacheStats();
+        }
+
+        frames++;
+        if ((frameLimit > 0 && frames >= frameLimit) || (durationLimit > 0.0f && myWindow.getTime() - loopStart >= durationLimit))
+            myWindow.setShouldClose(true);
     }
 
+    if (frameLimit > 0 || durationLimit > 0.0f || inputRecorder.isReplaying())
+        printRunStats(frames, myWindow.getTime() - loopStart);
+    inputRecorder.stop();
+    simulationThread.stop();
+
     cleanup();
 
     return EXIT_SUCCESS;
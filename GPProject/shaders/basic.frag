@@ -1,26 +1,80 @@
 #version 410 core
 
+// permutation features (SHADOWS, SPECULAR_MAP, EMISSIVE, ...) are injected at compile time (see gps::ShaderPermutations)
 
-in vec3 fPosition;
-in vec3 fNormal;
+in vec3 fPosEye;
+in vec3 fNormalEye;
 in vec2 fTexCoords;
-in vec4 fragPosLightSpace;
+in float fSunDistance;
+#ifdef SHADOWS
+in vec3 fWorldPosition;
+#endif
 
 out vec4 fColor;
 
-//matrices
-uniform mat4 model;
-uniform mat4 view;
-uniform mat3 normalMatrix;
-
 //lighting
 uniform vec3 lightColor;
-uniform vec3 sunPosition;
+// sun position in eye space, set once per frame
+uniform vec3 sunPositionEye;
 
 // textures
 uniform sampler2D diffuseTexture;
+#ifdef SPECULAR_MAP
 uniform sampler2D specularTexture;
+#endif
+
+// shadow filtering tier, injected at compile time (see gps::ShadowFilter)
+#define SHADOW_FILTER_PCF 0
+#define SHADOW_FILTER_POISSON 1
+#define SHADOW_FILTER_VSM 2
+#ifndef SHADOW_FILTER
+#define SHADOW_FILTER SHADOW_FILTER_PCF
+#endif
+
+#ifdef SHADOWS
+#if SHADOW_FILTER == SHADOW_FILTER_PCF
+// depth compare mode is enabled, so a linear fetch gives 2x2 PCF in hardware
+uniform sampler2DShadow shadowMap;
+#else
 uniform sampler2D shadowMap;
+#endif
+
+// shadow atlas, one tile per caster (see gps::ShadowAtlas)
+#define MAX_SHADOW_CASTERS 16
+uniform int shadowCasterCount;
+uniform mat4 casterLightSpace[MAX_SHADOW_CASTERS];
+// xy = tile offset, zw = tile size, in atlas uv
+uniform vec4 casterTile[MAX_SHADOW_CASTERS];
+uniform vec2 shadowTexelSize;
+// far plane of the tile frustums, normalizes the VSM moments
+uniform float shadowFar;
+
+#if SHADOW_FILTER == SHADOW_FILTER_POISSON
+#define POISSON_SAMPLES 16
+// kernel radius in atlas texels
+const float poissonRadius = 2.5f;
+const vec2 poissonDisk[POISSON_SAMPLES] = vec2[](
+    vec2(-0.94201624f, -0.39906216f), vec2(0.94558609f, -0.76890725f),
+    vec2(-0.09418410f, -0.92938870f), vec2(0.34495938f, 0.29387760f),
+    vec2(-0.91588581f, 0.45771432f), vec2(-0.81544232f, -0.87912464f),
+    vec2(-0.38277543f, 0.27676845f), vec2(0.97484398f, 0.75648379f),
+    vec2(0.44323325f, -0.97511554f), vec2(0.53742981f, -0.47373420f),
+    vec2(-0.26496911f, -0.41893023f), vec2(0.79197514f, 0.19090188f),
+    vec2(-0.24188840f, 0.99706507f), vec2(-0.81409955f, 0.91437590f),
+    vec2(0.19984126f, 0.78641367f), vec2(0.14383161f, -0.14100790f));
+#endif
+#endif
+
+// clustered point lights (see gps::ClusteredLighting)
+// 2 texels per light: eye space position + radius, color
+uniform samplerBuffer pointLights;
+// offset into lightIndices and light count, one texel per cluster
+uniform usamplerBuffer lightClusters;
+uniform usamplerBuffer lightIndices;
+uniform uvec3 clusterGrid;
+uniform vec2 clusterScreenSize;
+// near and far plane of the camera; depth slices are spaced exponentially between them
+uniform vec2 clusterDepthRange;
 
 // Attenuation coefficients
 const float constant = 1.0;
@@ -34,63 +88,160 @@ vec3 diffuse;
 vec3 specular;
 float specularStrength = 0.1f;
 float shadow;
+vec3 normalEye;
 
-float computeShadow() 
+#ifdef SHADOWS
+// shadow factor for one caster tile: 0 = lit, 1 = fully shadowed
+float sampleShadowTile(int i, vec3 normalizedCoords, float lightDistance)
 {
-    vec3 normalizedCoords = fragPosLightSpace.xyz / fragPosLightSpace.w;
-    normalizedCoords = normalizedCoords * 0.5 + 0.5;
-    
-    if (normalizedCoords.z > 1.0f)
+    // stay a texel inside the tile so filtering never reads a neighbouring tile
+    vec2 tileMin = casterTile[i].xy + shadowTexelSize;
+    vec2 tileMax = casterTile[i].xy + casterTile[i].zw - shadowTexelSize;
+    vec2 uv = casterTile[i].xy + normalizedCoords.xy * casterTile[i].zw;
+
+    // the slope scaled part of the bias is applied when the tiles are rendered
+    float currentDepth = normalizedCoords.z - 0.0005f;
+
+#if SHADOW_FILTER == SHADOW_FILTER_PCF
+    return 1.0f - texture(shadowMap, vec3(clamp(uv, tileMin, tileMax), currentDepth));
+#elif SHADOW_FILTER == SHADOW_FILTER_POISSON
+    // rotate the disk per pixel, trading banding for noise
+    float angle = 6.2831853f * fract(sin(dot(gl_FragCoord.xy, vec2(12.9898f, 78.233f))) * 43758.5453f);
+    mat2 rotation = mat2(cos(angle), sin(angle), -sin(angle), cos(angle));
+    float shadow = 0.0f;
+    for (int s = 0; s < POISSON_SAMPLES; s++)
+    {
+        vec2 offset = rotation * poissonDisk[s] * poissonRadius * shadowTexelSize;
+        float closestDepth = texture(shadowMap, clamp(uv + offset, tileMin, tileMax)).r;
+        shadow += currentDepth > closestDepth ? 1.0f : 0.0f;
+    }
+    return shadow / float(POISSON_SAMPLES);
+#else
+    // chebyshev upper bound on the blurred moments of the light distance
+    vec2 moments = texture(shadowMap, clamp(uv, tileMin, tileMax)).rg;
+    float depth = lightDistance / shadowFar;
+    if (depth <= moments.x)
         return 0.0f;
-    
-    float closestDepth = texture(shadowMap, normalizedCoords.xy).r;
-    float currentDepth = normalizedCoords.z;
-    
-    float bias = max(0.05f * (1.0f - dot(normalize(fNormal), sunPosition)), 0.005f);
-    float shadow = currentDepth - bias > closestDepth ? 1.0f : 0.0f;
+    float variance = max(moments.y - moments.x * moments.x, 0.00002f);
+    float delta = depth - moments.x;
+    float litProbability = variance / (variance + delta * delta);
+    // cut off the low probability tail to reduce light bleeding
+    litProbability = clamp((litProbability - 0.2f) / 0.8f, 0.0f, 1.0f);
+    return 1.0f - litProbability;
+#endif
+}
+
+float computeShadow() 
+{
+    float shadow = 0.0f;
+    for (int i = 0; i < shadowCasterCount; i++)
+    {
+        vec4 lightSpacePosition = casterLightSpace[i] * vec4(fWorldPosition, 1.0f);
+        if (lightSpacePosition.w <= 0.0f)
+            continue;
+
+        vec3 normalizedCoords = lightSpacePosition.xyz / lightSpacePosition.w;
+        normalizedCoords = normalizedCoords * 0.5 + 0.5;
+
+        // outside this caster's frustum
+        if (any(lessThan(normalizedCoords, vec3(0.0f))) || any(greaterThan(normalizedCoords, vec3(1.0f))))
+            continue;
+
+        shadow = max(shadow, sampleShadowTile(i, normalizedCoords, lightSpacePosition.w));
+    }
 
     return shadow;
 }
+#endif
 
-void computeDirLight()
+void computeDirLight(vec3 albedo, vec3 specularMask)
 {
-    //compute eye space coordinates
-    vec4 fPosEye = view * model * vec4(fPosition, 1.0f);
-    vec3 normalEye = normalize(normalMatrix * fNormal);
+    //eye space position and normal come from the vertex shader
+    normalEye = normalize(fNormalEye);
 
     //normalize light direction
-     vec3 lightDirN = normalize(vec3(view * vec4(sunPosition, 1.0f)) - fPosEye.xyz);
+    vec3 lightDirN = normalize(sunPositionEye - fPosEye);
 
     //compute view direction (in eye coordinates, the viewer is situated at the origin
-    vec3 viewDir = normalize(- fPosEye.xyz);
+    vec3 viewDir = normalize(- fPosEye);
 
     // Compute distance to light
-    float distance = length(sunPosition - fPosition);
+    float distance = fSunDistance;
     float attenuation = 1.0 / (constant + linear * distance + quadratic * (distance * distance));
 
     // add shadow calculation
+#ifdef SHADOWS
     shadow = computeShadow();
+#else
+    shadow = 0.0f;
+#endif
 
     //compute ambient light
     ambient = ambientStrength * lightColor;
 
     //compute diffuse light
     diffuse = max(dot(normalEye, lightDirN), 0.0f) * lightColor * attenuation;
-    diffuse *= (1.0f - shadow) * texture(diffuseTexture, fTexCoords).rgb;
+    diffuse *= (1.0f - shadow) * albedo;
 
     //compute specular light
     vec3 reflectDir = reflect(-lightDirN, normalEye);
     float specCoeff = pow(max(dot(viewDir, reflectDir), 0.0f), 32);
     specular = specularStrength * specCoeff * lightColor * attenuation;
-    specular *= (1.0f - shadow) * texture(specularTexture, fTexCoords).rgb;
+    specular *= (1.0f - shadow) * specularMask;
+}
+
+// unshadowed point lights, only the ones binned into this fragment's cluster
+void computePointLights()
+{
+    float depth = -fPosEye.z;
+    int slice = int(log(depth / clusterDepthRange.x) / log(clusterDepthRange.y / clusterDepthRange.x) * float(clusterGrid.z));
+    uvec3 cluster = uvec3(clamp(ivec3(ivec2(gl_FragCoord.xy / clusterScreenSize * vec2(clusterGrid.xy)), slice),
+        ivec3(0), ivec3(clusterGrid) - 1));
+    uvec2 range = texelFetch(lightClusters, int(cluster.x + clusterGrid.x * (cluster.y + clusterGrid.y * cluster.z))).rg;
+
+    vec3 viewDir = normalize(-fPosEye.xyz);
+    for (uint i = 0u; i < range.y; i++)
+    {
+        int light = int(texelFetch(lightIndices, int(range.x + i)).r);
+        vec4 positionRadius = texelFetch(pointLights, light * 2);
+        vec3 color = texelFetch(pointLights, light * 2 + 1).rgb;
+
+        vec3 toLight = positionRadius.xyz - fPosEye;
+        float distance = length(toLight);
+        if (distance >= positionRadius.w)
+            continue;
+        vec3 lightDirN = toLight / distance;
+
+        // inverse square falloff windowed to reach zero at the light radius
+        float window = clamp(1.0f - pow(distance / positionRadius.w, 4.0f), 0.0f, 1.0f);
+        float attenuation = window * window / (distance * distance + 1.0f);
+
+        diffuse += max(dot(normalEye, lightDirN), 0.0f) * color * attenuation;
+        vec3 reflectDir = reflect(-lightDirN, normalEye);
+        specular += specularStrength * pow(max(dot(viewDir, reflectDir), 0.0f), 32) * color * attenuation;
+    }
 }
 
 void main() 
 {
-    computeDirLight();
+    vec3 albedo = texture(diffuseTexture, fTexCoords).rgb;
+
+#ifdef EMISSIVE
+    vec3 color = min(ambientStrength * lightColor * albedo, 1.0f);
+#else
+#ifdef SPECULAR_MAP
+    vec3 specularMask = texture(specularTexture, fTexCoords).rgb;
+#else
+    // without a specular map the diffuse texture doubles as the specular mask
+    vec3 specularMask = albedo;
+#endif
+
+    computeDirLight(albedo, specularMask);
+    computePointLights();
 
     //compute final vertex color
-    vec3 color = min((ambient + diffuse) * texture(diffuseTexture, fTexCoords).rgb + specular * texture(specularTexture, fTexCoords).rgb, 1.0f);
+    vec3 color = min((ambient + diffuse) * albedo + specular * specularMask, 1.0f);
+#endif
 
     fColor = vec4(color, 1.0f);
 }
\ No newline at end of file
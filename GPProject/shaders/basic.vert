@@ -1,28 +1,57 @@
 #version 410 core
 
+// permutation features (SHADOWS, EMISSIVE, INSTANCED, ...) are injected at compile time (see gps::ShaderPermutations)
 
 layout(location=0) in vec3 vPosition;
 layout(location=1) in vec3 vNormal;
 layout(location=2) in vec2 vTexCoords;
+#ifdef INSTANCED
+// per-instance model matrix, takes locations 3 to 6
+layout(location=3) in mat4 instanceModel;
+#endif
 
-out vec3 fPosition;
-out vec3 fNormal;
+out vec3 fPosEye;
+out vec3 fNormalEye;
 out vec2 fTexCoords;
-out vec4 fragPosLightSpace;
+out float fSunDistance;
+#ifdef SHADOWS
+out vec3 fWorldPosition;
+#endif
 
-uniform mat4 model;
 uniform mat4 view;
 uniform mat4 projection;
-uniform mat4 lightSpaceTrMatrix;
+#ifdef INSTANCED
+#define model instanceModel
+#else
+uniform mat4 model;
+// inverse transpose of view * model, computed once per object
+uniform mat3 normalMatrix;
+#endif
+uniform vec3 sunPosition;
+
+// must match the DEPTH_PREPASS path of depthMapShader.vert for the GL_EQUAL depth test
+invariant gl_Position;
 
 void main() 
 {
-	gl_Position = projection * view * model * vec4(vPosition, 1.0f);
+	vec4 worldPosition = model * vec4(vPosition, 1.0f);
+	vec4 eyePosition = view * worldPosition;
+	gl_Position = projection * eyePosition;
 
-	// Calculate the fragment's position in light space for shadow mapping
-    fragPosLightSpace = lightSpaceTrMatrix * model * vec4(vPosition, 1.0f);
+	// eye space setup for the lighting, done once per vertex instead of once per fragment
+	fPosEye = eyePosition.xyz;
+#ifdef INSTANCED
+	// instances are only rotated and uniformly scaled, the normalize in the fragment shader takes the scale out
+	fNormalEye = mat3(view * model) * vNormal;
+#else
+	fNormalEye = normalMatrix * vNormal;
+#endif
+	// sun attenuation is measured in object space
+	fSunDistance = length(sunPosition - vPosition);
 
-	fPosition = vPosition;
-	fNormal = vNormal;
+#ifdef SHADOWS
+	// World position, projected into the shadow atlas tiles in the fragment shader
+	fWorldPosition = worldPosition.xyz;
+#endif
 	fTexCoords = vTexCoords;
 }
@@ -2,6 +2,18 @@
 
 out vec4 fColor;
 
+#ifdef SHADOW_MOMENTS
+in float linearDepth;
+
+uniform float shadowFar;
+#endif
+
 void main() {
+#ifdef SHADOW_MOMENTS
+    // first two moments of the normalized light distance for variance shadow mapping
+    float depth = linearDepth / shadowFar;
+    fColor = vec4(depth, depth * depth, 0.0f, 0.0f);
+#else
     fColor = vec4(1.0f);
+#endif
 }
@@ -1,10 +1,35 @@
 #version 410 core
 
 layout(location = 0) in vec3 vertexPosition;
-
+#ifdef INSTANCED
+// per-instance model matrix, same locations as basic.vert
+layout(location = 3) in mat4 instanceModel;
+#define model instanceModel
+#else
 uniform mat4 model;
+#endif
+
+#ifdef DEPTH_PREPASS
+// camera depth pre-pass: the lit pass depth tests with GL_EQUAL, so the position has to come out
+// bit-identical to basic.vert, same expression and invariant
+uniform mat4 view;
+uniform mat4 projection;
+
+invariant gl_Position;
+#else
 uniform mat4 lightSpaceMatrix; // Transformation matrix to light space
 
+// distance along the light's view axis, used by the moment (VSM) variant
+out float linearDepth;
+#endif
+
 void main() {
+#ifdef DEPTH_PREPASS
+    vec4 worldPosition = model * vec4(vertexPosition, 1.0f);
+    vec4 eyePosition = view * worldPosition;
+    gl_Position = projection * eyePosition;
+#else
     gl_Position = lightSpaceMatrix * model * vec4(vertexPosition, 1.0);
+    linearDepth = gl_Position.w;
+#endif
 }
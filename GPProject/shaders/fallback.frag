@@ -0,0 +1,13 @@
+#version 410 core
+
+in vec2 fTexCoords;
+
+out vec4 fColor;
+
+uniform sampler2D diffuseTexture;
+
+void main()
+{
+	// flat, unlit texture: cheap to compile, and close enough for the few frames it is on screen
+	fColor = vec4(texture(diffuseTexture, fTexCoords).rgb * 0.5f, 1.0f);
+}
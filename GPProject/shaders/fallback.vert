@@ -0,0 +1,23 @@
+#version 410 core
+
+// drawn while the real permutation of an object is still compiling (see useBasicShader)
+
+layout(location=0) in vec3 vPosition;
+layout(location=2) in vec2 vTexCoords;
+
+out vec2 fTexCoords;
+
+uniform mat4 model;
+uniform mat4 view;
+uniform mat4 projection;
+
+// same position math as basic.vert, so it also passes the GL_EQUAL test after a depth pre-pass
+invariant gl_Position;
+
+void main()
+{
+	vec4 worldPosition = model * vec4(vPosition, 1.0f);
+	vec4 eyePosition = view * worldPosition;
+	gl_Position = projection * eyePosition;
+	fTexCoords = vTexCoords;
+}
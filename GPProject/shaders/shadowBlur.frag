@@ -0,0 +1,30 @@
+#version 410 core
+
+in vec2 localCoords;
+
+out vec4 fColor;
+
+uniform sampler2D source;
+// xy = offset, zw = size of the source region, in source uv
+uniform vec4 sourceRect;
+// one texel of the source along the blur axis
+uniform vec2 direction;
+
+// 5 tap gaussian using linear filtering (9 texel footprint)
+const float offsets[3] = float[](0.0f, 1.3846153846f, 3.2307692308f);
+const float weights[3] = float[](0.2270270270f, 0.3162162162f, 0.0702702703f);
+
+void main() {
+    vec2 texel = 1.0f / vec2(textureSize(source, 0));
+    vec2 regionMin = sourceRect.xy + 0.5f * texel;
+    vec2 regionMax = sourceRect.xy + sourceRect.zw - 0.5f * texel;
+    vec2 uv = sourceRect.xy + localCoords * sourceRect.zw;
+
+    // clamped to the region so neighbouring atlas tiles never bleed in
+    vec4 sum = texture(source, uv) * weights[0];
+    for (int i = 1; i < 3; i++) {
+        sum += texture(source, clamp(uv + direction * offsets[i], regionMin, regionMax)) * weights[i];
+        sum += texture(source, clamp(uv - direction * offsets[i], regionMin, regionMax)) * weights[i];
+    }
+    fColor = sum;
+}
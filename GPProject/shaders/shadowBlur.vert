@@ -0,0 +1,10 @@
+#version 410 core
+
+// fullscreen triangle generated from gl_VertexID, covering the current viewport
+out vec2 localCoords;
+
+void main() {
+    vec2 position = vec2((gl_VertexID << 1) & 2, gl_VertexID & 2);
+    localCoords = position;
+    gl_Position = vec4(position * 2.0f - 1.0f, 0.0f, 1.0f);
+}